@@ -32,23 +32,37 @@ function [varargout] = bart(cmd, varargin);
 	end
 
 	name = tempname;
+	arg_name = name;
+
+	% pass data in shared memory (shm:/name refers to /dev/shm/name)
+	% to avoid disk I/O
+
+	if ~ispc && (7 == exist('/dev/shm', 'dir'))
+		[~, base] = fileparts(name);
+		name = strcat('/dev/shm/bart_', base);
+		arg_name = strcat('shm:/bart_', base);
+	end
 
 	in = cell(1, nargin - 1);
+	in_arg = cell(1, nargin - 1);
 
 	for i=1:nargin - 1,
 		in{i} = strcat(name, 'in', num2str(i));
+		in_arg{i} = strcat(arg_name, 'in', num2str(i));
 		writecfl(in{i}, varargin{i});
 	end
 
-	in_str = sprintf(' %s', in{:});
+	in_str = sprintf(' %s', in_arg{:});
 
 	out = cell(1, nargout);
+	out_arg = cell(1, nargout);
 
 	for i=1:nargout,
 		out{i} = strcat(name, 'out', num2str(i));
+		out_arg{i} = strcat(arg_name, 'out', num2str(i));
 	end
 
-	out_str = sprintf(' %s', out{:});
+	out_str = sprintf(' %s', out_arg{:});
 
 	if ispc
 		% For cygwin use bash and modify paths
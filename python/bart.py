@@ -7,16 +7,17 @@
 
 import subprocess as sp
 import tempfile as tmp
+import uuid
 import cfl
 import os
 
 def bart(cmd='', nargout=0, *args):
 
     if not cmd or not nargout:
-        print "Usage: bart <command> <arguments...>";
+        print("Usage: bart <command> <arguments...>")
         return None
 
-    bart_path = os.environ['TOOLBOX_PATH'] + '/bart ';
+    bart_path = os.environ.get('TOOLBOX_PATH')
 
     if not bart_path:
         if os.path.isfile('/usr/local/bin/bart'):
@@ -26,6 +27,9 @@ def bart(cmd='', nargout=0, *args):
         else:
             raise Exception('Environment variable TOOLBOX_PATH is not set.')
 
+    if cfl.shm_available():
+        return bart_shm(bart_path, cmd, nargout, *args)
+
     name = tmp.NamedTemporaryFile().name
 
     nargin = len(args);
@@ -64,3 +68,51 @@ def bart(cmd='', nargout=0, *args):
         output = output[0]
 
     return output
+
+
+def bart_shm(bart_path, cmd, nargout, *args):
+
+    # Arrays are passed in shared memory ('shm:/name'). Inputs allocated
+    # with cfl.shm_empty are used in place, other inputs are copied into
+    # shared memory once. Outputs are mapped without copying.
+
+    name = 'bart_' + uuid.uuid4().hex
+
+    nargin = len(args)
+    innames = []
+    tmpnames = []
+
+    for idx in range(nargin):
+        elm = cfl.shm_name(args[idx])
+        if elm is None:
+            elm = name + 'in' + str(idx)
+            cfl.writeshm(elm, args[idx])
+            tmpnames.append(elm)
+        else:
+            args[idx].flush()
+            cfl.writeshmhdr(elm, args[idx].shape)
+        innames.append(elm)
+
+    outnames = [name + 'out' + str(idx) for idx in range(nargout)]
+
+    in_str = ' '.join(['shm:/' + elm for elm in innames])
+    out_str = ' '.join(['shm:/' + elm for elm in outnames])
+
+    ERR = os.system(bart_path + '/bart ' + cmd + ' ' + in_str + ' ' + out_str)
+
+    for elm in tmpnames:
+        cfl.removeshm(elm)
+
+    output = []
+    for elm in outnames:
+        if not ERR:
+            output.append(cfl.readshm(elm))
+        cfl.removeshm(elm)
+
+    if ERR:
+        raise Exception("Command exited with an error.")
+
+    if nargout == 1:
+        output = output[0]
+
+    return output
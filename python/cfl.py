@@ -7,6 +7,7 @@
 # 2015 Jonathan Tamir <jtamir@eecs.berkeley.edu>
 
 
+import os
 import numpy as np
 
 def readcfl(name):
@@ -39,3 +40,93 @@ def writecfl(name, array):
     d = open(name + ".cfl", "w")
     array.T.astype(np.complex64).tofile(d) # tranpose for column-major order
     d.close()
+
+
+# Shared memory transport: an array called 'name' lives in the POSIX
+# shared memory objects /name.hdr and /name.cfl (files in /dev/shm on
+# Linux) and is passed to bart as 'shm:/name'.
+
+SHM_DIR = '/dev/shm'
+
+def shm_available():
+    return os.path.isdir(SHM_DIR) and os.access(SHM_DIR, os.W_OK)
+
+
+def _shm_path(name):
+    return os.path.join(SHM_DIR, name.lstrip('/'))
+
+
+def writeshmhdr(name, shape):
+    h = open(_shm_path(name) + ".hdr", "w")
+    h.write('# Dimensions\n')
+    for i in shape:
+            h.write("%d " % i)
+    h.write('\n')
+    h.close()
+
+
+def shm_empty(name, shape):
+    # array in shared memory, can be passed to bart without copying
+    writeshmhdr(name, shape)
+    return np.memmap(_shm_path(name) + ".cfl", dtype=np.complex64, mode='w+', shape=tuple(shape), order='F')
+
+
+def writeshm(name, array):
+    a = shm_empty(name, array.shape)
+    a[...] = array
+    a.flush()
+    del a
+
+
+def shm_name(array):
+    # name of the shared memory object backing array (or None)
+    if not isinstance(array, np.memmap) or array.filename is None:
+        return None
+
+    path = os.path.realpath(array.filename)
+
+    if os.path.dirname(path) != os.path.realpath(SHM_DIR) or not path.endswith('.cfl'):
+        return None
+
+    if array.dtype != np.complex64 or not array.flags.f_contiguous:
+        return None
+
+    # outputs of bart() are mapped after the object was removed,
+    # so these are copied into a new object
+    if not os.path.exists(path):
+        return None
+
+    # must be a view of the complete object
+    mm = getattr(array, '_mmap', None)
+
+    if mm is None or array.nbytes != os.path.getsize(path):
+        return None
+
+    start = np.frombuffer(mm, dtype=np.uint8).__array_interface__['data'][0]
+
+    if start != array.__array_interface__['data'][0]:
+        return None
+
+    return os.path.basename(path)[:-len('.cfl')]
+
+
+def readshm(name):
+    # maps the data without copying
+    h = open(_shm_path(name) + ".hdr", "r")
+    h.readline() # skip
+    l = h.readline()
+    h.close()
+    dims = [int(i) for i in l.split( )]
+
+    # remove singleton dimensions from the end
+    n = np.prod(dims)
+    dims_prod = np.cumprod(dims)
+    dims = dims[:np.searchsorted(dims_prod, n)+1]
+
+    return np.memmap(_shm_path(name) + ".cfl", dtype=np.complex64, mode='r+', shape=tuple(dims), order='F')
+
+
+def removeshm(name):
+    for ext in ['.hdr', '.cfl']:
+        if os.path.isfile(_shm_path(name) + ext):
+            os.remove(_shm_path(name) + ext)
@@ -13,15 +13,23 @@
 #include <complex.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "num/multind.h"
 #include "num/flpmath.h"
 #include "num/rand.h"
 #include "num/init.h"
 #include "num/ops.h"
+#include "num/lapack.h"
+#include "num/optimize.h"
+
+#include "linops/linop.h"
+
+#include "noncart/nufft.h"
 
 #include "wavelet2/wavelet.h"
 #include "wavelet3/wavthresh.h"
+#include "wavelet3/wavelet.h"
 
 #include "misc/debug.h"
 #include "misc/misc.h"
@@ -288,53 +296,101 @@ static double bench_sumf(long scale)
 }
 
 
-static double bench_transpose(long scale)
+static double bench_generic_transpose(long dims[DIMS], unsigned int dim1, unsigned int dim2, bool blocking)
 {
-	long dims[DIMS] = { 2000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+	long odims[DIMS];
+	md_transpose_dims(DIMS, dim1, dim2, odims, dims);
 
 	complex float* x = md_alloc(DIMS, dims, CFL_SIZE);
-	complex float* y = md_alloc(DIMS, dims, CFL_SIZE);
+	complex float* y = md_alloc(DIMS, odims, CFL_SIZE);
 	
 	md_gaussian_rand(DIMS, dims, x);
-	md_clear(DIMS, dims, y, CFL_SIZE);
+	md_clear(DIMS, odims, y, CFL_SIZE);
+
+	if (!blocking)
+		num_set_block_size(-1);
 
 	double tic = timestamp();
 
-	md_transpose(DIMS, 0, 1, dims, y, dims, x, CFL_SIZE);
+	md_transpose(DIMS, dim1, dim2, odims, y, dims, x, CFL_SIZE);
 
 	double toc = timestamp();
 
+	num_set_block_size(0);
+
 	md_free(x);
 	md_free(y);
 	
 	return toc - tic;
 }
 
+static double bench_transpose(long scale)
+{
+	long dims[DIMS] = { 2000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+	return bench_generic_transpose(dims, 0, 1, true);
+}
 
+static double bench_transpose_noblock(long scale)
+{
+	long dims[DIMS] = { 2000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+	return bench_generic_transpose(dims, 0, 1, false);
+}
 
-static double bench_resize(long scale)
+static double bench_transpose_coils(long scale)
 {
-	long dimsX[DIMS] = { 2000 * scale, 1000 * scale, 1, 1, 1, 1, 1, 1 };
-	long dimsY[DIMS] = { 1000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+	long dims[DIMS] = { 8, 256 * scale, 256 * scale, 1, 1, 1, 1, 1 };
+	return bench_generic_transpose(dims, 0, 3, true);
+}
+
+static double bench_transpose_coils_noblock(long scale)
+{
+	long dims[DIMS] = { 8, 256 * scale, 256 * scale, 1, 1, 1, 1, 1 };
+	return bench_generic_transpose(dims, 0, 3, false);
+}
+
 
+
+static double bench_generic_resize(long dimsX[DIMS], long dimsY[DIMS], bool blocking)
+{
 	complex float* x = md_alloc(DIMS, dimsX, CFL_SIZE);
 	complex float* y = md_alloc(DIMS, dimsY, CFL_SIZE);
 	
 	md_gaussian_rand(DIMS, dimsX, x);
 	md_clear(DIMS, dimsY, y, CFL_SIZE);
 
+	if (!blocking)
+		num_set_block_size(-1);
+
 	double tic = timestamp();
 
 	md_resize(DIMS, dimsY, y, dimsX, x, CFL_SIZE);
 
 	double toc = timestamp();
 
+	num_set_block_size(0);
+
 	md_free(x);
 	md_free(y);
 	
 	return toc - tic;
 }
 
+static double bench_resize(long scale)
+{
+	long dimsX[DIMS] = { 2000 * scale, 1000 * scale, 1, 1, 1, 1, 1, 1 };
+	long dimsY[DIMS] = { 1000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+
+	return bench_generic_resize(dimsX, dimsY, true);
+}
+
+static double bench_resize_noblock(long scale)
+{
+	long dimsX[DIMS] = { 2000 * scale, 1000 * scale, 1, 1, 1, 1, 1, 1 };
+	long dimsY[DIMS] = { 1000 * scale, 2000 * scale, 1, 1, 1, 1, 1, 1 };
+
+	return bench_generic_resize(dimsX, dimsY, false);
+}
+
 
 static double bench_norm(int s, long scale)
 {
@@ -443,6 +499,293 @@ static double bench_wavelet3(long scale)
 }
 
 
+/*
+ * Forward and inverse transform (wavelet3) with a given filter.
+ */
+static double bench_wavelet3_transform(long flen, const float filter[2][2][flen], long scale)
+{
+	long dims[DIMS] = { 1, 256 * scale, 256 * scale, 1, 16, 1, 1, 1 };
+	long minsize[DIMS] = { [0 ... DIMS - 1] = 1 };
+	minsize[1] = MIN(dims[1], 16);
+	minsize[2] = MIN(dims[2], 16);
+
+	long strs[DIMS];
+	md_calc_strides(DIMS, strs, dims, CFL_SIZE);
+
+	long shifts[DIMS] = { 0 };
+	long coeffs = wavelet_coeffs(DIMS, 6, dims, minsize, flen);
+
+	complex float* x = md_alloc(DIMS, dims, CFL_SIZE);
+	complex float* w = md_alloc(1, MD_DIMS(coeffs), CFL_SIZE);
+
+	md_gaussian_rand(DIMS, dims, x);
+
+	double tic = timestamp();
+
+	fwt(DIMS, 6, shifts, dims, w, strs, x, minsize, flen, filter);
+	iwt(DIMS, 6, shifts, dims, strs, x, w, minsize, flen, filter);
+
+	double toc = timestamp();
+
+	md_free(x);
+	md_free(w);
+
+	return toc - tic;
+}
+
+static double bench_wavelet3_haar(long scale)
+{
+	return bench_wavelet3_transform(2, wavelet3_haar, scale);
+}
+
+static double bench_wavelet3_dau2(long scale)
+{
+	return bench_wavelet3_transform(4, wavelet3_dau2, scale);
+}
+
+static double bench_wavelet3_cdf44(long scale)
+{
+	return bench_wavelet3_transform(10, wavelet3_cdf44, scale);
+}
+
+
+static double bench_svthresh(enum svthresh_alg alg, long scale)
+{
+	long M = 64;
+	long N = 8;
+	long B = 4096 * scale;
+	long dims[DIMS] = { M, N, B, 1, 1, 1, 1, 1 };
+
+	complex float* x = md_alloc(DIMS, dims, CFL_SIZE);
+
+	md_gaussian_rand(DIMS, dims, x);
+
+	double tic = timestamp();
+
+	batch_svthresh2(M, N, B, 8., x, x, alg);
+
+	double toc = timestamp();
+
+	debug_printf(DP_DEBUG1, "%.0f blocks/s\n", B / (toc - tic));
+
+	md_free(x);
+
+	return toc - tic;
+}
+
+static double bench_svthresh_svd(long scale)
+{
+	return bench_svthresh(SVT_SVD, scale);
+}
+
+static double bench_svthresh_gram(long scale)
+{
+	return bench_svthresh(SVT_GRAM, scale);
+}
+
+/*
+ * Compare the Gram-matrix thresholding to the SVD for blocks whose
+ * singular values span several orders of magnitude.
+ */
+static double bench_svthresh_accuracy(long scale)
+{
+	UNUSED(scale);
+
+	long M = 64;
+	long N = 8;
+	long B = 256;
+	long dims[DIMS] = { M, N, B, 1, 1, 1, 1, 1 };
+
+	complex float* x = md_alloc(DIMS, dims, CFL_SIZE);
+	complex float* y = md_alloc(DIMS, dims, CFL_SIZE);
+	complex float* z = md_alloc(DIMS, dims, CFL_SIZE);
+
+	md_gaussian_rand(DIMS, dims, x);
+
+	for (long b = 0; b < B; b++)
+		for (long n = 0; n < N; n++)
+			for (long m = 0; m < M; m++)
+				x[(b * N + n) * M + m] *= powf(10., -0.5 * n);
+
+	double tic = timestamp();
+
+	md_copy(DIMS, dims, z, x, CFL_SIZE);
+	batch_svthresh2(M, N, B, 1.E-3, y, z, SVT_SVD);
+
+	md_copy(DIMS, dims, z, x, CFL_SIZE);
+	batch_svthresh2(M, N, B, 1.E-3, z, z, SVT_GRAM);
+
+	double toc = timestamp();
+
+	float err = md_znrmse(DIMS, dims, y, z);
+
+	debug_printf(DP_INFO, "svthresh Gram vs. SVD: rel. error: %.2e\n", err);
+
+	md_free(x);
+	md_free(y);
+	md_free(z);
+
+	return toc - tic;
+}
+
+
+static void nufft_random_traj(long N, const long trj_dims[DIMS], complex float* trj)
+{
+	num_rand_init(1);
+
+	// gridding does not wrap around, so stay away from the edge of k-space
+
+	md_uniform_rand(DIMS, trj_dims, trj);
+
+	for (long i = 0; i < md_calc_size(DIMS, trj_dims); i++)
+		trj[i] = (N - 8) * (crealf(trj[i]) - 0.5);
+}
+
+
+/*
+ * Forward and adjoint 3D NUFFT with a given oversampling factor.
+ */
+static double bench_nufft(float os, long scale)
+{
+	long N = 64 * scale;
+	long img_dims[DIMS] = { N, N, N, 1, 1, 1, 1, 1 };
+	long ksp_dims[DIMS] = { 1, N * N, N, 1, 1, 1, 1, 1 };
+	long trj_dims[DIMS] = { 3, N * N, N, 1, 1, 1, 1, 1 };
+
+	complex float* img = md_alloc(DIMS, img_dims, CFL_SIZE);
+	complex float* ksp = md_alloc(DIMS, ksp_dims, CFL_SIZE);
+	complex float* trj = md_alloc(DIMS, trj_dims, CFL_SIZE);
+
+	md_gaussian_rand(DIMS, img_dims, img);
+
+	nufft_random_traj(N, trj_dims, trj);
+
+	struct nufft_conf_s conf = nufft_conf_defaults;
+	conf.os = os;
+
+	const struct linop_s* op = nufft_create(DIMS, ksp_dims, img_dims, trj_dims, trj, NULL, conf, false);
+
+	double tic = timestamp();
+
+	linop_forward(op, DIMS, ksp_dims, ksp, DIMS, img_dims, img);
+	linop_adjoint(op, DIMS, img_dims, img, DIMS, ksp_dims, ksp);
+
+	double toc = timestamp();
+
+	linop_free(op);
+
+	md_free(img);
+	md_free(ksp);
+	md_free(trj);
+
+	return toc - tic;
+}
+
+
+/*
+ * Compare the forward NUFFT of a small image to a unitary centered
+ * DFT. The NUFFT has a fixed scale relative to the DFT, so the error
+ * is computed after the least-squares scale is applied. The scale is
+ * reported as well, so different oversampling factors can be checked
+ * for the same normalization.
+ */
+static void nufft_accuracy(float os)
+{
+	long N = 32;
+	long K = 256;
+	long img_dims[DIMS] = { N, N, N, 1, 1, 1, 1, 1 };
+	long ksp_dims[DIMS] = { 1, K, 1, 1, 1, 1, 1, 1 };
+	long trj_dims[DIMS] = { 3, K, 1, 1, 1, 1, 1, 1 };
+
+	complex float* img = md_alloc(DIMS, img_dims, CFL_SIZE);
+	complex float* ksp = md_alloc(DIMS, ksp_dims, CFL_SIZE);
+	complex float* trj = md_alloc(DIMS, trj_dims, CFL_SIZE);
+
+	md_gaussian_rand(DIMS, img_dims, img);
+
+	nufft_random_traj(N, trj_dims, trj);
+
+	struct nufft_conf_s conf = nufft_conf_defaults;
+	conf.os = os;
+
+	const struct linop_s* op = nufft_create(DIMS, ksp_dims, img_dims, trj_dims, trj, NULL, conf, false);
+
+	linop_forward(op, DIMS, ksp_dims, ksp, DIMS, img_dims, img);
+
+	linop_free(op);
+
+	complex double ref[K];
+
+	double rr = 0.;
+	complex double kr = 0.;
+
+	for (long k = 0; k < K; k++) {
+
+		ref[k] = 0.;
+
+		for (long z = 0; z < N; z++)
+			for (long y = 0; y < N; y++)
+				for (long x = 0; x < N; x++) {
+
+					double ph = crealf(trj[3 * k + 0]) * (x - N / 2)
+						  + crealf(trj[3 * k + 1]) * (y - N / 2)
+						  + crealf(trj[3 * k + 2]) * (z - N / 2);
+
+					ref[k] += img[(z * N + y) * N + x] * cexp(-2.i * M_PI * ph / N);
+				}
+
+		ref[k] /= sqrt(N * N * N);
+
+		rr += pow(cabs(ref[k]), 2.);
+		kr += conj(ref[k]) * ksp[k];
+	}
+
+	complex double sc = kr / rr;
+
+	double ee = 0.;
+
+	for (long k = 0; k < K; k++)
+		ee += pow(cabs(ksp[k] - sc * ref[k]), 2.);
+
+	debug_printf(DP_INFO, "NUFFT %.2fx: rel. error vs. DFT: %.2e, scale: %.4f%+.4fi\n",
+			os, sqrt(ee / (pow(cabs(sc), 2.) * rr)), creal(sc), cimag(sc));
+
+	md_free(img);
+	md_free(ksp);
+	md_free(trj);
+}
+
+static double bench_nufft_accuracy(long scale)
+{
+	UNUSED(scale);
+
+	double tic = timestamp();
+
+	nufft_accuracy(2.);
+	nufft_accuracy(1.5);
+	nufft_accuracy(1.25);
+
+	double toc = timestamp();
+
+	return toc - tic;
+}
+
+static double bench_nufft_2(long scale)
+{
+	return bench_nufft(2., scale);
+}
+
+static double bench_nufft_15(long scale)
+{
+	return bench_nufft(1.5, scale);
+}
+
+static double bench_nufft_125(long scale)
+{
+	return bench_nufft(1.25, scale);
+}
+
+
 enum bench_indices { REPETITION_IND, SCALE_IND, THREADS_IND, TESTS_IND, BENCH_DIMS };
 
 typedef double (*bench_fun)(long scale);
@@ -487,7 +830,11 @@ const struct benchmark_s {
 	{ bench_sum2,   	"sum (md_zaxpy), contiguous" },
 	{ bench_sumf,   	"sum (for loop)" },
 	{ bench_transpose,	"complex transpose" },
+	{ bench_transpose_noblock,	"complex transpose (no blocking)" },
+	{ bench_transpose_coils,	"coil transpose" },
+	{ bench_transpose_coils_noblock,	"coil transpose (no blocking)" },
 	{ bench_resize,   	"complex resize" },
+	{ bench_resize_noblock,	"complex resize (no blocking)" },
 	{ bench_matrix_mult,	"complex matrix multiply" },
 	{ bench_batch_matmul1,	"batch matrix multiply 1" },
 	{ bench_batch_matmul2,	"batch matrix multiply 2" },
@@ -502,6 +849,16 @@ const struct benchmark_s {
 	{ bench_copy2,		"copy 2" },
 	{ bench_wavelet2,	"wavelet soft thresh" },
 	{ bench_wavelet3,	"wavelet soft thresh" },
+	{ bench_wavelet3_haar,	"wavelet fwt+iwt (Haar)" },
+	{ bench_wavelet3_dau2,	"wavelet fwt+iwt (Daubechies 2)" },
+	{ bench_wavelet3_cdf44,	"wavelet fwt+iwt (CDF 4/4)" },
+	{ bench_svthresh_svd,	"batch svthresh (SVD)" },
+	{ bench_svthresh_gram,	"batch svthresh (Gram)" },
+	{ bench_svthresh_accuracy,	"batch svthresh accuracy" },
+	{ bench_nufft_2,	"nufft 2x grid" },
+	{ bench_nufft_15,	"nufft 1.5x grid" },
+	{ bench_nufft_125,	"nufft 1.25x grid" },
+	{ bench_nufft_accuracy,	"nufft accuracy (vs. DFT)" },
 };
 
 
@@ -514,10 +871,12 @@ int main_bench(int argc, char* argv[])
 {
 	bool threads = false;
 	bool scaling = false;
+	bool tune = false;
 
 	const struct opt_s opts[] = {
 		{ 'T', false, opt_set, &threads, "\tvarying number of threads" },
 		{ 'S', false, opt_set, &scaling, "\tvarying problem size" },
+		{ 'B', false, opt_set, &tune, "\ttune cache blocking for this machine" },
 	};
 
 	cmdline(&argc, argv, 0, 1, usage_str, help_str, ARRAY_SIZE(opts), opts);
@@ -538,6 +897,9 @@ int main_bench(int argc, char* argv[])
 
 	num_init();
 
+	if (tune)
+		num_tune_blocking();
+
 	do {
 		if (threads) {
 
@@ -0,0 +1,202 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ *
+ *
+ * On-disk cache for intermediate results of the calibration.
+ *
+ * Entries are identified by a kind (e.g. "kernels") and a 64-bit
+ * key, which is a hash (FNV-1a) of everything the result depends on:
+ * parameters, dimensions and the calibration data itself. Each entry
+ * is one file <dir>/<kind>-<key>.dat with a small header that repeats
+ * the key and the size of the payload, so that truncated or foreign
+ * files are treated as misses.
+ *
+ * New entries are written to a temporary file first and then renamed,
+ * so that concurrent processes (e.g. a batch of ecalib calls sharing
+ * a directory) never read a partially written entry.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "calcache.h"
+
+
+#define CALCACHE_MAGIC "BARTCC01"
+
+struct calcache_header_s {
+
+	char magic[8];
+	uint64_t key;
+	uint64_t size;
+};
+
+static long calcache_hits = 0;
+static long calcache_misses = 0;
+
+
+
+/*
+ * The directory given on the command line takes precedence
+ * over BART_CALIB_CACHE. No caching if neither is set.
+ */
+const char* calcache_dir(const char* dir)
+{
+	if (NULL != dir)
+		return dir;
+
+	return getenv("BART_CALIB_CACHE");
+}
+
+
+uint64_t calcache_hash(uint64_t hash, size_t size, const void* data)
+{
+	const unsigned char* p = data;
+
+	for (size_t i = 0; i < size; i++) {
+
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+
+static char* calcache_file(const char* dir, const char* kind, uint64_t key)
+{
+	char* name = xmalloc(strlen(dir) + strlen(kind) + 32);
+	sprintf(name, "%s/%s-%016llx.dat", dir, kind, (unsigned long long)key);
+
+	return name;
+}
+
+
+void calcache_stats(long* hits, long* misses)
+{
+	*hits = calcache_hits;
+	*misses = calcache_misses;
+}
+
+
+/*
+ * Returns the payload of an entry (allocated with xmalloc) and
+ * its size, or NULL if there is no valid entry.
+ */
+void* calcache_load(const char* dir, const char* kind, uint64_t key, size_t* size)
+{
+	char* name = calcache_file(dir, kind, key);
+	FILE* fp = fopen(name, "rb");
+
+	void* data = NULL;
+	struct calcache_header_s hdr;
+
+	if (NULL == fp)
+		goto out;
+
+	if (   (1 != fread(&hdr, sizeof(hdr), 1, fp))
+	    || (0 != memcmp(hdr.magic, CALCACHE_MAGIC, 8))
+	    || (key != hdr.key)) {
+
+		debug_printf(DP_WARN, "Calibration cache: ignoring invalid entry %s.\n", name);
+		goto out;
+	}
+
+	long pos = ftell(fp);
+
+	if ((0 != fseek(fp, 0, SEEK_END)) || (ftell(fp) - pos != (long)hdr.size) || (0 != fseek(fp, pos, SEEK_SET))) {
+
+		debug_printf(DP_WARN, "Calibration cache: ignoring truncated entry %s.\n", name);
+		goto out;
+	}
+
+	data = xmalloc(MAX(hdr.size, (uint64_t)1));
+
+	if (hdr.size != fread(data, 1, hdr.size, fp)) {
+
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	*size = hdr.size;
+
+out:
+	if (NULL != fp)
+		fclose(fp);
+
+	if (NULL != data) {
+
+		#pragma omp atomic
+		calcache_hits++;
+
+	} else {
+
+		#pragma omp atomic
+		calcache_misses++;
+	}
+
+	debug_printf(DP_DEBUG1, "Calibration cache: %s %s-%016llx\n", (NULL != data) ? "hit" : "miss", kind, (unsigned long long)key);
+
+	free(name);
+
+	return data;
+}
+
+
+/*
+ * Stores the concatenation of N arrays as one entry.
+ * Failures are reported but are not fatal.
+ */
+void calcache_save(const char* dir, const char* kind, uint64_t key, unsigned int N, const size_t sizes[N], const void* data[N])
+{
+	if ((0 != mkdir(dir, 0777)) && (EEXIST != errno)) {
+
+		debug_printf(DP_WARN, "Calibration cache: could not create %s.\n", dir);
+		return;
+	}
+
+	char* name = calcache_file(dir, kind, key);
+	char* tmp = xmalloc(strlen(name) + 32);
+	sprintf(tmp, "%s.%ld", name, (long)getpid());
+
+	struct calcache_header_s hdr = { .key = key, .size = 0 };
+	memcpy(hdr.magic, CALCACHE_MAGIC, 8);
+
+	for (unsigned int i = 0; i < N; i++)
+		hdr.size += sizes[i];
+
+	FILE* fp = fopen(tmp, "wb");
+	bool ok = (NULL != fp) && (1 == fwrite(&hdr, sizeof(hdr), 1, fp));
+
+	for (unsigned int i = 0; ok && (i < N); i++)
+		ok = (sizes[i] == fwrite(data[i], 1, sizes[i], fp));
+
+	if (NULL != fp)
+		ok = (0 == fclose(fp)) && ok;
+
+	if (ok && (0 == rename(tmp, name))) {
+
+		debug_printf(DP_DEBUG1, "Calibration cache: saved %s\n", name);
+
+	} else {
+
+		debug_printf(DP_WARN, "Calibration cache: could not save %s.\n", name);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(name);
+}
+
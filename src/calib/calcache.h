@@ -0,0 +1,27 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ */
+
+#ifndef __CALCACHE_H
+#define __CALCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "misc/cppwrap.h"
+
+#define CALCACHE_SEED 0xCBF29CE484222325ULL
+
+extern const char* calcache_dir(const char* dir);
+
+extern uint64_t calcache_hash(uint64_t hash, size_t size, const void* data);
+
+extern void* calcache_load(const char* dir, const char* kind, uint64_t key, size_t* size);
+extern void calcache_save(const char* dir, const char* kind, uint64_t key, unsigned int N, const size_t sizes[__VLA(N)], const void* data[__VLA(N)]);
+
+extern void calcache_stats(long* hits, long* misses);
+
+#include "misc/cppwrap.h"
+
+#endif	// __CALCACHE_H
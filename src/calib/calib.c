@@ -19,6 +19,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "num/multind.h"
 #include "num/fft.h"
@@ -37,6 +39,7 @@
 #include "calib/calmat.h"
 #include "calib/cc.h"
 #include "calib/softweight.h"
+#include "calib/calcache.h"
 
 #include "calib.h"
 
@@ -53,23 +56,112 @@
 #endif
 
 
-static void eigen_herm3(int M, int N, float val[M], complex float matrix[N][N]) // ordering might be different to herm2
+// number of voxels processed together by orthiter_batch
+#define EIG_BLK 32
+
+/*
+ * Orthogonal iteration (as orthiter in num/la.c) for a batch of
+ * Hermitian matrices in packed lower-triangular form. The batch is the innermost
+ * dimension of all arrays, the real and imaginary parts are stored
+ * separately, so all operations are vectorized across the batch.
+ */
+VEC_CLONES
+static void orthiter_batch(int M, int N, int iter, float val[M][EIG_BLK],
+		float vr[M][N][EIG_BLK], float vi[M][N][EIG_BLK],
+		const float ar[][EIG_BLK], const float ai[][EIG_BLK])
 {
-	complex float mout[M][N];
+	float tr[M][N][EIG_BLK];
+	float ti[M][N][EIG_BLK];
 
-	for (int li = 0; li < N; li++)
-		for (int lj = 0; lj < li; lj++)
-			matrix[lj][li] = conj(matrix[li][lj]);
+	for (int i = 0; i < M; i++) {
+		for (int j = 0; j < N; j++) {
+			for (int b = 0; b < EIG_BLK; b++) {
 
-	//mat_identity(M, N, mout);
-	orthiter(M, N, 30, val, mout, matrix);
+				vr[i][j][b] = (i == j) ? 1. : 0.;
+				vi[i][j][b] = 0.;
+			}
+		}
+	}
 
-	for (int i = 0; i < M; i++)
-		for (int j = 0; j < N; j++)
-			matrix[i][j] = mout[i][j];
-}
+	for (int n = 0; n < iter; n++) {
+
+		memcpy(tr, vr, sizeof(tr));
+		memcpy(ti, vi, sizeof(ti));
+
+		// v_i = t_i A, where A[k][j] = conj(A[j][k]),
+		// each element of A is loaded once for all vectors
+
+		memset(vr, 0, sizeof(tr));
+		memset(vi, 0, sizeof(ti));
+
+		for (int k = 0; k < N; k++) {
+			for (int j = 0; j < N; j++) {
+
+				bool lower = (k >= j);
+				int l = lower ? (k * (k + 1) / 2 + j) : (j * (j + 1) / 2 + k);
+				float s = lower ? 1. : -1.;
+
+				for (int i = 0; i < M; i++) {
+					for (int b = 0; b < EIG_BLK; b++) {
+
+						float pr = ar[l][b];
+						float pi = s * ai[l][b];
+
+						vr[i][j][b] += tr[i][k][b] * pr - ti[i][k][b] * pi;
+						vi[i][j][b] += tr[i][k][b] * pi + ti[i][k][b] * pr;
+					}
+				}
+			}
+		}
+
+		// Gram-Schmidt, starting with the last vector (as gram_schmidt)
+
+		for (int m = M - 1; m >= 0; m--) {
+
+			for (int j = m + 1; j < M; j++) {
+
+				float dr[EIG_BLK] = { 0. };
+				float di[EIG_BLK] = { 0. };
+
+				for (int k = 0; k < N; k++) {
+					for (int b = 0; b < EIG_BLK; b++) {
+
+						dr[b] += vr[m][k][b] * vr[j][k][b] + vi[m][k][b] * vi[j][k][b];
+						di[b] += vi[m][k][b] * vr[j][k][b] - vr[m][k][b] * vi[j][k][b];
+					}
+				}
+
+				for (int k = 0; k < N; k++) {
+					for (int b = 0; b < EIG_BLK; b++) {
+
+						float xr = vr[j][k][b];
+						float xi = vi[j][k][b];
+
+						vr[m][k][b] -= dr[b] * xr - di[b] * xi;
+						vi[m][k][b] -= dr[b] * xi + di[b] * xr;
+					}
+				}
+			}
 
+			float nrm[EIG_BLK] = { 0. };
 
+			for (int k = 0; k < N; k++)
+				for (int b = 0; b < EIG_BLK; b++)
+					nrm[b] += vr[m][k][b] * vr[m][k][b] + vi[m][k][b] * vi[m][k][b];
+
+			for (int b = 0; b < EIG_BLK; b++)
+				val[m][b] = sqrtf(nrm[b]);
+
+			for (int k = 0; k < N; k++) {
+				for (int b = 0; b < EIG_BLK; b++) {
+
+					vr[m][k][b] /= val[m][b];
+					vi[m][k][b] /= val[m][b];
+				}
+			}
+		}
+	}
+}
 
 
 
@@ -139,6 +231,134 @@ void crop_sens(const long dims[DIMS], complex float* ptr, bool soft, float crth,
 
 
 
+/*
+ * The kernels and the image-space covariance are kept in the
+ * calibration cache (if enabled), so that repeated calibrations
+ * with the same data (e.g. a calibration region shared by several
+ * frames) skip the SVD and the Gram matrices.
+ */
+static uint64_t kernels_key(const struct ecalib_conf* conf, const long caldims[DIMS], const complex float* caldata)
+{
+	uint64_t key = CALCACHE_SEED;
+
+	key = calcache_hash(key, sizeof(conf->kdims), conf->kdims);
+	key = calcache_hash(key, sizeof(conf->threshold), &conf->threshold);
+	key = calcache_hash(key, sizeof(conf->numsv), &conf->numsv);
+	key = calcache_hash(key, sizeof(conf->percentsv), &conf->percentsv);
+	key = calcache_hash(key, sizeof(conf->weighting), &conf->weighting);
+	key = calcache_hash(key, DIMS * sizeof(long), caldims);
+	key = calcache_hash(key, md_calc_size(DIMS, caldims) * CFL_SIZE, caldata);
+
+	return key;
+}
+
+
+static void cached_kernels(const struct ecalib_conf* conf, long nskerns_dims[5], complex float** nskerns_ptr, unsigned int SN, float svals[SN], const long caldims[DIMS], const complex float* caldata)
+{
+	const char* dir = calcache_dir(conf->cache);
+
+	// perturbation draws random numbers
+
+	if ((NULL == dir) || (conf->perturb > 0.)) {
+
+		compute_kernels(conf, nskerns_dims, nskerns_ptr, SN, svals, caldims, caldata);
+		return;
+	}
+
+	long N = conf->kdims[0] * conf->kdims[1] * conf->kdims[2] * caldims[3];
+
+	assert((NULL == svals) || (SN == N));
+
+	uint64_t key = kernels_key(conf, caldims, caldata);
+
+	// layout: nskerns_dims[5], svals[N], nskerns[nskerns_dims[4]][N]
+
+	size_t hsize = 5 * sizeof(long) + N * FL_SIZE;
+	size_t size;
+	char* buf = calcache_load(dir, "kernels", key, &size);
+
+	if (NULL != buf) {
+
+		// the header has to be complete before it is read
+
+		long dims[5] = { 0 };
+
+		if (size >= hsize)
+			memcpy(dims, buf, sizeof(dims));
+
+		if ((size >= hsize) && (N == md_calc_size(4, dims)) && (dims[4] <= N) && (size == hsize + dims[4] * N * CFL_SIZE)) {
+
+			md_copy_dims(5, nskerns_dims, dims);
+			nskerns_dims[4] = N;
+
+			*nskerns_ptr = md_alloc(5, nskerns_dims, CFL_SIZE);
+			memcpy(*nskerns_ptr, buf + hsize, dims[4] * N * CFL_SIZE);
+
+			nskerns_dims[4] = dims[4];
+
+			if (NULL != svals)
+				memcpy(svals, buf + 5 * sizeof(long), N * FL_SIZE);
+
+			free(buf);
+			return;
+		}
+
+		free(buf);
+	}
+
+	float* val = (NULL != svals) ? svals : xmalloc(N * FL_SIZE);
+
+	compute_kernels(conf, nskerns_dims, nskerns_ptr, N, val, caldims, caldata);
+
+	const size_t sizes[3] = { 5 * sizeof(long), N * FL_SIZE, nskerns_dims[4] * N * CFL_SIZE };
+	const void* data[3] = { nskerns_dims, val, *nskerns_ptr };
+
+	calcache_save(dir, "kernels", key, 3, sizes, data);
+
+	if (NULL == svals)
+		free(val);
+}
+
+
+static void cached_imgcov(const struct ecalib_conf* conf, const long cov_dims[4], complex float* imgcov, const long nskerns_dims[5], const complex float* nskerns)
+{
+	const char* dir = calcache_dir(conf->cache);
+
+	if (NULL == dir) {
+
+		compute_imgcov(cov_dims, imgcov, nskerns_dims, nskerns);
+		return;
+	}
+
+	uint64_t key = CALCACHE_SEED;
+
+	key = calcache_hash(key, 4 * sizeof(long), cov_dims);
+	key = calcache_hash(key, 5 * sizeof(long), nskerns_dims);
+	key = calcache_hash(key, md_calc_size(5, nskerns_dims) * CFL_SIZE, nskerns);
+
+	size_t csize = md_calc_size(4, cov_dims) * CFL_SIZE;
+	size_t size;
+	void* buf = calcache_load(dir, "imgcov", key, &size);
+
+	if (NULL != buf) {
+
+		if (size == csize)
+			memcpy(imgcov, buf, csize);
+
+		free(buf);
+
+		if (size == csize)
+			return;
+	}
+
+	compute_imgcov(cov_dims, imgcov, nskerns_dims, nskerns);
+
+	const void* data[1] = { imgcov };
+	calcache_save(dir, "imgcov", key, 1, &csize, data);
+}
+
+
+
 void calone(const struct ecalib_conf* conf, const long cov_dims[4], complex float* imgcov, unsigned int SN, float svals[SN], const long calreg_dims[DIMS], const complex float* data)
 {
 	assert(1 == md_calc_size(DIMS - 5, calreg_dims + 5));
@@ -146,7 +366,7 @@ void calone(const struct ecalib_conf* conf, const long cov_dims[4], complex floa
 #if 1
 	long nskerns_dims[5];
 	complex float* nskerns;
-	compute_kernels(conf, nskerns_dims, &nskerns, SN, svals, calreg_dims, data);
+	cached_kernels(conf, nskerns_dims, &nskerns, SN, svals, calreg_dims, data);
 #else
 	long channels = calreg_dims[3];
 
@@ -167,7 +387,7 @@ void calone(const struct ecalib_conf* conf, const long cov_dims[4], complex floa
 	spirit_kernel(nskerns_dims, nskerns, calreg_dims, data);
 #endif
 
-	compute_imgcov(cov_dims, imgcov, nskerns_dims, nskerns);
+	cached_imgcov(conf, cov_dims, imgcov, nskerns_dims, nskerns);
 
 	md_free(nskerns);
 }
@@ -179,6 +399,82 @@ void calone(const struct ecalib_conf* conf, const long cov_dims[4], complex floa
 
 
 
+/*
+ * Point-wise maps with orthogonal iteration for batches of EIG_BLK
+ * voxels. The covariance matrices and the maps are stored
+ * with the voxels as the innermost dimension, so a batch is gathered
+ * from (and scattered to) contiguous rows.
+ */
+static void eigenmaps_batch(const long out_dims[DIMS], complex float* optr, complex float* eptr, const complex float* imgcov2, const bool* msk)
+{
+	int channels = out_dims[3];
+	int maps = out_dims[4];
+	int L = channels * (channels + 1) / 2;
+
+	long V = md_calc_size(3, out_dims);
+
+	// voxels inside the mask
+
+	long* idx = xmalloc(V * sizeof(long));
+	long nr = 0;
+
+	for (long v = 0; v < V; v++)
+		if (!msk || msk[v])
+			idx[nr++] = v;
+
+	#pragma omp parallel
+	{
+		float (*ar)[EIG_BLK] = xmalloc(L * sizeof(*ar));
+		float (*ai)[EIG_BLK] = xmalloc(L * sizeof(*ai));
+
+		float val[maps][EIG_BLK];
+		float (*vr)[channels][EIG_BLK] = xmalloc(maps * sizeof(*vr));
+		float (*vi)[channels][EIG_BLK] = xmalloc(maps * sizeof(*vi));
+
+		#pragma omp for schedule(dynamic)
+		for (long o = 0; o < nr; o += EIG_BLK) {
+
+			int B = MIN(EIG_BLK, nr - o);
+
+			// unused lanes repeat the first voxel
+
+			for (int l = 0; l < L; l++) {
+				for (int b = 0; b < EIG_BLK; b++) {
+
+					complex float c = imgcov2[l * V + idx[o + ((b < B) ? b : 0)]];
+
+					ar[l][b] = crealf(c);
+					ai[l][b] = cimagf(c);
+				}
+			}
+
+			orthiter_batch(maps, channels, 30, val, vr, vi, ar, ai);
+
+			for (int u = 0; u < maps; u++) {
+
+				int ru = maps - 1 - u;
+
+				for (int v = 0; v < channels; v++)
+					for (int b = 0; b < B; b++)
+						optr[(u * channels + v) * V + idx[o + b]] = vr[ru][v][b] + 1.i * vi[ru][v][b];
+
+				if (NULL != eptr)
+					for (int b = 0; b < B; b++)
+						eptr[u * V + idx[o + b]] = val[ru][b];
+			}
+		}
+
+		free(ar);
+		free(ai);
+		free(vr);
+		free(vi);
+	}
+
+	free(idx);
+}
+
+
+
 /* calculate point-wise maps 
  *
  */
@@ -218,6 +514,12 @@ void eigenmaps(const long out_dims[DIMS], complex float* optr, complex float* ep
 
 	md_clear(5, out_dims, optr, CFL_SIZE);
 
+	if (orthiter) {
+
+		eigenmaps_batch(out_dims, optr, eptr, imgcov2, msk);
+		return;
+	}
+
 #pragma omp parallel for collapse(3)
 	for (long k = 0; k < zz; k++) {
 		for (long j = 0; j < yy; j++) {
@@ -235,14 +537,11 @@ void eigenmaps(const long out_dims[DIMS], complex float* optr, complex float* ep
 
 					unpack_tri_matrix(channels, cov, tmp);
 
-					if (orthiter) 
-						eigen_herm3(maps, channels, val, cov);
-					else 
-						lapack_eig(channels, val, cov);
+					lapack_eig(channels, val, cov);
 
 					for (long u = 0; u < maps; u++) {
 
-						long ru = (orthiter ? maps : channels) - 1 - u;
+						long ru = channels - 1 - u;
 
 						for (long v = 0; v < channels; v++) 
 							optr[((((u * channels + v) * zz + k) * yy + j) * xx + i)] = cov[ru][v];
@@ -264,7 +563,7 @@ void eigenmaps(const long out_dims[DIMS], complex float* optr, complex float* ep
 
 
 
-void caltwo(const struct ecalib_conf* conf, const long out_dims[DIMS], complex float* out_data, complex float* emaps, const long in_dims[4], complex float* in_data, const long msk_dims[3], const bool* msk)
+static void caltwo_full(const struct ecalib_conf* conf, const long out_dims[DIMS], complex float* out_data, complex float* emaps, const long in_dims[4], const complex float* in_data, const long msk_dims[3], const bool* msk)
 {
 
 	long xx = out_dims[0];
@@ -309,6 +608,151 @@ void caltwo(const struct ecalib_conf* conf, const long out_dims[DIMS], complex f
 
 
 
+/*
+ * Align the phase of the eigenvectors with the phase of the coil sum,
+ * so that they vary smoothly in space and can be interpolated.
+ */
+static void align_phase(const long dims[DIMS], complex float* maps)
+{
+	complex float ones[dims[COIL_DIM]];
+
+	for (long i = 0; i < dims[COIL_DIM]; i++)
+		ones[i] = 1.;
+
+	fixphase2(DIMS, dims, COIL_DIM, ones, maps, maps);
+}
+
+
+/*
+ * Compute the maps on a grid which is coarser by the factor conf->lowres
+ * along each axis and upsample them with sinc interpolation. The phase of
+ * the eigenvectors is aligned before and they are normalized again after
+ * the interpolation. Optionally, the maps are also computed at full
+ * resolution and the relative error is reported.
+ */
+static void caltwo_lowres(const struct ecalib_conf* conf, const long out_dims[DIMS], complex float* out_data, complex float* emaps, const long in_dims[4], const complex float* in_data, const long msk_dims[3], const bool* msk)
+{
+	long lo_dims[DIMS];
+	md_copy_dims(DIMS, lo_dims, out_dims);
+
+	for (int i = 0; i < 3; i++)
+		if (1 < out_dims[i])
+			lo_dims[i] = MIN(out_dims[i], MAX(in_dims[i], 2 * ((out_dims[i] / conf->lowres + 1) / 2)));
+
+	long map_dims[DIMS];
+	long lo_map_dims[DIMS];
+	md_select_dims(DIMS, ~COIL_FLAG, map_dims, out_dims);
+	md_select_dims(DIMS, ~COIL_FLAG, lo_map_dims, lo_dims);
+
+	debug_printf(DP_DEBUG1, "Low-resolution maps: %ldx%ldx%ld\n", lo_dims[0], lo_dims[1], lo_dims[2]);
+
+	complex float* lo_data = md_alloc(DIMS, lo_dims, CFL_SIZE);
+	complex float* lo_emaps = (NULL != emaps) ? md_alloc(DIMS, lo_map_dims, CFL_SIZE) : NULL;
+
+	// sinc_zeropad scales by the size of the input along each axis
+	// which is resized. Axes which are resized at full but not at low
+	// resolution need this factor, or the eigenvalues are too small.
+
+	long cov_scale = 1;
+
+	for (int i = 0; i < 3; i++)
+		if ((lo_dims[i] == in_dims[i]) && (out_dims[i] != in_dims[i]))
+			cov_scale *= in_dims[i];
+
+	complex float* in_data2 = md_alloc(4, in_dims, CFL_SIZE);
+	md_zsmul(4, in_dims, in_data2, in_data, cov_scale);
+
+	caltwo_full(conf, lo_dims, lo_data, lo_emaps, in_dims, in_data2, NULL, NULL);
+
+	md_free(in_data2);
+
+	if (NULL != lo_emaps) {
+
+		float max = 0.;
+
+		for (long i = 0; i < md_calc_size(3, lo_dims); i++)
+			max = MAX(max, crealf(lo_emaps[i]));
+
+		if ((conf->crop > 0.) && (max < conf->crop))
+			error("Low-resolution maps: largest eigenvalue %f below the crop threshold %f.\n", max, conf->crop);
+	}
+
+	align_phase(lo_dims, lo_data);
+
+	debug_printf(DP_DEBUG1, "Upsample maps...\n");
+
+	sinc_zeropad(DIMS, out_dims, out_data, lo_dims, lo_data);
+	normalize(DIMS, COIL_FLAG, out_dims, out_data);
+
+	md_free(lo_data);
+
+	if (NULL != emaps) {
+
+		sinc_zeropad(DIMS, map_dims, emaps, lo_map_dims, lo_emaps);
+		md_zreal(DIMS, map_dims, emaps, emaps);
+
+		// sinc_zeropad scales by the size of the input
+
+		long scale = 1;
+
+		for (int i = 0; i < 3; i++)
+			if (lo_dims[i] != out_dims[i])
+				scale *= lo_dims[i];
+
+		md_zsmul(DIMS, map_dims, emaps, emaps, 1. / scale);
+
+		md_free(lo_emaps);
+	}
+
+	// points outside the mask are not computed
+
+	if (NULL != msk) {
+
+		long V = md_calc_size(3, out_dims);
+
+		for (long m = 0; m < md_calc_size(DIMS - 3, out_dims + 3); m++)
+			for (long v = 0; v < V; v++)
+				if (!msk[v])
+					out_data[m * V + v] = 0.;
+
+		if (NULL != emaps)
+			for (long m = 0; m < out_dims[MAPS_DIM]; m++)
+				for (long v = 0; v < V; v++)
+					if (!msk[v])
+						emaps[m * V + v] = 0.;
+	}
+
+	if (conf->lowres_check) {
+
+		complex float* full = md_alloc(DIMS, out_dims, CFL_SIZE);
+		complex float* full_emaps = md_alloc(DIMS, map_dims, CFL_SIZE);
+
+		caltwo_full(conf, out_dims, full, full_emaps, in_dims, in_data, msk_dims, msk);
+
+		align_phase(out_dims, full);
+
+		float err = md_znrmse(DIMS, out_dims, full, out_data);
+		float err_ev = (NULL != emaps) ? md_znrmse(DIMS, map_dims, full_emaps, emaps) : 0.;
+
+		debug_printf(DP_INFO, "Low-resolution maps: relative error %f (eigenvalues: %f)\n", err, err_ev);
+
+		md_free(full);
+		md_free(full_emaps);
+	}
+}
+
+
+void caltwo(const struct ecalib_conf* conf, const long out_dims[DIMS], complex float* out_data, complex float* emaps, const long in_dims[4], complex float* in_data, const long msk_dims[3], const bool* msk)
+{
+	if (1 < conf->lowres)
+		caltwo_lowres(conf, out_dims, out_data, emaps, in_dims, in_data, msk_dims, msk);
+	else
+		caltwo_full(conf, out_dims, out_data, emaps, in_dims, in_data, msk_dims, msk);
+}
+
+
+
+
 void calone_dims(const struct ecalib_conf* conf, long cov_dims[4], long channels)
 {
 	long kx = conf->kdims[0];
@@ -323,7 +767,7 @@ void calone_dims(const struct ecalib_conf* conf, long cov_dims[4], long channels
 
 
 
-const struct ecalib_conf ecalib_defaults = { { 6, 6, 6 }, 0.001, -1, -1., false, false, 0.8, true, false, -1., false, true };
+const struct ecalib_conf ecalib_defaults = { { 6, 6, 6 }, 0.001, -1, -1., false, false, 0.8, true, false, -1., false, true, 1, false, NULL };
 
 
 
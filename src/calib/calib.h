@@ -23,6 +23,9 @@ struct ecalib_conf {
 	float perturb;
 	_Bool intensity;
 	_Bool rotphase;
+	long lowres;
+	_Bool lowres_check;
+	const char* cache;
 };
 
 extern const struct ecalib_conf ecalib_defaults;
@@ -8,6 +8,8 @@
 
 #include <complex.h>
 #include <math.h>
+#include <stdlib.h>
+#include <assert.h>
 
 #include "num/multind.h"
 #include "num/flpmath.h"
@@ -154,23 +156,160 @@ static void circular_patch_mask(const long kdims[3], unsigned int channels, comp
 }
 #endif
 
+/*
+ * Gram matrix of the calibration matrix, computed directly from the
+ * calibration region without forming the calibration matrix.
+ *
+ * The entry for the kernel positions ki, kj and channels a, b is
+ *
+ *	cov[j][i] = sum_p x_a(p + ki) conj(x_b(p + kj)),
+ *
+ * where p runs over all patch positions. With q = p + kj this is a
+ * box sum of the lagged product z(q) = x_a(q + d) conj(x_b(q)) with
+ * d = ki - kj over a window of the size of the patch positions which
+ * starts at kj. For each channel pair and lag, z is computed once and
+ * the box sums for all kj are read from its summed-area table. This
+ * needs (2K - 1)^3 instead of K^6 passes over the calibration region
+ * for a K x K x K kernel and only one table per thread.
+ */
+static void gram_matrix_calreg(const long kdims[3], unsigned int N, complex float cov[N][N], const long calreg_dims[4], const complex float* data)
+{
+	long C = calreg_dims[3];
+	long K = md_calc_size(3, kdims);
+
+	assert((long)N == K * C);
+
+	long P[3];	// number of patch positions
+	long L[3];	// number of lags
+	long T[3];	// summed-area table
+
+	for (int i = 0; i < 3; i++) {
+
+		assert(calreg_dims[i] >= kdims[i]);
+
+		P[i] = calreg_dims[i] - kdims[i] + 1;
+		L[i] = 2 * kdims[i] - 1;
+		T[i] = calreg_dims[i] + 1;
+	}
+
+	long lags = md_calc_size(3, L);
+	long work = C * C * lags;
+
+	#pragma omp parallel
+	{
+		complex double* sat = xmalloc(md_calc_size(3, T) * sizeof(complex double));
+
+		#pragma omp for schedule(dynamic)
+		for (long w = 0; w < work; w++) {
+
+			long a = w / (C * lags);
+			long b = (w / lags) % C;
+			long l = w % lags;
+
+			long d[3] = { l % L[0] - (kdims[0] - 1), (l / L[0]) % L[1] - (kdims[1] - 1), l / (L[0] * L[1]) - (kdims[2] - 1) };
+
+			// each pair of columns once: a > b, or a == b and the
+			// second half of the lags (-d has the index lags - 1 - l)
+
+			if ((a < b) || ((a == b) && (l < lags / 2)))
+				continue;
+
+			// range of q for which q and q + d are inside
+
+			long lo[3];
+			long n[3];
+
+			for (int i = 0; i < 3; i++) {
+
+				lo[i] = MAX(0, -d[i]);
+				n[i] = calreg_dims[i] - labs(d[i]);
+			}
+
+			const complex float* xa = data + a * md_calc_size(3, calreg_dims);
+			const complex float* xb = data + b * md_calc_size(3, calreg_dims);
+
+			// sat[u] = sum of z(lo + q') for all q' < u
+
+#define SAT(u0, u1, u2)	sat[((u2) * (n[1] + 1) + (u1)) * (n[0] + 1) + (u0)]
+
+			for (long u2 = 0; u2 <= n[2]; u2++) {
+				for (long u1 = 0; u1 <= n[1]; u1++) {
+
+					if ((0 == u1) || (0 == u2)) {
+
+						for (long u0 = 0; u0 <= n[0]; u0++)
+							SAT(u0, u1, u2) = 0.;
+
+						continue;
+					}
+
+					long q1 = lo[1] + u1 - 1;
+					long q2 = lo[2] + u2 - 1;
+					long ob = (q2 * calreg_dims[1] + q1) * calreg_dims[0] + lo[0];
+					long oa = ((q2 + d[2]) * calreg_dims[1] + q1 + d[1]) * calreg_dims[0] + lo[0] + d[0];
+
+					complex double row = 0.;
+					SAT(0, u1, u2) = 0.;
+
+					for (long u0 = 1; u0 <= n[0]; u0++) {
+
+						row += (complex double)xa[oa + u0 - 1] * conj((complex double)xb[ob + u0 - 1]);
+
+						SAT(u0, u1, u2) = row + SAT(u0, u1 - 1, u2) + SAT(u0, u1, u2 - 1) - SAT(u0, u1 - 1, u2 - 1);
+					}
+				}
+			}
+
+			// box sums for all kj with kj + d inside the kernel
+
+			long kj[3];
+
+			for (kj[2] = lo[2]; kj[2] < kdims[2] - MAX(0, d[2]); kj[2]++) {
+				for (kj[1] = lo[1]; kj[1] < kdims[1] - MAX(0, d[1]); kj[1]++) {
+					for (kj[0] = lo[0]; kj[0] < kdims[0] - MAX(0, d[0]); kj[0]++) {
+
+						long u[3] = { kj[0] - lo[0], kj[1] - lo[1], kj[2] - lo[2] };
+						long v[3] = { u[0] + P[0], u[1] + P[1], u[2] + P[2] };
+
+						complex double val = SAT(v[0], v[1], v[2])
+							- SAT(u[0], v[1], v[2]) - SAT(v[0], u[1], v[2]) - SAT(v[0], v[1], u[2])
+							+ SAT(u[0], u[1], v[2]) + SAT(u[0], v[1], u[2]) + SAT(v[0], u[1], u[2])
+							- SAT(u[0], u[1], u[2]);
+
+						long i = ((a * kdims[2] + kj[2] + d[2]) * kdims[1] + kj[1] + d[1]) * kdims[0] + kj[0] + d[0];
+						long j = ((b * kdims[2] + kj[2]) * kdims[1] + kj[1]) * kdims[0] + kj[0];
+
+						cov[j][i] = val;
+						cov[i][j] = conj(val);
+					}
+				}
+			}
+#undef SAT
+		}
+
+		free(sat);
+	}
+}
+
+
 void covariance_function(const long kdims[3], unsigned int N, complex float cov[N][N], const long calreg_dims[4], const complex float* data)
 {
-	long calmat_dims[2];
 #if 1
-	complex float* cm = calibration_matrix(calmat_dims, kdims, calreg_dims, data);
+	gram_matrix_calreg(kdims, N, cov, calreg_dims, data);
 #else
+	long calmat_dims[2];
 	long channels = calreg_dims[3];
 	complex float msk[channels * md_calc_size(3, kdims)];
 	circular_patch_mask(kdims, channels, msk);
 	complex float* cm = calibration_matrix_mask2(calmat_dims, kdims, msk, calreg_dims, data);
-#endif
+
 	unsigned int L = calmat_dims[0];
 	assert(N == calmat_dims[1]);
 
 	gram_matrix(N, cov, L, MD_CAST_ARRAY2(const complex float, 2, calmat_dims, cm, 0, 1));
 
 	md_free(cm);
+#endif
 }
 
 
@@ -13,15 +13,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "num/rand.h"
 #include "num/multind.h"
+#include "num/flpmath.h"
 #include "num/lapack.h"
 
+#include "misc/misc.h"
 #include "misc/debug.h"
 
 #include "calib/calib.h"
 #include "calib/calmat.h"
+#include "calib/calcache.h"
 
 #include "estvar.h"
 
@@ -39,60 +43,50 @@
 static void noise_calreg(long T, complex float* ncalreg)
 {
 
-    float spike = 1;
-    float stdev = 1.f/sqrtf(2.f); 
+    float stdev = 1.f/sqrtf(2.f);
 
-    for (long idx = 0; idx < T; idx++) {
-        if (spike >= uniform_rand()) {
-            ncalreg[idx] = stdev * gaussian_rand();
-        }
-    }
+    md_zgaussian_rand(1, MD_DIMS(T), ncalreg);
+    md_zsmul(1, MD_DIMS(T), ncalreg, ncalreg, stdev);
+
+}
+
+/**
+ * nsv_dir - This returns the directory to read or write
+ *           the simulated noise singular values from/to
+ *           (NULL if TOOLBOX_PATH is not set).
+ */
+static char* nsv_dir(void) {
+
+    const char* path = TOOLBOX_PATH;
+
+    if (NULL == path)
+        return NULL;
+
+    char* dir = xmalloc(strlen(path) + strlen("/save/nsv") + 1);
+    sprintf(dir, "%s/save/nsv", path);
+
+    return dir;
 
 }
 
 /**
- * file_name - This returns the name of file to read
-               or write the simulated noise singular values to.
+ * nsv_key - This returns the key of the simulated noise
+ *           singular values in the calibration cache.
  *
  * Parameters:
  *  kernel_dims - kernel dimensions.
  *  calreg_dims - calibration region dimensions.
+ *  L           - Number of singular values.
  */
-static char* file_name(const long kernel_dims[3], const long calreg_dims[4]) {
-
-    char PATH[]     = "/save/nsv/";
-    char KERNEL[]   = "KERNEL_";
-    char CALREG[]   = "CALREG_";
-    char DAT[]      = ".dat";
-
-    int space[] = {strlen(TOOLBOX_PATH), strlen(PATH), strlen(KERNEL), 
-        floor(log10(kernel_dims[0])) + 2,
-        floor(log10(kernel_dims[1])) + 2,
-        floor(log10(kernel_dims[2])) + 2, strlen(CALREG),
-        floor(log10(calreg_dims[0])) + 2,
-        floor(log10(calreg_dims[1])) + 2,
-        floor(log10(calreg_dims[2])) + 2,
-        floor(log10(calreg_dims[3])) + 1, strlen(DAT) + 1};
-
-    size_t total = 0;
-    for (size_t idx = 0; idx < sizeof(space)/sizeof(int); idx ++) {
-        total += space[idx];
-    }
+static uint64_t nsv_key(const long kernel_dims[3], const long calreg_dims[4], long L) {
 
-    char* name = calloc(total, sizeof(char));
+    uint64_t key = CALCACHE_SEED;
 
-    assert(NULL != name);
+    key = calcache_hash(key, 3 * sizeof(long), kernel_dims);
+    key = calcache_hash(key, 4 * sizeof(long), calreg_dims);
+    key = calcache_hash(key, sizeof(long), &L);
 
-    sprintf(name, "%s%s%s%ldx%ldx%ld_%s%ldx%ldx%ldx%ld%s", 
-        TOOLBOX_PATH, 
-        PATH, 
-        KERNEL,
-        kernel_dims[0], kernel_dims[1], kernel_dims[2],
-        CALREG,
-        calreg_dims[0], calreg_dims[1], calreg_dims[2], calreg_dims[3],
-        DAT);
-    
-    return name;
+    return key;
 
 }
 
@@ -108,21 +102,27 @@ static char* file_name(const long kernel_dims[3], const long calreg_dims[4]) {
  */
 static int load_noise_sv(const long kernel_dims[3], const long calreg_dims[4], long L, float* E) {
 
-    char* name = file_name(kernel_dims, calreg_dims);
-    FILE* fp   = fopen(name, "rb");
+    char* dir = nsv_dir();
 
-    if (NULL == fp) {
-        free(name);
+    if (NULL == dir)
         return 0;
-    }
 
-    int c = fread(E, sizeof(float), L, fp);
-    assert(c == L);
-    
-    free(name);
-    fclose(fp);
+    size_t size;
+    float* data = calcache_load(dir, "nsv", nsv_key(kernel_dims, calreg_dims, L), &size);
+
+    free(dir);
+
+    if (NULL == data)
+        return 0;
 
-    return 1;
+    int ok = (size == L * sizeof(float));
+
+    if (ok)
+        memcpy(E, data, size);
+
+    free(data);
+
+    return ok;
 
 }
 
@@ -139,19 +139,17 @@ static int load_noise_sv(const long kernel_dims[3], const long calreg_dims[4], l
  */
 static void save_noise_sv(const long kernel_dims[3], const long calreg_dims[4], long L, float* E) {
 
-    char* name = file_name(kernel_dims, calreg_dims);
-    FILE* fp   = fopen(name, "wb");
+    char* dir = nsv_dir();
 
-    if (!fp) {
-        perror("fopen");
-        free(name);
-        exit(1);
-    }
+    if (NULL == dir)
+        return;
+
+    const size_t sizes[1] = { L * sizeof(float) };
+    const void* data[1] = { E };
 
-    fwrite(E, sizeof(float), L, fp);
+    calcache_save(dir, "nsv", nsv_key(kernel_dims, calreg_dims, L), 1, sizes, data);
 
-    free(name);
-    fclose(fp);
+    free(dir);
 
 }
 
@@ -11,6 +11,7 @@
 #include <complex.h>
 #include <stdio.h>
 
+#include "num/multind.h"
 #include "num/flpmath.h"
 
 #include "misc/mmio.h"
@@ -30,13 +31,32 @@ int main_conj(int argc, char* argv[])
 
 	const int N = 16;
 	long dims[N];
-	complex float* idata = load_cfl(argv[1], N, dims);
-	complex float* odata = create_cfl(argv[2], N, dims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[1], N, dims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[2], N, dims);
 
-	md_zconj(N, dims, odata, idata);
+	unsigned long loop_flags = cfl_stream_flags(N, dims, 0u);
 
-	unmap_cfl(N, dims, idata);
-	unmap_cfl(N, dims, odata);
+	long cdims[N];
+	md_select_dims(N, ~loop_flags, cdims, dims);
+
+	complex float* data = md_alloc(N, cdims, sizeof(complex float));
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		cfl_stream_read(in, N, loop_flags, pos, data);
+
+		md_zconj(N, cdims, data, data);
+
+		cfl_stream_write(out, N, loop_flags, pos, data);
+
+	} while (md_next(N, dims, loop_flags, pos));
+
+	md_free(data);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 	exit(0);
 }
 
@@ -25,6 +25,7 @@
 #include "num/init.h"
 
 #include "calib/calib.h"
+#include "calib/calcache.h"
 
 #ifndef CFL_SIZE
 #define CFL_SIZE sizeof(complex float)
@@ -73,6 +74,9 @@ int main_ecalib(int argc, char* argv[])
 		{ 'g', false, opt_set, &conf.usegpu, NULL },
 		{ 'p', true, opt_float, &conf.percentsv, NULL },
 		{ 'n', true, opt_int, &conf.numsv, NULL },
+		{ 'L', true, opt_long, &conf.lowres, " f\t\tcompute maps at 1/f resolution and upsample them." },
+		{ 'E', false, opt_set, &conf.lowres_check, NULL },
+		{ 'D', true, opt_string, &conf.cache, " dir\t\tcache kernels and covariances in {dir} (default: $BART_CALIB_CACHE)" },
 	};
 
 	cmdline(&argc, argv, 2, 3, usage_str, help_str, ARRAY_SIZE(opts), opts);
@@ -219,6 +223,15 @@ int main_ecalib(int argc, char* argv[])
 	}
 
 
+	if (NULL != calcache_dir(conf.cache)) {
+
+		long hits, misses;
+		calcache_stats(&hits, &misses);
+
+		debug_printf(DP_INFO, "Calibration cache: %ld hits, %ld misses.\n", hits, misses);
+	}
+
+
 	if (print_svals) {
 
 		for (unsigned int i = 0; i < K; i++)
@@ -50,6 +50,8 @@ int main_ecaltwo(int argc, char* argv[])
 		{ 'S', false, opt_set, &conf.softcrop, NULL },
 		{ 'O', false, opt_clear, &conf.orthiter, NULL },
 		{ 'g', false, opt_set, &conf.usegpu, NULL },
+		{ 'L', true, opt_long, &conf.lowres, " f\t\tcompute maps at 1/f resolution and upsample them." },
+		{ 'E', false, opt_set, &conf.lowres_check, NULL },
 	};
 
 	cmdline(&argc, argv, 5, 6, usage_str, help_str, ARRAY_SIZE(opts), opts);
@@ -43,21 +43,38 @@ int main_fft(int argc, char* argv[])
 	cmdline(&argc, argv, 3, 3, usage_str, help_str, ARRAY_SIZE(opts), opts);
 
 	long dims[DIMS];
-	complex float* idata = load_cfl(argv[2], DIMS, dims);
-	complex float* data = create_cfl(argv[3], DIMS, dims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[2], DIMS, dims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[3], DIMS, dims);
 
 	unsigned long flags = labs(atol(argv[1]));
 
+	// transform chunk by chunk along the remaining dimensions
 
-	md_copy(DIMS, dims, data, idata, sizeof(complex float));
-	unmap_cfl(DIMS, dims, idata);
+	unsigned long loop_flags = cfl_stream_flags(DIMS, dims, flags);
 
-	if (unitary)
-		fftscale(DIMS, dims, flags, data, data);
+	long cdims[DIMS];
+	md_select_dims(DIMS, ~loop_flags, cdims, dims);
 
-	(inv ? ifftc : fftc)(DIMS, dims, flags, data, data);
+	complex float* data = md_alloc(DIMS, cdims, sizeof(complex float));
 
-	unmap_cfl(DIMS, dims, data);
+	long pos[DIMS] = { 0 };
+
+	do {
+		cfl_stream_read(in, DIMS, loop_flags, pos, data);
+
+		if (unitary)
+			fftscale(DIMS, cdims, flags, data, data);
+
+		(inv ? ifftc : fftc)(DIMS, cdims, flags, data, data);
+
+		cfl_stream_write(out, DIMS, loop_flags, pos, data);
+
+	} while (md_next(DIMS, dims, loop_flags, pos));
+
+	md_free(data);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 	exit(0);
 }
 
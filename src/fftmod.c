@@ -48,13 +48,32 @@ int main_fftmod(int argc, char* argv[])
 	int N = DIMS;
 	long dims[N];
 
-	complex float* idata = load_cfl(argv[2], N, dims);
-	complex float* odata = create_cfl(argv[3], N, dims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[2], N, dims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[3], N, dims);
 
-	(inv ? ifftmod : fftmod)(N, dims, flags, odata, idata);
+	unsigned long loop_flags = cfl_stream_flags(N, dims, flags);
 
-	unmap_cfl(N, dims, idata);
-	unmap_cfl(N, dims, odata);
+	long cdims[N];
+	md_select_dims(N, ~loop_flags, cdims, dims);
+
+	complex float* data = md_alloc(N, cdims, sizeof(complex float));
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		cfl_stream_read(in, N, loop_flags, pos, data);
+
+		(inv ? ifftmod : fftmod)(N, cdims, flags, data, data);
+
+		cfl_stream_write(out, N, loop_flags, pos, data);
+
+	} while (md_next(N, dims, loop_flags, pos));
+
+	md_free(data);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 	exit(0);
 }
 
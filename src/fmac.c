@@ -46,8 +46,8 @@ int main_fmac(int argc, char* argv[])
 	long dims1[N];
 	long dims2[N];
 
-	complex float* data1 = load_cfl(argv[1], N, dims1);
-	complex float* data2 = load_cfl(argv[2], N, dims2);
+	struct cfl_stream_s* in1 = load_cfl_stream(argv[1], N, dims1);
+	struct cfl_stream_s* in2 = load_cfl_stream(argv[2], N, dims2);
 
 	long dims[N];
 
@@ -60,26 +60,68 @@ int main_fmac(int argc, char* argv[])
 
 	long dimso[N];
 	md_select_dims(N, ~squash, dimso, dims);
-	complex float* out = create_cfl(argv[3], N, dimso);
+	struct cfl_stream_s* out = create_cfl_stream(argv[3], N, dimso);
 
-	if (clear) {
+	// loop over dimensions which are not squashed, inputs
+	// which are broadcast along a loop dimension are re-read
 
-		md_clear(N, dimso, out, CFL_SIZE);
-	}
+	unsigned long loop_flags = cfl_stream_flags(N, dims, squash);
+
+	long cdims[N];
+	long cdims1[N];
+	long cdims2[N];
+	long cdimso[N];
+
+	md_select_dims(N, ~loop_flags, cdims, dims);
+	md_select_dims(N, ~loop_flags, cdims1, dims1);
+	md_select_dims(N, ~loop_flags, cdims2, dims2);
+	md_select_dims(N, ~loop_flags, cdimso, dimso);
+
+	complex float* data1 = md_alloc(N, cdims1, CFL_SIZE);
+	complex float* data2 = md_alloc(N, cdims2, CFL_SIZE);
+	complex float* data = md_alloc(N, cdimso, CFL_SIZE);
 
 	long str1[N];
 	long str2[N];
 	long stro[N];
 
-	md_calc_strides(N, str1, dims1, CFL_SIZE);
-	md_calc_strides(N, str2, dims2, CFL_SIZE);
-	md_calc_strides(N, stro, dimso, CFL_SIZE);
+	md_calc_strides(N, str1, cdims1, CFL_SIZE);
+	md_calc_strides(N, str2, cdims2, CFL_SIZE);
+	md_calc_strides(N, stro, cdimso, CFL_SIZE);
+
+	long pos[N];
+	long pos1[N];
+	long pos2[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		for (int i = 0; i < N; i++) {
+
+			pos1[i] = (1 == dims1[i]) ? 0 : pos[i];
+			pos2[i] = (1 == dims2[i]) ? 0 : pos[i];
+		}
+
+		cfl_stream_read(in1, N, loop_flags, pos1, data1);
+		cfl_stream_read(in2, N, loop_flags, pos2, data2);
+
+		if (clear)
+			md_clear(N, cdimso, data, CFL_SIZE);
+		else
+			cfl_stream_read(out, N, loop_flags, pos, data);
+
+		(conj ? md_zfmacc2 : md_zfmac2)(N, cdims, stro, data, str1, data1, str2, data2);
+
+		cfl_stream_write(out, N, loop_flags, pos, data);
+
+	} while (md_next(N, dims, loop_flags, pos));
 
-	(conj ? md_zfmacc2 : md_zfmac2)(N, dims, stro, out, str1, data1, str2, data2);
+	md_free(data1);
+	md_free(data2);
+	md_free(data);
 
-	unmap_cfl(N, dims1, data1);
-	unmap_cfl(N, dims2, data2);
-	unmap_cfl(N, dimso, out);
+	cfl_stream_close(in1);
+	cfl_stream_close(in2);
+	cfl_stream_close(out);
 	exit(0);
 }
 
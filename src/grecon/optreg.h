@@ -0,0 +1,54 @@
+/* Copyright 2015-2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ */
+
+#ifndef __OPTREG_H
+#define __OPTREG_H 1
+
+#include <stdbool.h>
+
+#include "misc/mri.h"
+#include "misc/cppwrap.h"
+
+
+#define NUM_REGS 10
+
+struct operator_p_s;
+struct linop_s;
+
+
+struct reg_s {
+
+	enum { L1WAV, TV, LLR, MLR, IMAGL1, IMAGL2, L1IMG, L2IMG } xform;
+
+	unsigned int xflags;
+	unsigned int jflags;
+
+	float lambda;
+};
+
+enum algo_t { CG, IST, FISTA, ADMM };
+
+struct opt_reg_s {
+
+	float lambda;
+	enum algo_t algo;
+	struct reg_s regs[NUM_REGS];
+	unsigned int r;
+};
+
+
+extern void opt_reg_init(struct opt_reg_s* ropts);
+extern _Bool opt_reg(void* ptr, char c, const char* optarg);
+
+extern void opt_reg_configure(long max_dims[DIMS], long img_dims[DIMS], struct opt_reg_s* ropts,
+		const struct operator_p_s* prox_ops[NUM_REGS], const struct linop_s* trafos[NUM_REGS],
+		const struct linop_s** forward_op, unsigned int llr_blk, _Bool randshift, _Bool use_gpu);
+
+extern void opt_reg_free(struct opt_reg_s* ropts, const struct operator_p_s* prox_ops[NUM_REGS], const struct linop_s* trafos[NUM_REGS]);
+
+
+#include "misc/cppwrap.h"
+
+#endif	// __OPTREG_H
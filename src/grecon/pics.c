@@ -0,0 +1,775 @@
+/* Copyright 2013-2016. The Regents of the University of California.
+ * Copyright 2015. Martin Uecker.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ *
+ * Authors:
+ * 2012-2015 Martin Uecker <martin.uecker@med.uni-goettingen.de>
+ * 2014-2016 Frank Ong <frankong@berkeley.edu>
+ * 2014-2015 Jonathan Tamir <jtamir@eecs.berkeley.edu>
+ *
+ *
+ * Reconstruction context for parallel-imaging compressed-sensing.
+ *
+ * The forward operator, the regularization terms and the iteration
+ * configuration are set up once in pics_create and can then be used
+ * to reconstruct any number of k-space frames with pics_recon. This
+ * avoids re-creating operators, re-planning FFTs and re-computing the
+ * Toeplitz PSF for every frame.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <complex.h>
+
+#include "num/multind.h"
+#include "num/flpmath.h"
+#include "num/fft.h"
+#include "num/ops.h"
+#include "num/workspace.h"
+
+#include "iter/iter.h"
+#include "iter/iter2.h"
+#include "iter/misc.h"
+
+#include "linops/linop.h"
+
+#include "noncart/nufft.h"
+
+#include "sense/recon.h"
+#include "sense/model.h"
+#include "sense/optcom.h"
+
+#include "misc/debug.h"
+#include "misc/mri.h"
+#include "misc/utils.h"
+#include "misc/misc.h"
+
+#include "grecon/optreg.h"
+
+#include "pics.h"
+
+
+const struct pics_conf pics_defaults = {
+
+	.sense = {
+		.rvc = false,
+		.rwiter = 1,
+		.gamma = -1.,
+		.cclambda = 0.,
+	},
+
+	.maxiter = 30,
+	.step = -1.,
+	.eigen = false,
+	.randshift = true,
+	.hogwild = false,
+	.fast = false,
+	.admm_rho = 0.5,	// as in iter_admm_defaults
+	.admm_maxitercg = 10,
+	.llr_blk = 8,
+
+	.restrict_fov = -1.,
+	.scaling = 0.,
+	.scale_im = false,
+	.warm_start = false,
+
+	.use_gpu = false,
+	.sense_mem = 256L << 20,
+};
+
+
+struct pics_s {
+
+	struct pics_conf conf;
+	struct opt_reg_s ropts;
+	enum algo_t algo;
+
+	long max_dims[DIMS];
+	long img_dims[DIMS];
+	long ksp_dims[DIMS];
+	long pat_dims[DIMS];
+	long wgh_dims[DIMS];
+	long adj_dims[DIMS];
+
+	complex float* pattern;
+	complex float* weights;
+	complex float* traj;
+
+	const complex float* image_truth;
+
+	const struct linop_s* forward_op;
+	const struct linop_s* adj_op;
+	const struct operator_s* precond_op;
+
+	unsigned int nr_penalties;
+	const struct operator_p_s* thresh_ops[NUM_REGS];
+	const struct linop_s* trafos[NUM_REGS];
+
+	italgo_fun2_t italgo;
+	void* iconf;
+
+	struct iter_call_s iter2_data;
+	struct iter_conjgrad_conf cgconf;
+	struct iter_fista_conf fsconf;
+	struct iter_ist_conf isconf;
+	struct iter_admm_conf mmconf;
+};
+
+
+
+static const struct linop_s* sense_nc_init(const long max_dims[DIMS], const long map_dims[DIMS], const complex float* maps, const long ksp_dims[DIMS], const long traj_dims[DIMS], const complex float* traj, struct nufft_conf_s conf, _Bool use_gpu, struct operator_s** precond_op)
+{
+	long coilim_dims[DIMS];
+	long img_dims[DIMS];
+	md_select_dims(DIMS, ~MAPS_FLAG, coilim_dims, max_dims);
+	md_select_dims(DIMS, ~COIL_FLAG, img_dims, max_dims);
+
+	const struct linop_s* fft_op = nufft_create(DIMS, ksp_dims, coilim_dims, traj_dims, traj, NULL, conf, use_gpu);
+	const struct linop_s* maps_op = maps2_create(coilim_dims, map_dims, img_dims, maps, use_gpu);
+
+	//precond_op[0] = (struct operator_s*) nufft_precond_create( fft_op );
+	precond_op[0] = NULL;
+
+	const struct linop_s* lop = linop_chain(maps_op, fft_op);
+
+	linop_free(maps_op);
+	linop_free(fft_op);
+
+	return lop;
+}
+
+
+/*
+ * The coil-batched SENSE operator includes the weights (the square
+ * root of the pattern), so they are also part of the normal operator.
+ * If the pattern is constant along the readout, only one readout
+ * position is kept (wgh_dims), so that the normal operator can skip
+ * the readout FFT.
+ */
+static void pics_weights(struct pics_s* ctx, const complex float* pattern)
+{
+	long pat_strs[DIMS];
+	long wgh_strs[DIMS];
+	md_calc_strides(DIMS, pat_strs, ctx->pat_dims, CFL_SIZE);
+	md_calc_strides(DIMS, wgh_strs, ctx->wgh_dims, CFL_SIZE);
+
+	md_copy2(DIMS, ctx->wgh_dims, wgh_strs, ctx->weights, pat_strs, pattern, CFL_SIZE);
+
+	long dimsR[DIMS + 1];
+	dimsR[0] = 2;
+	md_copy_dims(DIMS, dimsR + 1, ctx->wgh_dims);
+
+	md_sqrt(DIMS + 1, dimsR, (float*)ctx->weights, (const float*)ctx->weights);
+}
+
+
+static bool readout_constant(const long pat_dims[DIMS], const complex float* pattern)
+{
+	long strs[DIMS];
+	md_calc_strides(DIMS, strs, pat_dims, CFL_SIZE);
+
+	long strs0[DIMS];
+	md_copy_strides(DIMS, strs0, strs);
+	strs0[READ_DIM] = 0;
+
+	complex float* tmp = md_alloc(DIMS, pat_dims, CFL_SIZE);
+	md_zsub2(DIMS, pat_dims, strs, tmp, strs, pattern, strs0, pattern);
+
+	float diff = md_znorm(DIMS, pat_dims, tmp);
+
+	md_free(tmp);
+
+	return (0. == diff);
+}
+
+
+static void italgo_config(struct pics_s* ctx)
+{
+	struct pics_conf* conf = &ctx->conf;
+	struct reg_s* regs = ctx->ropts.regs;
+
+	enum algo_t algo = ctx->ropts.algo;
+	unsigned int nr_penalties = ctx->ropts.r;
+	float step = conf->step;
+
+	ctx->italgo = iter2_call_iter;
+	ctx->iconf = &ctx->iter2_data;
+
+	if ((CG == algo) && (1 == nr_penalties) && (L2IMG != regs[0].xform))
+		algo = FISTA;
+
+	if (nr_penalties > 1)
+		algo = ADMM;
+
+	if ((IST == algo) || (FISTA == algo)) {
+
+		// For non-Cartesian trajectories, the default
+		// will usually not work. TODO: The same is true
+		// for sensitivities which are not normalized, but
+		// we do not detect this case.
+
+		if ((NULL != ctx->traj) && (-1. == step) && !conf->eigen)
+			debug_printf(DP_WARN, "No step size specified.\n");
+
+		if (-1. == step)
+			step = 0.95;
+	}
+
+	if ((CG == algo) || (ADMM == algo))
+		if (-1. != step)
+			debug_printf(DP_INFO, "Stepsize ignored.\n");
+
+	if (conf->eigen) {
+
+		// as without the coil-batched operator, the
+		// eigenvalue is computed without the weights
+
+		complex float* weights = NULL;
+
+		if (NULL != ctx->weights) {
+
+			weights = md_alloc(DIMS, ctx->wgh_dims, CFL_SIZE);
+			md_copy(DIMS, ctx->wgh_dims, weights, ctx->weights, CFL_SIZE);
+			md_zfill(DIMS, ctx->wgh_dims, ctx->weights, 1.);
+		}
+
+		double maxeigen = estimate_maxeigenval(ctx->forward_op->normal);
+
+		if (NULL != weights) {
+
+			md_copy(DIMS, ctx->wgh_dims, ctx->weights, weights, CFL_SIZE);
+			md_free(weights);
+		}
+
+		debug_printf(DP_INFO, "Maximum eigenvalue: %.2e\n", maxeigen);
+
+		step /= maxeigen;
+	}
+
+	switch (algo) {
+
+	case CG:
+
+		debug_printf(DP_INFO, "conjugate gradients\n");
+
+		assert((0 == nr_penalties) || ((1 == nr_penalties) && (L2IMG == regs[0].xform)));
+
+		ctx->cgconf = iter_conjgrad_defaults;
+		ctx->cgconf.maxiter = conf->maxiter;
+		ctx->cgconf.l2lambda = (0 == nr_penalties) ? 0. : regs[0].lambda;
+
+		ctx->iter2_data.fun = iter_conjgrad;
+		ctx->iter2_data._conf = &ctx->cgconf;
+
+		nr_penalties = 0;
+
+		break;
+
+	case IST:
+
+		debug_printf(DP_INFO, "IST\n");
+
+		assert(1 == nr_penalties);
+
+		ctx->isconf = iter_ist_defaults;
+		ctx->isconf.maxiter = conf->maxiter;
+		ctx->isconf.step = step;
+		ctx->isconf.hogwild = conf->hogwild;
+
+		ctx->iter2_data.fun = iter_ist;
+		ctx->iter2_data._conf = &ctx->isconf;
+
+		break;
+
+	case ADMM:
+
+		debug_printf(DP_INFO, "ADMM\n");
+
+		ctx->mmconf = iter_admm_defaults;
+		ctx->mmconf.maxiter = conf->maxiter;
+		ctx->mmconf.maxitercg = conf->admm_maxitercg;
+		ctx->mmconf.rho = conf->admm_rho;
+		ctx->mmconf.hogwild = conf->hogwild;
+		ctx->mmconf.fast = conf->fast;
+//		ctx->mmconf.dynamic_rho = true;
+		ctx->mmconf.ABSTOL = 0.;
+		ctx->mmconf.RELTOL = 0.;
+
+		ctx->italgo = iter2_admm;
+		ctx->iconf = &ctx->mmconf;
+
+		break;
+
+	case FISTA:
+
+		debug_printf(DP_INFO, "FISTA\n");
+
+		assert(1 == nr_penalties);
+
+		ctx->fsconf = iter_fista_defaults;
+		ctx->fsconf.maxiter = conf->maxiter;
+		ctx->fsconf.step = step;
+		ctx->fsconf.hogwild = conf->hogwild;
+
+		ctx->iter2_data.fun = iter_fista;
+		ctx->iter2_data._conf = &ctx->fsconf;
+
+		break;
+
+	default:
+
+		assert(0);
+	}
+
+	ctx->algo = algo;
+	ctx->nr_penalties = nr_penalties;
+}
+
+
+/**
+ * Create a reconstruction context.
+ *
+ * Maps, pattern and trajectory are copied, the caller may release
+ * them afterwards. If no pattern is given, it is estimated from each
+ * Cartesian frame, and the Toeplitz embedding is used for non-Cartesian
+ * data. num_init (or num_init_gpu) must have been called before.
+ *
+ * @param conf pics configuration
+ * @param ropts regularization terms
+ * @param ksp_dims dimensions of every k-space frame
+ * @param map_dims dimensions of the sensitivities
+ * @param maps sensitivities
+ * @param pat_dims dimensions of the sampling pattern
+ * @param pattern sampling pattern or weights (or NULL)
+ * @param traj_dims dimensions of the trajectory
+ * @param traj k-space trajectory (or NULL for Cartesian)
+ */
+struct pics_s* pics_create(const struct pics_conf* conf, const struct opt_reg_s* ropts,
+		const long ksp_dims[DIMS],
+		const long map_dims[DIMS], const complex float* maps,
+		const long pat_dims[DIMS], const complex float* pattern,
+		const long traj_dims[DIMS], const complex float* traj)
+{
+	PTR_ALLOC(struct pics_s, ctx);
+
+	ctx->conf = *conf;
+	ctx->ropts = *ropts;
+
+	ctx->image_truth = NULL;
+
+	md_copy_dims(DIMS, ctx->ksp_dims, ksp_dims);
+	md_copy_dims(DIMS, ctx->max_dims, ksp_dims);
+	md_copy_dims(5, ctx->max_dims, map_dims);
+
+	md_select_dims(DIMS, ~COIL_FLAG, ctx->img_dims, ctx->max_dims);
+
+	if (!md_check_compat(DIMS, ~(MD_BIT(MAPS_DIM)|FFT_FLAGS), ctx->img_dims, map_dims))
+		error("Dimensions of image and sensitivities do not match!\n");
+
+	assert(1 == ksp_dims[MAPS_DIM]);
+
+
+	ctx->pattern = NULL;
+
+	if (NULL != pattern) {
+
+		assert(md_check_compat(DIMS, COIL_FLAG, ksp_dims, pat_dims));
+
+		md_copy_dims(DIMS, ctx->pat_dims, pat_dims);
+		ctx->pattern = md_alloc(DIMS, pat_dims, CFL_SIZE);
+		md_copy(DIMS, pat_dims, ctx->pattern, pattern, CFL_SIZE);
+
+	} else {
+
+		md_select_dims(DIMS, ~COIL_FLAG, ctx->pat_dims, ksp_dims);
+	}
+
+	ctx->traj = NULL;
+
+	if (NULL != traj) {
+
+		ctx->traj = md_alloc(DIMS, traj_dims, CFL_SIZE);
+		md_copy(DIMS, traj_dims, ctx->traj, traj, CFL_SIZE);
+	}
+
+
+	complex float* maps2 = md_alloc(DIMS, map_dims, CFL_SIZE);
+	md_copy(DIMS, map_dims, maps2, maps, CFL_SIZE);
+
+	if (NULL == traj)
+		fftmod(DIMS, map_dims, FFT_FLAGS, maps2, maps2);
+
+	// apply fov mask to sensitivities
+
+	if (-1. != conf->restrict_fov) {
+
+		float restrict_dims[DIMS] = { [0 ... DIMS - 1] = 1. };
+		restrict_dims[0] = conf->restrict_fov;
+		restrict_dims[1] = conf->restrict_fov;
+		restrict_dims[2] = conf->restrict_fov;
+
+		apply_mask(DIMS, map_dims, maps2, restrict_dims);
+	}
+
+
+	// initialize forward_op and precond_op
+
+	ctx->precond_op = NULL;
+	ctx->adj_op = NULL;
+
+	ctx->weights = NULL;
+
+	if ((NULL == traj) && !conf->use_gpu && (1 == conf->sense.rwiter)) {
+
+		md_copy_dims(DIMS, ctx->wgh_dims, ctx->pat_dims);
+
+		// Without a pattern, it is estimated for each frame in pics_recon
+		// and may vary along the readout. A given pattern (also one which
+		// the caller estimated, as in main_pics) is checked here.
+
+		if ((NULL != pattern) && readout_constant(ctx->pat_dims, ctx->pattern))
+			ctx->wgh_dims[READ_DIM] = 1;
+
+		ctx->weights = md_alloc(DIMS, ctx->wgh_dims, CFL_SIZE);
+
+		if (NULL != pattern)
+			pics_weights(ctx, ctx->pattern);
+		else
+			md_zfill(DIMS, ctx->wgh_dims, ctx->weights, 1.);
+
+		ctx->forward_op = sense_stream_create(ctx->max_dims, FFT_FLAGS|COIL_FLAG|MAPS_FLAG, maps2,
+						ctx->wgh_dims, ctx->weights, conf->sense_mem, false);
+
+	} else if (NULL == traj) {
+
+		ctx->forward_op = sense_init(ctx->max_dims, FFT_FLAGS|COIL_FLAG|MAPS_FLAG, maps2, conf->use_gpu);
+
+	} else {
+
+		struct nufft_conf_s nuconf = nufft_conf_defaults;
+		nuconf.toeplitz = (NULL == pattern);
+
+		// all operators of the reconstruction share one scratch buffer
+		nuconf.workspace = workspace_create(0);
+
+		ctx->forward_op = sense_nc_init(ctx->max_dims, map_dims, maps2, ksp_dims, traj_dims, ctx->traj, nuconf, conf->use_gpu, (struct operator_s**)&ctx->precond_op);
+
+		workspace_free(nuconf.workspace);
+
+		// keep the plain SENSE operator for estimating the scaling
+
+		md_copy_dims(DIMS, ctx->adj_dims, ctx->img_dims);
+
+		if (0. == conf->scaling)
+			ctx->adj_op = linop_clone(ctx->forward_op);
+	}
+
+	md_free(maps2);
+
+	if (0. != conf->scaling)
+		debug_printf(DP_DEBUG1, "Scaling: %f\n", conf->scaling);
+
+
+	// initialize thresh_op
+
+	opt_reg_configure(ctx->max_dims, ctx->img_dims, &ctx->ropts, ctx->thresh_ops, ctx->trafos,
+			&ctx->forward_op, conf->llr_blk, conf->randshift, conf->use_gpu);
+
+	// initialize algorithm
+
+	italgo_config(ctx);
+
+	return ctx;
+}
+
+
+
+/**
+ * Dimensions of the reconstructed image (these may include
+ * additional levels for multi-scale low rank).
+ */
+void pics_img_dims(const struct pics_s* ctx, long img_dims[DIMS])
+{
+	md_copy_dims(DIMS, img_dims, ctx->img_dims);
+}
+
+
+
+/**
+ * Set an image which the iterations are compared to (for debugging),
+ * or NULL for none. The image is not copied and has to remain valid
+ * while the context is used.
+ */
+void pics_set_truth(struct pics_s* ctx, const long img_dims[DIMS], const complex float* image_truth)
+{
+	assert((NULL == image_truth) || md_check_compat(DIMS, 0u, img_dims, ctx->img_dims));
+
+	ctx->image_truth = image_truth;
+}
+
+
+
+/**
+ * Reconstruct one k-space frame. A context may only be
+ * used by one thread at a time.
+ *
+ * @param ctx reconstruction context
+ * @param img_dims image dimensions (see pics_img_dims)
+ * @param image output (and initial guess for warm start)
+ * @param ksp_dims k-space dimensions (as passed to pics_create)
+ * @param kspace k-space data
+ */
+void pics_recon(struct pics_s* ctx, const long img_dims[DIMS], complex float* image,
+		const long ksp_dims[DIMS], const complex float* kspace)
+{
+	assert(md_check_compat(DIMS, 0u, img_dims, ctx->img_dims));
+	assert(md_check_compat(DIMS, 0u, ksp_dims, ctx->ksp_dims));
+
+	complex float* ksp = md_alloc(DIMS, ksp_dims, CFL_SIZE);
+	md_copy(DIMS, ksp_dims, ksp, kspace, CFL_SIZE);
+
+	complex float* pattern = ctx->pattern;
+
+	if ((NULL == ctx->traj) && (NULL == ctx->pattern)) {
+
+		pattern = md_alloc(DIMS, ctx->pat_dims, CFL_SIZE);
+		estimate_pattern(DIMS, ksp_dims, COIL_DIM, pattern, ksp);
+	}
+
+	if (NULL == ctx->traj)
+		fftmod(DIMS, ksp_dims, FFT_FLAGS, ksp, ksp);
+
+	// apply scaling
+
+	float scaling = ctx->conf.scaling;
+
+	if (0. == scaling) {
+
+		if (NULL == ctx->traj) {
+
+			scaling = estimate_scaling(ksp_dims, NULL, ksp);
+
+		} else {
+
+			complex float* adj = md_alloc(DIMS, ctx->adj_dims, CFL_SIZE);
+
+			linop_adjoint(ctx->adj_op, DIMS, ctx->adj_dims, adj, DIMS, ksp_dims, ksp);
+			scaling = estimate_scaling_norm(1., md_calc_size(DIMS, ctx->adj_dims), adj, false);
+
+			md_free(adj);
+		}
+	}
+
+	if (0. != scaling)
+		md_zsmul(DIMS, ksp_dims, ksp, ksp, 1. / scaling);
+
+	// the weights are part of the forward operator
+
+	if (NULL != ctx->weights) {
+
+		if (pattern != ctx->pattern)
+			pics_weights(ctx, pattern);
+
+		long strs[DIMS];
+		long pat_strs[DIMS];
+		md_calc_strides(DIMS, strs, ksp_dims, CFL_SIZE);
+		md_calc_strides(DIMS, pat_strs, ctx->wgh_dims, CFL_SIZE);
+
+		md_zmul2(DIMS, ksp_dims, strs, ksp, strs, ksp, pat_strs, ctx->weights);
+	}
+
+	const complex float* pattern2 = (NULL != ctx->weights) ? NULL : pattern;
+
+
+	if (!ctx->conf.warm_start)
+		md_clear(DIMS, img_dims, image, CFL_SIZE);
+	else
+	// if rescaling at the end, assume the input has also been rescaled
+	if (ctx->conf.scale_im && (0. != scaling))
+		md_zsmul(DIMS, img_dims, image, image, 1. / scaling);
+
+
+	// sense_recon2 consumes the operator
+
+	const struct linop_s* forward_op = linop_clone(ctx->forward_op);
+	const struct linop_s** trafos = (ADMM == ctx->algo) ? ctx->trafos : NULL;
+
+	if (ctx->conf.use_gpu)
+#ifdef USE_CUDA
+		sense_recon2_gpu(&ctx->conf.sense, ctx->max_dims, image, forward_op, ctx->pat_dims, pattern,
+				 ctx->italgo, ctx->iconf, ctx->nr_penalties, ctx->thresh_ops,
+				 trafos, ksp_dims, ksp, ctx->image_truth, ctx->precond_op);
+#else
+	assert(0);
+#endif
+	else
+		sense_recon2(&ctx->conf.sense, ctx->max_dims, image, forward_op, ctx->pat_dims, pattern2,
+			     ctx->italgo, ctx->iconf, ctx->nr_penalties, ctx->thresh_ops,
+			     trafos, ksp_dims, ksp, ctx->image_truth, ctx->precond_op);
+
+	if (ctx->conf.scale_im)
+		md_zsmul(DIMS, img_dims, image, image, scaling);
+
+	if (pattern != ctx->pattern)
+		md_free(pattern);
+
+	md_free(ksp);
+}
+
+
+
+/**
+ * Reconstruct the readout positions of Cartesian data independently.
+ *
+ * The k-space is transformed along the readout, which decouples the
+ * positions x if the pattern is constant along the readout, and each
+ * position is reconstructed as a separate problem (compare parslices).
+ * The problems are distributed over the threads. Each one has its own
+ * operators (and FFT plans) and writes its result directly into the
+ * image. The k-space scaling is estimated once for the whole data.
+ * Regularization terms are applied to each position separately.
+ *
+ * @param conf configuration
+ * @param ropts regularization options
+ * @param img_dims image dimensions
+ * @param image output (and initial guess for warm start)
+ * @param ksp_dims k-space dimensions
+ * @param kspace k-space data
+ * @param map_dims dimensions of the sensitivities
+ * @param maps sensitivities
+ * @param pat_dims dimensions of the sampling pattern
+ * @param pattern sampling pattern or weights (not NULL)
+ */
+void pics_recon_decoupled(const struct pics_conf* conf, const struct opt_reg_s* ropts,
+		const long img_dims[DIMS], complex float* image,
+		const long ksp_dims[DIMS], const complex float* kspace,
+		const long map_dims[DIMS], const complex float* maps,
+		const long pat_dims[DIMS], const complex float* pattern)
+{
+	if (conf->use_gpu)
+		error("Decoupled reconstruction is not supported on the GPU.\n");
+
+	assert(NULL != pattern);
+
+	if (!readout_constant(pat_dims, pattern))
+		error("Decoupled reconstruction needs a pattern which is constant along the readout.\n");
+
+	struct pics_conf conf1 = *conf;
+
+	if (0. == conf1.scaling) {
+
+		conf1.scaling = estimate_scaling(ksp_dims, NULL, kspace);
+		debug_printf(DP_INFO, "Scaling: %f\n", conf1.scaling);
+	}
+
+	complex float* ksp = md_alloc(DIMS, ksp_dims, CFL_SIZE);
+	ifftuc(DIMS, ksp_dims, READ_FLAG, ksp, kspace);
+
+	long img_strs[DIMS];
+	long ksp_strs[DIMS];
+	long map_strs[DIMS];
+	long pat_strs[DIMS];
+
+	md_calc_strides(DIMS, img_strs, img_dims, CFL_SIZE);
+	md_calc_strides(DIMS, ksp_strs, ksp_dims, CFL_SIZE);
+	md_calc_strides(DIMS, map_strs, map_dims, CFL_SIZE);
+	md_calc_strides(DIMS, pat_strs, pat_dims, CFL_SIZE);
+
+	// dimensions of one position
+
+	long img1_dims[DIMS];
+	long ksp1_dims[DIMS];
+	long map1_dims[DIMS];
+	long pat1_dims[DIMS];
+
+	md_select_dims(DIMS, ~READ_FLAG, img1_dims, img_dims);
+	md_select_dims(DIMS, ~READ_FLAG, ksp1_dims, ksp_dims);
+	md_select_dims(DIMS, ~READ_FLAG, map1_dims, map_dims);
+	md_select_dims(DIMS, ~READ_FLAG, pat1_dims, pat_dims);
+
+	long img1_strs[DIMS];
+	long ksp1_strs[DIMS];
+	long map1_strs[DIMS];
+	long pat1_strs[DIMS];
+
+	md_calc_strides(DIMS, img1_strs, img1_dims, CFL_SIZE);
+	md_calc_strides(DIMS, ksp1_strs, ksp1_dims, CFL_SIZE);
+	md_calc_strides(DIMS, map1_strs, map1_dims, CFL_SIZE);
+	md_calc_strides(DIMS, pat1_strs, pat1_dims, CFL_SIZE);
+
+	// the pattern is the same for all positions
+
+	complex float* pattern1 = md_alloc(DIMS, pat1_dims, CFL_SIZE);
+	md_copy2(DIMS, pat1_dims, pat1_strs, pattern1, pat_strs, pattern, CFL_SIZE);
+
+	// parallelize over positions only: nested parallel regions
+	// run serially and FFT plans created inside the parallel
+	// region are single-threaded (see fft_fftwf_plan)
+
+	int counter = 0;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (long i = 0; i < ksp_dims[READ_DIM]; i++) {
+
+		complex float* map1 = md_alloc(DIMS, map1_dims, CFL_SIZE);
+		md_copy2(DIMS, map1_dims, map1_strs, map1, map_strs, (const void*)maps + i * map_strs[READ_DIM], CFL_SIZE);
+
+		complex float* ksp1 = md_alloc(DIMS, ksp1_dims, CFL_SIZE);
+		md_copy2(DIMS, ksp1_dims, ksp1_strs, ksp1, ksp_strs, (const void*)ksp + i * ksp_strs[READ_DIM], CFL_SIZE);
+
+		struct pics_s* ctx = pics_create(&conf1, ropts, ksp1_dims, map1_dims, map1, pat1_dims, pattern1, NULL, NULL);
+
+		md_free(map1);
+
+		long dims1[DIMS];
+		pics_img_dims(ctx, dims1);
+
+		if (!md_check_compat(DIMS, 0u, dims1, img1_dims))
+			error("Decoupled reconstruction: image dimensions do not match.\n");
+
+		complex float* img1 = md_alloc(DIMS, img1_dims, CFL_SIZE);
+		void* out = (void*)image + i * img_strs[READ_DIM];
+
+		if (conf->warm_start)
+			md_copy2(DIMS, img1_dims, img1_strs, img1, img_strs, out, CFL_SIZE);
+
+		pics_recon(ctx, img1_dims, img1, ksp1_dims, ksp1);
+
+		md_copy2(DIMS, img1_dims, img_strs, out, img1_strs, img1, CFL_SIZE);
+
+		pics_free(ctx);
+
+		md_free(img1);
+		md_free(ksp1);
+
+		#pragma omp critical
+		{ debug_printf(DP_DEBUG2, "%04d/%04ld    \r", ++counter, ksp_dims[READ_DIM]); }
+	}
+
+	debug_printf(DP_DEBUG2, "\n");
+
+	md_free(pattern1);
+	md_free(ksp);
+}
+
+
+
+void pics_free(struct pics_s* ctx)
+{
+	opt_reg_free(&ctx->ropts, ctx->thresh_ops, ctx->trafos);
+
+	linop_free(ctx->forward_op);
+
+	if (NULL != ctx->adj_op)
+		linop_free(ctx->adj_op);
+
+	// the nufft references the trajectory
+
+	md_free(ctx->traj);
+	md_free(ctx->pattern);
+	md_free(ctx->weights);
+
+	free(ctx);
+}
@@ -0,0 +1,83 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ */
+
+#ifndef __PICS_H
+#define __PICS_H 1
+
+#include <stdbool.h>
+
+#include "misc/mri.h"
+#include "misc/cppwrap.h"
+
+#include "sense/recon.h"
+
+
+struct opt_reg_s;
+
+
+/**
+ * configuration parameters for pics reconstruction
+ *
+ * @param sense sense configuration
+ * @param scaling k-space scaling, 0. to estimate it for every frame
+ * @param scale_im undo the k-space scaling in the image
+ * @param warm_start use the image passed to pics_recon as initial guess
+ * @param restrict_fov restrict field of view of the sensitivities, -1. for none
+ * @param sense_mem memory for coil images (in bytes) of the Cartesian SENSE operator, 0 for all coils
+ */
+struct pics_conf {
+
+	struct sense_conf sense;
+
+	unsigned int maxiter;
+	float step;
+	_Bool eigen;
+	_Bool randshift;
+	_Bool hogwild;
+	_Bool fast;
+	float admm_rho;
+	unsigned int admm_maxitercg;
+	unsigned int llr_blk;
+
+	float restrict_fov;
+	float scaling;
+	_Bool scale_im;
+	_Bool warm_start;
+
+	_Bool use_gpu;
+	long sense_mem;
+};
+
+extern const struct pics_conf pics_defaults;
+
+
+struct pics_s;
+
+extern struct pics_s* pics_create(const struct pics_conf* conf, const struct opt_reg_s* ropts,
+		const long ksp_dims[DIMS],
+		const long map_dims[DIMS], const _Complex float* maps,
+		const long pat_dims[DIMS], const _Complex float* pattern,
+		const long traj_dims[DIMS], const _Complex float* traj);
+
+extern void pics_img_dims(const struct pics_s* ctx, long img_dims[DIMS]);
+
+extern void pics_set_truth(struct pics_s* ctx, const long img_dims[DIMS], const _Complex float* image_truth);
+
+extern void pics_recon(struct pics_s* ctx, const long img_dims[DIMS], _Complex float* image,
+		const long ksp_dims[DIMS], const _Complex float* kspace);
+
+extern void pics_free(struct pics_s* ctx);
+
+// the pattern has to be given (it is not estimated)
+extern void pics_recon_decoupled(const struct pics_conf* conf, const struct opt_reg_s* ropts,
+		const long img_dims[DIMS], _Complex float* image,
+		const long ksp_dims[DIMS], const _Complex float* kspace,
+		const long map_dims[DIMS], const _Complex float* maps,
+		const long pat_dims[DIMS], const _Complex float* pattern);
+
+
+#include "misc/cppwrap.h"
+
+#endif	// __PICS_H
@@ -55,6 +55,12 @@ static void ravine(const struct vec_iter_s* vops, long N, float* ftp, float* xa,
 	ft = (1.f + sqrtf(1.f + 4.f * ft * ft)) / 2.f;
 	*ftp = ft;
 
+	if (NULL != vops->momentum) {
+
+		vops->momentum(N, (tfo - 1.f) / ft, xa, xb);
+		return;
+	}
+
 	vops->swap(N, xa, xb);
 	vops->axpy(N, xa, (1.f - tfo) / ft - 1.f, xa);
 	vops->axpy(N, xa, (tfo - 1.f) / ft + 1.f, xb);
@@ -62,6 +68,47 @@ static void ravine(const struct vec_iter_s* vops, long N, float* ftp, float* xa,
 
 
 
+/*
+ * Fused vector operations. Fall back to
+ * separate passes if not provided by vops.
+ */
+
+// a = beta * a + x, returns ||a||^2
+static double xpay_norm2(const struct vec_iter_s* vops, long N, float beta, float* a, const float* x)
+{
+	if (NULL != vops->xpay_norm2)
+		return vops->xpay_norm2(N, beta, a, x);
+
+	vops->xpay(N, beta, a, x);
+
+	return pow(vops->norm(N, a), 2.);
+}
+
+// a = a + alpha * x, returns <x, a>
+static double axpy_dot(const struct vec_iter_s* vops, long N, float* a, float alpha, const float* x)
+{
+	if (NULL != vops->axpy_dot)
+		return vops->axpy_dot(N, a, alpha, x);
+
+	vops->axpy(N, a, alpha, x);
+
+	return vops->dot(N, x, a);
+}
+
+// x = x + alpha * p, r = r - alpha * Ap, returns ||r||^2
+static double cg_update(const struct vec_iter_s* vops, long N, float alpha, float* x, const float* p, float* r, const float* Ap)
+{
+	if (NULL != vops->cg_update)
+		return vops->cg_update(N, alpha, x, p, r, Ap);
+
+	vops->axpy(N, x, +alpha, p);
+	vops->axpy(N, r, -alpha, Ap);
+
+	return pow(vops->norm(N, r), 2.);
+}
+
+
+
 
 
 
@@ -80,9 +127,7 @@ void landweber_sym(unsigned int maxiter, float epsilon, float alpha, long N, voi
 	for (unsigned int i = 0; i < maxiter; i++) {
 
 		op(data, r, x);		// r = A x
-		vops->xpay(N, -1., r, b);	// r = b - r = b - A x
-
-		double rsnew = vops->norm(N, r);
+		double rsnew = sqrt(xpay_norm2(vops, N, -1., r, b));	// r = b - A x
 
 		debug_printf(DP_DEBUG3, "#%d: %f\n", i, rsnew / rsnot);
 
@@ -219,9 +264,7 @@ void ist(unsigned int maxiter, float epsilon, float tau,
 
 
 		op(data, r, x);		// r = A x
-		vops->xpay(N, -1., r, b);	// r = b - r = b - A x
-
-		itrdata.rsnew = vops->norm(N, r);
+		itrdata.rsnew = sqrt(xpay_norm2(vops, N, -1., r, b));	// r = b - A x
 
 		debug_printf(DP_DEBUG3, "#It %03d: %f \n", itrdata.iter, itrdata.rsnew / itrdata.rsnot);
 
@@ -333,9 +376,7 @@ void fista(unsigned int maxiter, float epsilon, float tau,
 
 		ravine(vops, N, &ra, x, o);	// FISTA
 		op(data, r, x);		// r = A x
-		vops->xpay(N, -1., r, b);	// r = b - r = b - A x
-
-		itrdata.rsnew = vops->norm(N, r);
+		itrdata.rsnew = sqrt(xpay_norm2(vops, N, -1., r, b));	// r = b - A x
 
 		debug_printf(DP_DEBUG3, "#It %03d: %f   \n", itrdata.iter, itrdata.rsnew / itrdata.rsnot);
 
@@ -388,9 +429,7 @@ void landweber(unsigned int maxiter, float epsilon, float alpha, long N, long M,
 	for (unsigned int i = 0; i < maxiter; i++) {
 
 		op(data, r, x);		// r = A x
-		vops->xpay(M, -1., r, b);	// r = b - r = b - A x
-
-		double rsnew = vops->norm(M, r);
+		double rsnew = sqrt(xpay_norm2(vops, M, -1., r, b));	// r = b - A x
 
 		debug_printf(DP_DEBUG3, "#%d: %f\n", i, rsnew / rsnot);
 
@@ -443,10 +482,9 @@ float conjgrad(unsigned int maxiter, float l2lambda, float epsilon,
 	linop(data, r, x);		// r = A x
 	vops->axpy(N, r, l2lambda, x);
 
-	vops->xpay(N, -1., r, b);	// r = b - r = b - A x
+	float rsnot = (float)xpay_norm2(vops, N, -1., r, b);	// r = b - A x
 	vops->copy(N, p, r);		// p = r
 
-	float rsnot = (float)pow(vops->norm(N, r), 2.);
 	float rsold = rsnot;
 	float rsnew = rsnot;
 
@@ -475,19 +513,15 @@ float conjgrad(unsigned int maxiter, float l2lambda, float epsilon,
 		debug_printf(DP_DEBUG3, "#%d: %f\n", i, (double)sqrtf(rsnew));
 
 		linop(data, Ap, p);	// Ap = A p
-		vops->axpy(N, Ap, l2lambda, p);
 
-		float pAp = (float)vops->dot(N, p, Ap);
+		float pAp = (float)axpy_dot(vops, N, Ap, l2lambda, p);
 
 		if (0. == pAp)
 			break;
 
 		float alpha = rsold / pAp;
 
-		vops->axpy(N, x, +alpha, p);
-		vops->axpy(N, r, -alpha, Ap);
-	
-		rsnew = (float)pow(vops->norm(N, r), 2.);
+		rsnew = (float)cg_update(vops, N, alpha, x, p, r, Ap);
 		float beta = rsnew / rsold;
 		
 		rsold = rsnew;
@@ -540,10 +574,9 @@ float conjgrad_hist(struct iter_history_s* history, unsigned int maxiter, float
 	linop(data, r, x);		// r = A x
 	vops->axpy(N, r, l2lambda, x);
 
-	vops->xpay(N, -1., r, b);	// r = b - r = b - A x
+	float rsnot = (float)xpay_norm2(vops, N, -1., r, b);	// r = b - A x
 	vops->copy(N, p, r);		// p = r
 
-	float rsnot = (float)pow(vops->norm(N, r), 2.);
 	float rsold = rsnot;
 	float rsnew = rsnot;
 
@@ -573,14 +606,10 @@ float conjgrad_hist(struct iter_history_s* history, unsigned int maxiter, float
 		//debug_printf(DP_DEBUG3, "#%d: %f\n", i, (double)sqrtf(rsnew));
 
 		linop(data, Ap, p);	// Ap = A p
-		vops->axpy(N, Ap, l2lambda, p);
 
-		float alpha = rsold / (float)vops->dot(N, p, Ap);
+		float alpha = rsold / (float)axpy_dot(vops, N, Ap, l2lambda, p);
 
-		vops->axpy(N, x, +alpha, p);
-		vops->axpy(N, r, -alpha, Ap);
-	
-		rsnew = (float)pow(vops->norm(N, r), 2.);
+		rsnew = (float)cg_update(vops, N, alpha, x, p, r, Ap);
 		float beta = rsnew / rsold;
 		
 		rsold = rsnew;
@@ -665,10 +694,9 @@ float conjgrad_hist_prealloc(struct iter_history_s* history, unsigned int maxite
 	linop(data, r, x);		// r = A x
 	vops->axpy(N, r, l2lambda, x);
 
-	vops->xpay(N, -1., r, b);	// r = b - r = b - A x
+	float rsnot = (float)xpay_norm2(vops, N, -1., r, b);	// r = b - A x
 	vops->copy(N, p, r);		// p = r
 
-	float rsnot = (float)pow(vops->norm(N, r), 2.);
 	float rsold = rsnot;
 	float rsnew = rsnot;
 
@@ -697,14 +725,10 @@ float conjgrad_hist_prealloc(struct iter_history_s* history, unsigned int maxite
 		//debug_printf(DP_DEBUG3, "#%d: %f\n", i, (double)sqrtf(rsnew));
 
 		linop(data, Ap, p);	// Ap = A p
-		vops->axpy(N, Ap, l2lambda, p);
 
-		float alpha = rsold / (float)vops->dot(N, p, Ap);
+		float alpha = rsold / (float)axpy_dot(vops, N, Ap, l2lambda, p);
 
-		vops->axpy(N, x, +alpha, p);
-		vops->axpy(N, r, -alpha, Ap);
-	
-		rsnew = (float)pow(vops->norm(N, r), 2.);
+		rsnew = (float)cg_update(vops, N, alpha, x, p, r, Ap);
 		float beta = rsnew / rsold;
 		
 		rsold = rsnew;
@@ -7,7 +7,7 @@
 #include "vec.h"
 
 
-// defined in vecops.c and gpuops.c
+// defined in vecops.c, vecops_par.c and gpuops.c
 
 
 
@@ -16,10 +16,10 @@
 const struct vec_iter_s* select_vecops(const float* x)
 {
 #ifdef USE_CUDA
-	return cuda_ondevice(x) ? &gpu_iter_ops : &cpu_iter_ops;
+	return cuda_ondevice(x) ? &gpu_iter_ops : &cpu_par_iter_ops;
 #else
 	UNUSED(x);
-	return &cpu_iter_ops;
+	return &cpu_par_iter_ops;
 #endif
 }
 
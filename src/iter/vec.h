@@ -19,12 +19,24 @@ struct vec_iter_s {
 	void (*smul)(long N, float alpha, float* a, const float* x);
 	void (*xpay)(long N, float alpha, float* a, const float* x);
 	void (*axpy)(long N, float* a, float alpha, const float* x);
+
+	// fused operations (optional, may be NULL):
+	// axpy_dot:	a += alpha * x, returns <x, a>
+	// xpay_norm2:	a = beta * a + x, returns ||a||^2
+	// cg_update:	x += alpha * p, r -= alpha * Ap, returns ||r||^2
+	// momentum:	(x, o) = (x + theta * (x - o), x)
+
+	double (*axpy_dot)(long N, float* a, float alpha, const float* x);
+	double (*xpay_norm2)(long N, float beta, float* a, const float* x);
+	double (*cg_update)(long N, float alpha, float* x, const float* p, float* r, const float* Ap);
+	void (*momentum)(long N, float theta, float* x, float* o);
 };
 
 #ifdef USE_CUDA
 extern const struct vec_iter_s gpu_iter_ops;
 #endif
 extern const struct vec_iter_s cpu_iter_ops;
+extern const struct vec_iter_s cpu_par_iter_ops;
 
 extern const struct vec_iter_s* select_vecops(const float* x);
 
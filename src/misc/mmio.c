@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <errno.h>
 
 #include <sys/mman.h>
 
@@ -28,6 +29,7 @@
 
 #include "misc/misc.h"
 #include "misc/io.h"
+#include "misc/debug.h"
 
 #include "mmio.h"
 
@@ -51,6 +53,37 @@ static void io_error(const char* fmt, ...)
 }
 
 
+
+/*
+ * Names of the form "shm:/name" refer to POSIX shared memory objects
+ * (on Linux these are files in /dev/shm). The header and the data are
+ * stored in the objects "/name.hdr" and "/name.cfl", so that a caller
+ * can pass arrays in memory without going through the file system.
+ */
+#define SHM_PREFIX "shm:"
+
+static bool shm_name(const char* name)
+{
+	return (0 == strncmp(name, SHM_PREFIX, strlen(SHM_PREFIX)));
+}
+
+static int cfl_open(const char* name, int flags, mode_t mode)
+{
+	if (!shm_name(name))
+		return open(name, flags, mode);
+
+	name += strlen(SHM_PREFIX);
+
+	// shm_open needs exactly one leading slash
+
+	char shm[1024];
+	if (1024 <= snprintf(shm, 1024, "%s%s", ('/' == name[0]) ? "" : "/", name))
+		return -1;
+
+	return shm_open(shm, flags, mode);
+}
+
+
 complex float* load_zra(const char* name, unsigned int D, long dims[D])
 {
 	int fd;
@@ -192,7 +225,7 @@ complex float* create_cfl(const char* name, unsigned int D, const long dimension
 		io_error("Creating cfl file %s", name);
 
 	int ofd;
-	if (-1 == (ofd = open(name_hdr, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)))
+	if (-1 == (ofd = cfl_open(name_hdr, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)))
 		io_error("Creating cfl file %s", name);
 
 	if (-1 == write_cfl_header(ofd, D, dimensions))
@@ -271,7 +304,7 @@ static complex float* load_cfl_internal(const char* name, unsigned int D, long d
 		io_error("Loading cfl file %s", name);
 
 	int ofd;
-	if (-1 == (ofd = open(name_hdr, O_RDONLY)))
+	if (-1 == (ofd = cfl_open(name_hdr, O_RDONLY, 0)))
 		io_error("Loading cfl file %s", name);
 
 	if (-1 == read_cfl_header(ofd, D, dimensions))
@@ -305,7 +338,7 @@ complex float* shared_cfl(unsigned int D, const long dims[D], const char* name)
 
 	long T = md_calc_size(D, dims) * sizeof(complex float);
 
-        if (-1 == (fd = open(name, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)))
+        if (-1 == (fd = cfl_open(name, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)))
                 abort();
 
 //	if (-1 == (fstat(fd, &st)))
@@ -373,7 +406,7 @@ complex float* private_cfl(unsigned int D, const long dims[D], const char* name)
 	void* addr;
 	struct stat st;
 
-	if (-1 == (fd = open(name, O_RDONLY)))
+	if (-1 == (fd = cfl_open(name, O_RDONLY, 0)))
 		abort();
 
 	if (-1 == (fstat(fd, &st)))
@@ -404,3 +437,335 @@ void unmap_cfl(unsigned int D, const long dims[D], const complex float* x)
 		abort();
 }
 
+
+
+
+
+/*
+ * Chunked access to cfl files.
+ *
+ * A stream reads or writes a file in chunks which cover the full
+ * extent of all dimensions except a set of outer dimensions selected
+ * by 'flags' (e.g. slices or time frames). Data is transferred with
+ * pread/pwrite instead of mapping the whole file, so that tools which
+ * loop over chunks run in bounded memory. After each read the kernel
+ * is asked to read ahead the next chunk, and written chunks are
+ * flushed in the background and dropped from the page cache once the
+ * following chunk has been written.
+ *
+ * Files which are not plain cfl files (.ra, .coo) are mapped instead.
+ */
+struct cfl_stream_s {
+
+	int fd;
+	complex float* map;
+
+	off_t wb_off;	// range of the previous write (write-behind)
+	off_t wb_len;
+
+	unsigned int D;
+	long dims[];
+};
+
+
+static struct cfl_stream_s* stream_alloc(unsigned int D, const long dims[D])
+{
+	struct cfl_stream_s* s = xmalloc(sizeof(struct cfl_stream_s) + D * sizeof(long));
+
+	s->fd = -1;
+	s->map = NULL;
+	s->wb_off = 0;
+	s->wb_len = 0;
+	s->D = D;
+	md_copy_dims(D, s->dims, dims);
+
+	return s;
+}
+
+
+static bool stream_mapped(const char* name)
+{
+	const char *p = strrchr(name, '.');
+
+	return ((NULL != p) && (p != name) && ((0 == strcmp(p, ".ra")) || (0 == strcmp(p, ".coo"))));
+}
+
+
+struct cfl_stream_s* load_cfl_stream(const char* name, unsigned int D, long dims[D])
+{
+	if (stream_mapped(name)) {
+
+		complex float* map = load_cfl(name, D, dims);
+
+		struct cfl_stream_s* s = stream_alloc(D, dims);
+		s->map = map;
+
+		return s;
+	}
+
+	char name_bdy[1024];
+	if (1024 <= snprintf(name_bdy, 1024, "%s.cfl", name))
+		io_error("Loading cfl file %s", name);
+
+	char name_hdr[1024];
+	if (1024 <= snprintf(name_hdr, 1024, "%s.hdr", name))
+		io_error("Loading cfl file %s", name);
+
+	int fd;
+	if (-1 == (fd = cfl_open(name_hdr, O_RDONLY, 0)))
+		io_error("Loading cfl file %s", name);
+
+	if (-1 == read_cfl_header(fd, D, dims))
+		io_error("Loading cfl file %s", name);
+
+	if (-1 == close(fd))
+		io_error("Loading cfl file %s", name);
+
+	struct cfl_stream_s* s = stream_alloc(D, dims);
+
+	if (-1 == (s->fd = cfl_open(name_bdy, O_RDONLY, 0)))
+		io_error("Loading cfl file %s", name);
+
+	struct stat st;
+
+	if (-1 == fstat(s->fd, &st))
+		io_error("Loading cfl file %s", name);
+
+	if (md_calc_size(D, dims) * (off_t)sizeof(complex float) != st.st_size)
+		io_error("Loading cfl file %s", name);
+
+	return s;
+}
+
+
+struct cfl_stream_s* create_cfl_stream(const char* name, unsigned int D, const long dims[D])
+{
+	struct cfl_stream_s* s = stream_alloc(D, dims);
+
+	if (stream_mapped(name)) {
+
+		s->map = create_cfl(name, D, dims);
+		return s;
+	}
+
+	char name_bdy[1024];
+	if (1024 <= snprintf(name_bdy, 1024, "%s.cfl", name))
+		io_error("Creating cfl file %s", name);
+
+	char name_hdr[1024];
+	if (1024 <= snprintf(name_hdr, 1024, "%s.hdr", name))
+		io_error("Creating cfl file %s", name);
+
+	int fd;
+	if (-1 == (fd = cfl_open(name_hdr, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)))
+		io_error("Creating cfl file %s", name);
+
+	if (-1 == write_cfl_header(fd, D, dims))
+		io_error("Creating cfl file %s", name);
+
+	if (-1 == close(fd))
+		io_error("Creating cfl file %s", name);
+
+	// as for create_cfl, existing data is kept (e.g. for fmac -A)
+
+	if (-1 == (s->fd = cfl_open(name_bdy, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR)))
+		io_error("Creating cfl file %s", name);
+
+	if (-1 == ftruncate(s->fd, md_calc_size(D, dims) * sizeof(complex float)))
+		io_error("Creating cfl file %s", name);
+
+	return s;
+}
+
+
+
+/**
+ * Select outer dimensions to loop over such that a chunk
+ * fits into the memory budget (BART_CHUNK_MB, default 256 MB).
+ * Dimensions in 'keep' are never split.
+ */
+unsigned long cfl_stream_flags(unsigned int D, const long dims[D], unsigned long keep)
+{
+	long budget = 256;
+
+	const char* str = getenv("BART_CHUNK_MB");
+
+	if ((NULL != str) && (0 < atol(str)))
+		budget = atol(str);
+
+	budget *= 1024 * 1024;
+
+	long cdims[D];
+	md_copy_dims(D, cdims, dims);
+
+	unsigned long flags = 0;
+
+	for (int i = D - 1; (0 <= i) && (md_calc_size(D, cdims) * (long)sizeof(complex float) > budget); i--) {
+
+		if (MD_IS_SET(keep, i) || (1 == dims[i]))
+			continue;
+
+		flags = MD_SET(flags, i);
+		cdims[i] = 1;
+	}
+
+	debug_printf(DP_DEBUG2, "cfl stream: %ld chunks (flags: %lu)\n", md_calc_size(D, dims) / md_calc_size(D, cdims), flags);
+
+	return flags;
+}
+
+
+
+static void stream_xfer(bool wr, int fd, char* buf, size_t len, off_t off)
+{
+	while (len > 0) {
+
+		ssize_t r = wr ? pwrite(fd, buf, len, off) : pread(fd, buf, len, off);
+
+		if ((-1 == r) && (EINTR == errno))
+			continue;
+
+		if (r <= 0)
+			io_error("%s cfl stream", wr ? "Writing" : "Reading");
+
+		buf += r;
+		len -= r;
+		off += r;
+	}
+}
+
+
+// byte range of the file touched by a chunk
+
+static void stream_range(const struct cfl_stream_s* s, unsigned long flags, const long pos[s->D], off_t* off, off_t* len)
+{
+	unsigned int D = s->D;
+
+	long strs[D];
+	md_calc_strides(D, strs, s->dims, sizeof(complex float));
+
+	long last[D];
+
+	for (unsigned int i = 0; i < D; i++)
+		last[i] = MD_IS_SET(flags, i) ? pos[i] : (s->dims[i] - 1);
+
+	*off = md_calc_offset(D, strs, pos);
+	*len = md_calc_offset(D, strs, last) + (off_t)sizeof(complex float) - *off;
+}
+
+
+static void stream_chunk(struct cfl_stream_s* s, bool wr, unsigned long flags, const long pos[s->D], complex float* chunk)
+{
+	unsigned int D = s->D;
+
+	long cdims[D];
+	md_select_dims(D, ~flags, cdims, s->dims);
+
+	for (unsigned int i = 0; i < D; i++)
+		assert(MD_IS_SET(flags, i) ? ((0 <= pos[i]) && (pos[i] < s->dims[i])) : (0 == pos[i]));
+
+	if (NULL != s->map) {
+
+		if (wr)
+			md_copy_block(D, pos, s->dims, s->map, cdims, chunk, sizeof(complex float));
+		else
+			md_copy_block(D, pos, cdims, chunk, s->dims, s->map, sizeof(complex float));
+
+		return;
+	}
+
+	// transfer contiguous runs: all dimensions up to
+	// the first outer dimension are stored contiguously
+
+	unsigned int k = 0;
+	long run = 1;
+
+	while ((k < D) && (cdims[k] == s->dims[k]))
+		run *= cdims[k++];
+
+	unsigned long rflags = ~flags & ~(MD_BIT(k) - 1);
+
+	long strs[D];
+	md_calc_strides(D, strs, s->dims, sizeof(complex float));
+
+	long rpos[D];
+	md_copy_dims(D, rpos, pos);
+
+	long n = 0;
+
+	do {
+		stream_xfer(wr, s->fd, (char*)(chunk + n), run * sizeof(complex float), md_calc_offset(D, strs, rpos));
+		n += run;
+
+	} while (md_next(D, s->dims, rflags, rpos));
+
+	assert(n == md_calc_size(D, cdims));
+}
+
+
+void cfl_stream_read(struct cfl_stream_s* s, unsigned int D, unsigned long flags, const long pos[D], complex float* chunk)
+{
+	assert(D == s->D);
+
+	stream_chunk(s, false, flags, pos, chunk);
+
+#ifdef POSIX_FADV_WILLNEED
+	if (NULL != s->map)
+		return;
+
+	// read ahead the next chunk while the caller computes
+
+	long next[D];
+	md_copy_dims(D, next, pos);
+
+	if (md_next(D, s->dims, flags, next)) {
+
+		off_t off, len;
+		stream_range(s, flags, next, &off, &len);
+		posix_fadvise(s->fd, off, len, POSIX_FADV_WILLNEED);
+	}
+#endif
+}
+
+
+void cfl_stream_write(struct cfl_stream_s* s, unsigned int D, unsigned long flags, const long pos[D], const complex float* chunk)
+{
+	assert(D == s->D);
+
+	stream_chunk(s, true, flags, pos, (complex float*)chunk);
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	if (NULL != s->map)
+		return;
+
+	// start writing back this chunk, wait for the previous
+	// one and release its pages so that dirty memory stays
+	// bounded by about two chunks
+
+	off_t off, len;
+	stream_range(s, flags, pos, &off, &len);
+
+	sync_file_range(s->fd, off, len, SYNC_FILE_RANGE_WRITE);
+
+	if (0 < s->wb_len) {
+
+		sync_file_range(s->fd, s->wb_off, s->wb_len, SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(s->fd, s->wb_off, s->wb_len, POSIX_FADV_DONTNEED);
+	}
+
+	s->wb_off = off;
+	s->wb_len = len;
+#endif
+}
+
+
+void cfl_stream_close(struct cfl_stream_s* s)
+{
+	if (NULL != s->map)
+		unmap_cfl(s->D, s->dims, s->map);
+
+	if ((-1 != s->fd) && (-1 == close(s->fd)))
+		io_error("Closing cfl stream");
+
+	free(s);
+}
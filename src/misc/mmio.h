@@ -32,6 +32,15 @@ extern _Complex float* load_zcoo(const char* name, unsigned int D, long dimensio
 extern _Complex float* create_zra(const char* name, unsigned int D, const long dims[__VLA(D)]);
 extern _Complex float* load_zra(const char* name, unsigned int D, long dims[__VLA(D)]);
 
+
+struct cfl_stream_s;
+extern struct cfl_stream_s* load_cfl_stream(const char* name, unsigned int D, long dims[__VLA(D)]);
+extern struct cfl_stream_s* create_cfl_stream(const char* name, unsigned int D, const long dims[__VLA(D)]);
+extern unsigned long cfl_stream_flags(unsigned int D, const long dims[__VLA(D)], unsigned long keep);
+extern void cfl_stream_read(struct cfl_stream_s* s, unsigned int D, unsigned long flags, const long pos[__VLA(D)], _Complex float* chunk);
+extern void cfl_stream_write(struct cfl_stream_s* s, unsigned int D, unsigned long flags, const long pos[__VLA(D)], const _Complex float* chunk);
+extern void cfl_stream_close(struct cfl_stream_s* s);
+
 #ifdef __cplusplus
 }
 #endif
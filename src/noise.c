@@ -13,6 +13,7 @@
 #include <math.h>
 
 #include "num/multind.h"
+#include "num/flpmath.h"
 #include "num/rand.h"
 
 #include "misc/mmio.h"
@@ -58,25 +59,34 @@ int main_noise(int argc, char* argv[])
 
 	complex float* x = create_cfl(argv[2], N, dims);
 
-	long T = md_calc_size(N, dims);
-
 	// scale var for complex data
 	if (!rvc)
 		var = var / 2.f;
 
 	float stdev = sqrtf(var);
 
-	for (long i = 0; i < T; i++) {
+	md_zgaussian_rand(N, dims, x);
+	md_zsmul(N, dims, x, x, stdev);
+
+	if (spike < 1.) {
+
+		complex float* mask = md_alloc(N, dims, CFL_SIZE);
+		md_uniform_rand(N, dims, mask);
 
-		x[i] = y[i];
+		long T = md_calc_size(N, dims);
 
-		if (spike >= uniform_rand())
-			x[i] += stdev * gaussian_rand();
+		for (long i = 0; i < T; i++)
+			if (spike < crealf(mask[i]))
+				x[i] = 0.;
 
-		if (rvc)
-			x[i] = crealf(x[i]);
+		md_free(mask);
 	}
 
+	md_zadd(N, dims, x, x, y);
+
+	if (rvc)
+		md_zreal(N, dims, x, x);
+
 	unmap_cfl(N, dims, y);
 	unmap_cfl(N, dims, x);
 	exit(0);
@@ -11,12 +11,14 @@
 #include <complex.h>
 #include <assert.h>
 #include <string.h>
+#include <stdbool.h>
 
 #include "num/multind.h"
 #include "num/flpmath.h"
 #include "num/sf.h"
 
 #include "misc/misc.h"
+#include "misc/debug.h"
 
 #include "grid.h"
 
@@ -137,6 +139,17 @@ static float intlookup(int n, const float table[n + 1], float x)
 
 
 
+static void grid_pos(float pos[3], float os, const long grid_dims[3], const complex float traj[3])
+{
+	for (int j = 0; j < 3; j++) {
+
+		pos[j] = os * (creal(traj[j]));
+		pos[j] += (grid_dims[j] > 1) ? ((float)grid_dims[j] / 2.) : 0.;
+	}
+}
+
+
+
 void gridH(float os, float width, double beta, const complex float* traj, const long ksp_dims[4], complex float* dst, const long grid_dims[4], const complex float* grid)
 {
 	long C = ksp_dims[3];
@@ -157,13 +170,7 @@ void gridH(float os, float width, double beta, const complex float* traj, const
 	for(int i = 0; i < samples; i++) {
 
 		float pos[3];
-		pos[0] = os * (creal(traj[i * 3 + 0]));
-		pos[1] = os * (creal(traj[i * 3 + 1]));
-		pos[2] = os * (creal(traj[i * 3 + 2]));
-
-		pos[0] += (grid_dims[0] > 1) ? ((float)grid_dims[0] / 2.) : 0.;
-		pos[1] += (grid_dims[1] > 1) ? ((float)grid_dims[1] / 2.) : 0.;
-		pos[2] += (grid_dims[2] > 1) ? ((float)grid_dims[2] / 2.) : 0.;
+		grid_pos(pos, os, grid_dims, traj + i * 3);
 
 		complex float val[C];
 		for (int j = 0; j < C; j++)
@@ -199,13 +206,7 @@ void grid(float os, float width, double beta, const complex float* traj, const l
 	for(int i = 0; i < samples; i++) {
 
 		float pos[3];
-		pos[0] = os * (creal(traj[i * 3 + 0]));
-		pos[1] = os * (creal(traj[i * 3 + 1]));
-		pos[2] = os * (creal(traj[i * 3 + 2]));
-
-		pos[0] += (grid_dims[0] > 1) ? ((float) grid_dims[0] / 2.) : 0.;
-		pos[1] += (grid_dims[1] > 1) ? ((float) grid_dims[1] / 2.) : 0.;
-		pos[2] += (grid_dims[2] > 1) ? ((float) grid_dims[2] / 2.) : 0.;
+		grid_pos(pos, os, grid_dims, traj + i * 3);
 
 		complex float val[C];
 		
@@ -285,7 +286,7 @@ void grid2H(float os, float width, double beta, unsigned int D, const long trj_d
 
 
 
-void grid_point(unsigned int ch, const long dims[3], const float pos[3], complex float* dst, const complex float val[ch], float width, int kb_size, const float kb_table[kb_size + 1])
+static inline void grid_point_gen(unsigned int ch, const long dims[3], const float pos[3], complex float* dst, const complex float val[ch], float width, int kb_size, const float kb_table[kb_size + 1], bool atomic)
 {
 	int sti[3];
 	int eni[3];
@@ -322,6 +323,12 @@ void grid_point(unsigned int ch, const long dims[3], const float pos[3], complex
 
 	for (unsigned int c = 0; c < ch; c++) {
 
+		if (!atomic) {
+
+			dst[indu + c * dims[0] * dims[1] * dims[2]] += val[c] * du;
+			continue;
+		}
+
 		// we are allowed to update real and imaginary part independently which works atomically
 		#pragma omp atomic
 		__real(dst[indu + c * dims[0] * dims[1] * dims[2]]) += __real(val[c]) * du;
@@ -331,6 +338,12 @@ void grid_point(unsigned int ch, const long dims[3], const float pos[3], complex
 }
 
 
+void grid_point(unsigned int ch, const long dims[3], const float pos[3], complex float* dst, const complex float val[ch], float width, int kb_size, const float kb_table[kb_size + 1])
+{
+	grid_point_gen(ch, dims, pos, dst, val, width, kb_size, kb_table, true);
+}
+
+
 
 void grid_pointH(unsigned int ch, const long dims[3], const float pos[3], complex float val[ch], const complex float* src, float width, int kb_size, const float kb_table[kb_size + 1])
 {
@@ -367,17 +380,585 @@ void grid_pointH(unsigned int ch, const long dims[3], const float pos[3], comple
 		float du = dv * intlookup(kb_size, kb_table, frac / width);
 		int indu = (indv + u);
 
+	// val is private to the caller, so no atomics are needed here
+	for (unsigned int c = 0; c < ch; c++)
+		val[c] += src[indu + c * dims[0] * dims[1] * dims[2]] * du;
+	}}}
+}
+
+
+
+/*
+ * Precomputed interpolation
+ *
+ * The trajectory does not change between iterations, so the start
+ * indices and the separable 1D kernel weights of each sample are
+ * computed once. Gridding then only gathers/scatters and multiplies.
+ */
+struct grid_interp_s {
+
+	long grid_dims[3];
+
+	long samples;
+	long ntraj;
+
+	int K;		// max. number of taps per dimension
+
+	int* start;	// [ntraj][samples][3]
+	int* len;	// [ntraj][samples][3]
+	float* wgh;	// [ntraj][samples][3][K]
+};
+
+
+static void interp_compute(const struct grid_interp_s* interp, float os, float width, int kb_size, const float kb_table[kb_size + 1], const complex float* traj, int start[], int len[], float wgh[])
+{
+	int K = interp->K;
+
+	for (long i = 0; i < interp->samples; i++) {
+
+		float pos[3];
+		grid_pos(pos, os, interp->grid_dims, traj + i * 3);
+
+		for (int j = 0; j < 3; j++) {
+
+			int st = MAX((int)ceil(pos[j] - width), 0);
+			int en = MIN((int)floor(pos[j] + width), interp->grid_dims[j] - 1);
+
+			start[i * 3 + j] = st;
+			len[i * 3 + j] = MAX(en - st + 1, 0);
+
+			for (int k = 0; k < len[i * 3 + j]; k++) {
+
+				float frac = fabs(((float)(st + k) - pos[j]));
+				wgh[(i * 3 + j) * K + k] = intlookup(kb_size, kb_table, frac / width);
+			}
+		}
+	}
+}
+
+
+struct grid_interp_s* grid2_interp_create(float os, float width, double beta, unsigned int D, const long trj_dims[D], const complex float* traj, const long grid_dims[D], long max_bytes)
+{
+	assert(D >= 4);
+	assert(3 == trj_dims[0]);
+	assert(1 == trj_dims[3]);
+
+	int K = 2 * (int)ceilf(width) + 1;
+	long samples = trj_dims[1] * trj_dims[2];
+	long ntraj = md_calc_size(D - 4, trj_dims + 4);
+	long bytes = ntraj * samples * 3 * (2 * (long)sizeof(int) + K * (long)sizeof(float));
+
+	if (bytes > max_bytes) {
+
+		debug_printf(DP_DEBUG1, "Interpolation weights need %ld MB (limit: %ld MB), computing on the fly.\n", bytes >> 20, max_bytes >> 20);
+		return NULL;
+	}
+
+	debug_printf(DP_DEBUG1, "Precomputing interpolation weights: %ld MB\n", bytes >> 20);
+
+	PTR_ALLOC(struct grid_interp_s, interp);
+
+	for (int j = 0; j < 3; j++)
+		interp->grid_dims[j] = grid_dims[j];
+
+	interp->samples = samples;
+	interp->ntraj = ntraj;
+	interp->K = K;
+
+	interp->start = xmalloc(ntraj * samples * 3 * sizeof(int));
+	interp->len = xmalloc(ntraj * samples * 3 * sizeof(int));
+	interp->wgh = xmalloc(ntraj * samples * 3 * K * sizeof(float));
+
+#ifndef	KB128
+	// precompute kaiser bessel table
+	int kb_size = 500;
+	float kb_table[kb_size + 1];
+	kb_precompute(beta, kb_size, kb_table);
+#else
+	assert(KB_BETA == beta);
+	int kb_size = 128;
+	const float* kb_table = kb_table128;
+#endif
+
+	#pragma omp parallel for
+	for (long t = 0; t < ntraj; t++)
+		interp_compute(interp, os, width, kb_size, kb_table, traj + t * 3 * samples,
+			interp->start + t * samples * 3, interp->len + t * samples * 3,
+			interp->wgh + t * samples * 3 * K);
+
+	return interp;
+}
+
+
+void grid_interp_free(struct grid_interp_s* interp)
+{
+	free(interp->start);
+	free(interp->len);
+	free(interp->wgh);
+	free(interp);
+}
+
+
+static inline void grid_point_interp(unsigned int ch, const long dims[3], const int sti[3], const int len[3], int K, const float wgh[3][K], complex float* dst, const complex float val[ch], bool atomic)
+{
+	for (int w = 0; w < len[2]; w++) {
+
+		float dw = 1. * wgh[2][w];
+		int indw = (sti[2] + w) * dims[1];
+
+	for (int v = 0; v < len[1]; v++) {
+
+		float dv = dw * wgh[1][v];
+		int indv = (indw + sti[1] + v) * dims[0];
+
+	for (int u = 0; u < len[0]; u++) {
+
+		float du = dv * wgh[0][u];
+		int indu = (indv + sti[0] + u);
+
 	for (unsigned int c = 0; c < ch; c++) {
 
-		// we are allowed to update real and imaginary part independently which works atomically
+		if (!atomic) {
+
+			dst[indu + c * dims[0] * dims[1] * dims[2]] += val[c] * du;
+			continue;
+		}
+
 		#pragma omp atomic
-		__real(val[c]) += __real(src[indu + c * dims[0] * dims[1] * dims[2]]) * du;
+		__real(dst[indu + c * dims[0] * dims[1] * dims[2]]) += __real(val[c]) * du;
 		#pragma omp atomic
-		__imag(val[c]) += __imag(src[indu + c * dims[0] * dims[1] * dims[2]]) * du;
+		__imag(dst[indu + c * dims[0] * dims[1] * dims[2]]) += __imag(val[c]) * du;
 	}}}}
 }
 
 
+static inline void grid_pointH_interp(unsigned int ch, const long dims[3], const int sti[3], const int len[3], int K, const float wgh[3][K], complex float val[ch], const complex float* src)
+{
+	for (unsigned int i = 0; i < ch; i++)
+		val[i] = 0.;
+
+	for (int w = 0; w < len[2]; w++) {
+
+		float dw = 1. * wgh[2][w];
+		int indw = (sti[2] + w) * dims[1];
+
+	for (int v = 0; v < len[1]; v++) {
+
+		float dv = dw * wgh[1][v];
+		int indv = (indw + sti[1] + v) * dims[0];
+
+	for (int u = 0; u < len[0]; u++) {
+
+		float du = dv * wgh[0][u];
+		int indu = (indv + sti[0] + u);
+
+	for (unsigned int c = 0; c < ch; c++)
+		val[c] += src[indu + c * dims[0] * dims[1] * dims[2]] * du;
+	}}}
+}
+
+
+static void grid_interp(const struct grid_interp_s* interp, long trj_ind, const long grid_dims[4], complex float* grid, const long ksp_dims[4], const complex float* src)
+{
+	long C = ksp_dims[3];
+	long samples = ksp_dims[1] * ksp_dims[2];
+	int K = interp->K;
+
+	assert(samples == interp->samples);
+	assert(trj_ind < interp->ntraj);
+
+	const int* start = interp->start + trj_ind * samples * 3;
+	const int* len = interp->len + trj_ind * samples * 3;
+	const float* wgh = interp->wgh + trj_ind * samples * 3 * K;
+
+#pragma omp parallel for
+	for (long i = 0; i < samples; i++) {
+
+		complex float val[C];
+
+		for (int j = 0; j < C; j++)
+			val[j] = src[j * samples + i];
+
+		grid_point_interp(C, grid_dims, start + i * 3, len + i * 3, K, (const float (*)[K])(wgh + i * 3 * K), grid, val, true);
+	}
+}
+
+
+static void gridH_interp(const struct grid_interp_s* interp, long trj_ind, const long ksp_dims[4], complex float* dst, const long grid_dims[4], const complex float* grid)
+{
+	long C = ksp_dims[3];
+	long samples = ksp_dims[1] * ksp_dims[2];
+	int K = interp->K;
+
+	assert(samples == interp->samples);
+	assert(trj_ind < interp->ntraj);
+
+	const int* start = interp->start + trj_ind * samples * 3;
+	const int* len = interp->len + trj_ind * samples * 3;
+	const float* wgh = interp->wgh + trj_ind * samples * 3 * K;
+
+#pragma omp parallel for
+	for (long i = 0; i < samples; i++) {
+
+		complex float val[C];
+
+		grid_pointH_interp(C, grid_dims, start + i * 3, len + i * 3, K, (const float (*)[K])(wgh + i * 3 * K), val, grid);
+
+		for (int j = 0; j < C; j++)
+			dst[j * samples + i] += val[j];
+	}
+}
+
+
+void grid2_interp(const struct grid_interp_s* interp, unsigned int D, const long trj_dims[D], const long grid_dims[D], complex float* dst, const long ksp_dims[D], const complex float* src)
+{
+	grid2_dims(D, trj_dims, ksp_dims, grid_dims);
+
+	for (int j = 0; j < 3; j++)
+		assert(grid_dims[j] == interp->grid_dims[j]);
+
+	long ksp_strs[D];
+	md_calc_strides(D, ksp_strs, ksp_dims, CFL_SIZE);
+
+	long grid_strs[D];
+	md_calc_strides(D, grid_strs, grid_dims, CFL_SIZE);
+
+	long ind_strs[D];
+	md_calc_strides(D - 4, ind_strs, trj_dims + 4, 1);
+
+	long pos[D];
+	for (unsigned int i = 0; i < D; i++)
+		pos[i] = 0;
+
+	do {
+		grid_interp(interp, md_calc_offset(D - 4, ind_strs, pos + 4),
+			grid_dims, &MD_ACCESS(D, grid_strs, pos, dst),
+			ksp_dims, &MD_ACCESS(D, ksp_strs, pos, src));
+
+	} while(md_next(D, ksp_dims, (~0 ^ 15), pos));
+}
+
+
+void grid2H_interp(const struct grid_interp_s* interp, unsigned int D, const long trj_dims[D], const long ksp_dims[D], complex float* dst, const long grid_dims[D], const complex float* src)
+{
+	grid2_dims(D, trj_dims, ksp_dims, grid_dims);
+
+	for (int j = 0; j < 3; j++)
+		assert(grid_dims[j] == interp->grid_dims[j]);
+
+	long ksp_strs[D];
+	md_calc_strides(D, ksp_strs, ksp_dims, CFL_SIZE);
+
+	long grid_strs[D];
+	md_calc_strides(D, grid_strs, grid_dims, CFL_SIZE);
+
+	long ind_strs[D];
+	md_calc_strides(D - 4, ind_strs, trj_dims + 4, 1);
+
+	long pos[D];
+	for (unsigned int i = 0; i < D; i++)
+		pos[i] = 0;
+
+	do {
+		gridH_interp(interp, md_calc_offset(D - 4, ind_strs, pos + 4),
+			ksp_dims, &MD_ACCESS(D, ksp_strs, pos, dst),
+			grid_dims, &MD_ACCESS(D, grid_strs, pos, src));
+
+	} while(md_next(D, ksp_dims, (~0 ^ 15), pos));
+}
+
+
+
+/*
+ * Tiled gridding
+ *
+ * Samples are binned once into spatial tiles. Each tile is gridded
+ * into a thread-private buffer which includes a halo of the kernel
+ * width and then added to the grid. Tiles are processed in 2^3
+ * colors, such that tiles of the same color never share a grid
+ * point. This avoids atomics and, because the order of summation
+ * does not depend on the scheduling, the result is identical for
+ * any number of threads.
+ */
+struct grid_tiles_s {
+
+	long grid_dims[3];
+	long tile[3];
+	long halo[3];
+	long ntiles[3];
+
+	long samples;
+	long ntraj;
+
+	long* offsets;	// [ntraj][ntot + 1]
+	long* index;	// [ntraj][samples]
+};
+
+
+static long tiles_total(const struct grid_tiles_s* tiles)
+{
+	return tiles->ntiles[0] * tiles->ntiles[1] * tiles->ntiles[2];
+}
+
+
+static long tile_of_pos(const struct grid_tiles_s* tiles, const float pos[3])
+{
+	long ind = 0;
+
+	for (int j = 2; j >= 0; j--) {
+
+		long p = MIN(MAX((long)floorf(pos[j]), 0L), tiles->grid_dims[j] - 1);
+
+		ind = ind * tiles->ntiles[j] + p / tiles->tile[j];
+	}
+
+	return ind;
+}
+
+
+static void tiles_bin(const struct grid_tiles_s* tiles, float os, const complex float* traj, long offsets[], long index[])
+{
+	long ntot = tiles_total(tiles);
+	long samples = tiles->samples;
+	long* tind = xmalloc(samples * sizeof(long));
+
+	for (long t = 0; t < ntot + 1; t++)
+		offsets[t] = 0;
+
+	for (long i = 0; i < samples; i++) {
+
+		float pos[3];
+		grid_pos(pos, os, tiles->grid_dims, traj + i * 3);
+
+		tind[i] = tile_of_pos(tiles, pos);
+		offsets[tind[i] + 1]++;
+	}
+
+	for (long t = 0; t < ntot; t++)
+		offsets[t + 1] += offsets[t];
+
+	// stable counting sort, keeps samples in acquisition order within a tile
+
+	long* fill = xmalloc(ntot * sizeof(long));
+
+	for (long t = 0; t < ntot; t++)
+		fill[t] = offsets[t];
+
+	for (long i = 0; i < samples; i++)
+		index[fill[tind[i]]++] = i;
+
+	free(fill);
+	free(tind);
+}
+
+
+struct grid_tiles_s* grid2_tiles_create(float os, float width, unsigned int D, const long trj_dims[D], const complex float* traj, const long grid_dims[D], long tile_size)
+{
+	assert(D >= 4);
+	assert(3 == trj_dims[0]);
+	assert(1 == trj_dims[3]);
+
+	PTR_ALLOC(struct grid_tiles_s, tiles);
+
+	long halo = (long)ceilf(width);
+
+	if (0 == tile_size)
+		tile_size = 16;
+
+	// tiles of the same color must be separated by more than the halo
+	tile_size = MAX(tile_size, 2 * halo);
+
+	for (int j = 0; j < 3; j++) {
+
+		tiles->grid_dims[j] = grid_dims[j];
+		tiles->halo[j] = (1 == grid_dims[j]) ? 0 : halo;
+		tiles->tile[j] = MIN(tile_size, grid_dims[j]);
+		tiles->ntiles[j] = (grid_dims[j] + tiles->tile[j] - 1) / tiles->tile[j];
+	}
+
+	tiles->samples = trj_dims[1] * trj_dims[2];
+	tiles->ntraj = md_calc_size(D - 4, trj_dims + 4);
+
+	long ntot = tiles_total(tiles);
+
+	tiles->offsets = xmalloc(tiles->ntraj * (ntot + 1) * sizeof(long));
+	tiles->index = xmalloc(tiles->ntraj * tiles->samples * sizeof(long));
+
+	#pragma omp parallel for
+	for (long t = 0; t < tiles->ntraj; t++)
+		tiles_bin(tiles, os, traj + t * 3 * tiles->samples,
+			tiles->offsets + t * (ntot + 1), tiles->index + t * tiles->samples);
+
+	return tiles;
+}
+
+
+void grid_tiles_free(struct grid_tiles_s* tiles)
+{
+	free(tiles->offsets);
+	free(tiles->index);
+	free(tiles);
+}
+
+
+static void grid_tiled(const struct grid_tiles_s* tiles, const struct grid_interp_s* interp, long trj_ind, float os, float width, double beta, const complex float* traj, const long grid_dims[4], complex float* grid, const long ksp_dims[4], const complex float* src)
+{
+	long C = ksp_dims[3];
+
+#ifndef	KB128
+	// precompute kaiser bessel table
+	int kb_size = 500;
+	float kb_table[kb_size + 1];
+
+	if (NULL == interp)
+		kb_precompute(beta, kb_size, kb_table);
+#else
+	assert(KB_BETA == beta);
+	int kb_size = 128;
+	const float* kb_table = kb_table128;
+#endif
+	assert(1 == ksp_dims[0]);
+	long samples = ksp_dims[1] * ksp_dims[2];
+
+	assert(samples == tiles->samples);
+	assert(trj_ind < tiles->ntraj);
+
+	for (int j = 0; j < 3; j++)
+		assert(grid_dims[j] == tiles->grid_dims[j]);
+
+	long ntot = tiles_total(tiles);
+	const long* offsets = tiles->offsets + trj_ind * (ntot + 1);
+	const long* index = tiles->index + trj_ind * samples;
+
+	long bsize = C;
+
+	for (int j = 0; j < 3; j++)
+		bsize *= MIN(tiles->tile[j] + 2 * tiles->halo[j], grid_dims[j]);
+
+	long gsize = grid_dims[0] * grid_dims[1] * grid_dims[2];
+
+#pragma omp parallel
+	{
+		complex float* buf = xmalloc(bsize * sizeof(complex float));
+
+		for (int color = 0; color < 8; color++) {
+
+		#pragma omp for schedule(dynamic)
+			for (long t = 0; t < ntot; t++) {
+
+				if (offsets[t] == offsets[t + 1])
+					continue;
+
+				long tpos[3] = {
+					t % tiles->ntiles[0],
+					(t / tiles->ntiles[0]) % tiles->ntiles[1],
+					t / (tiles->ntiles[0] * tiles->ntiles[1]),
+				};
+
+				if (color != ((tpos[0] % 2) | ((tpos[1] % 2) << 1) | ((tpos[2] % 2) << 2)))
+					continue;
+
+				// tile plus halo, clipped to the grid
+
+				long lo[3];
+				long bdims[3];
+
+				for (int j = 0; j < 3; j++) {
+
+					lo[j] = MAX(tpos[j] * tiles->tile[j] - tiles->halo[j], 0L);
+					long hi = MIN((tpos[j] + 1) * tiles->tile[j] + tiles->halo[j], grid_dims[j]);
+					bdims[j] = hi - lo[j];
+				}
+
+				long tsize = bdims[0] * bdims[1] * bdims[2];
+
+				for (long i = 0; i < C * tsize; i++)
+					buf[i] = 0.;
+
+				for (long k = offsets[t]; k < offsets[t + 1]; k++) {
+
+					long i = index[k];
+
+					complex float val[C];
+
+					for (int j = 0; j < C; j++)
+						val[j] = src[j * samples + i];
+
+					if (NULL != interp) {
+
+						int K = interp->K;
+						long ii = trj_ind * samples + i;
+
+						int sti[3];
+
+						for (int j = 0; j < 3; j++)
+							sti[j] = interp->start[ii * 3 + j] - lo[j];
+
+						grid_point_interp(C, bdims, sti, interp->len + ii * 3, K, (const float (*)[K])(interp->wgh + ii * 3 * K), buf, val, false);
+						continue;
+					}
+
+					float pos[3];
+					grid_pos(pos, os, grid_dims, traj + i * 3);
+
+					for (int j = 0; j < 3; j++)
+						pos[j] -= lo[j];
+
+					grid_point_gen(C, bdims, pos, buf, val, width, kb_size, kb_table, false);
+				}
+
+				// merge, no other tile of this color touches this region
+
+				for (long c = 0; c < C; c++)
+					for (long z = 0; z < bdims[2]; z++)
+						for (long y = 0; y < bdims[1]; y++) {
+
+							complex float* dst = grid + c * gsize + ((lo[2] + z) * grid_dims[1] + lo[1] + y) * grid_dims[0] + lo[0];
+							const complex float* bsrc = buf + c * tsize + (z * bdims[1] + y) * bdims[0];
+
+							for (long x = 0; x < bdims[0]; x++)
+								dst[x] += bsrc[x];
+						}
+			}
+		}
+
+		free(buf);
+	}
+}
+
+
+void grid2_tiled(const struct grid_tiles_s* tiles, const struct grid_interp_s* interp, float os, float width, double beta, unsigned int D, const long trj_dims[D], const complex float* traj, const long grid_dims[D], complex float* dst, const long ksp_dims[D], const complex float* src)
+{
+	grid2_dims(D, trj_dims, ksp_dims, grid_dims);
+
+	long ksp_strs[D];
+	md_calc_strides(D, ksp_strs, ksp_dims, CFL_SIZE);
+
+	long trj_strs[D];
+	md_calc_strides(D, trj_strs, trj_dims, CFL_SIZE);
+
+	long grid_strs[D];
+	md_calc_strides(D, grid_strs, grid_dims, CFL_SIZE);
+
+	// index of the trajectory used for the current position
+
+	long ind_strs[D];
+	md_calc_strides(D - 4, ind_strs, trj_dims + 4, 1);
+
+	long pos[D];
+	for (unsigned int i = 0; i < D; i++)
+		pos[i] = 0;
+
+	do {
+		grid_tiled(tiles, interp, md_calc_offset(D - 4, ind_strs, pos + 4),
+			os, width, beta, &MD_ACCESS(D, trj_strs, pos, traj),
+			grid_dims, &MD_ACCESS(D, grid_strs, pos, dst),
+			ksp_dims, &MD_ACCESS(D, ksp_strs, pos, src));
+
+	} while(md_next(D, ksp_dims, (~0 ^ 15), pos));
+}
+
+
 
 double calc_beta(float os, float width)
 {
@@ -385,6 +966,13 @@ double calc_beta(float os, float width)
 }
 
 
+// DC gain of the kernel (per dimension, in grid units, up to a constant)
+double kb_gain(float width, double beta)
+{
+	return width * ftkb(beta, 0.);
+}
+
+
 static float pos(int d, int i)
 {
 	return (1 == d) ? 0. : (((float)i - (float)d / 2.) / (float)d);
@@ -392,16 +980,17 @@ static float pos(int d, int i)
 
 void rolloff_correction(float os, float width, float beta, const long dimensions[3], complex float* dst)
 {
-	UNUSED(os);
+	// image positions in cycles per oversampled grid point (times 2)
+	float sc = 2. / os;
 
 #pragma omp parallel for collapse(3)
 	for (int z = 0; z < dimensions[2]; z++) 
 		for (int y = 0; y < dimensions[1]; y++) 
 			for (int x = 0; x < dimensions[0]; x++)
 				dst[x + dimensions[0] * (y + z * dimensions[1])] 
-					= 1. / (  rolloff(pos(dimensions[0], x), beta, width)
-						* rolloff(pos(dimensions[1], y), beta, width) 
-						* rolloff(pos(dimensions[2], z), beta, width) );
+					= 1. / (  rolloff(sc * pos(dimensions[0], x), beta, width)
+						* rolloff(sc * pos(dimensions[1], y), beta, width) 
+						* rolloff(sc * pos(dimensions[2], z), beta, width) );
 }
 
 
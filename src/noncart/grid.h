@@ -19,10 +19,25 @@ extern void grid2(float os, float width, double beta, unsigned int D, const long
 extern void grid2H(float os, float width, double beta, unsigned int D, const long trj_dims[__VLA(D)], const complex float* traj, const long ksp_dims[__VLA(D)], complex float* dst, const long grid_dims[__VLA(D)], const complex float* grid);
 
 
+struct grid_interp_s;
+extern struct grid_interp_s* grid2_interp_create(float os, float width, double beta, unsigned int D, const long trj_dims[__VLA(D)], const complex float* traj, const long grid_dims[__VLA(D)], long max_bytes);
+extern void grid_interp_free(struct grid_interp_s* interp);
+
+extern void grid2_interp(const struct grid_interp_s* interp, unsigned int D, const long trj_dims[__VLA(D)], const long grid_dims[__VLA(D)], complex float* grid, const long ksp_dims[__VLA(D)], const complex float* src);
+extern void grid2H_interp(const struct grid_interp_s* interp, unsigned int D, const long trj_dims[__VLA(D)], const long ksp_dims[__VLA(D)], complex float* dst, const long grid_dims[__VLA(D)], const complex float* grid);
+
+struct grid_tiles_s;
+extern struct grid_tiles_s* grid2_tiles_create(float os, float width, unsigned int D, const long trj_dims[__VLA(D)], const complex float* traj, const long grid_dims[__VLA(D)], long tile_size);
+extern void grid_tiles_free(struct grid_tiles_s* tiles);
+
+extern void grid2_tiled(const struct grid_tiles_s* tiles, const struct grid_interp_s* interp, float os, float width, double beta, unsigned int D, const long trj_dims[__VLA(D)], const complex float* traj, const long grid_dims[__VLA(D)], complex float* grid, const long ksp_dims[__VLA(D)], const complex float* src);
+
+
 extern void grid_pointH(unsigned int ch, const long dims[3], const float pos[3], complex float val[__VLA(ch)], const complex float* src, float width, int kb_size, const float kb_table[__VLA(kb_size + 1)]);
 extern void grid_point(unsigned int ch, const long dims[3], const float pos[3], complex float* dst, const complex float val[__VLA(ch)], float width, int kb_size, const float kb_table[__VLA(kb_size + 1)]);
 
 extern double calc_beta(float os, float width);
+extern double kb_gain(float width, double beta);
 
 extern void rolloff_correction(float os, float width, float beta, const long dim[3], complex float* dst);
 
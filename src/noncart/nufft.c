@@ -24,6 +24,8 @@
 #include "num/fft.h"
 #include "num/shuffle.h"
 #include "num/ops.h"
+#include "num/workspace.h"
+#include "num/expr.h"
 
 #include "linops/linop.h"
 #include "linops/someops.h"
@@ -37,6 +39,12 @@
 struct nufft_conf_s nufft_conf_defaults = {
 
 	.toeplitz = false,
+	.tiled = true,
+	.tile_size = 0,
+	.max_interp_mem = 1L << 30,
+	.workspace = NULL,
+	.os = 2.,
+	.width = 0.,
 };
 
 
@@ -62,11 +70,25 @@ struct nufft_data {
 
 	complex float* grid;		///< Oversampling grid
 
+	float os;			///< Oversampling factor
 	float width;			///< Interpolation kernel width
 	double beta;			///< Kaiser-Bessel beta parameter
 
+	bool pad;			///< Zero-padded FFT instead of shifted FFTs (os != 2)
+	float grid_os;			///< Scaling of grid_traj to grid units
+	const complex float* grid_traj;	///< Trajectory used for gridding
+	const complex float* pad_pre;	///< Roll-off, modulation and scaling before padding
+	const complex float* pad_post;	///< Modulation on the oversampled grid
+	long pad_offset;		///< Offset of the image in the oversampled grid
+	const struct linop_s* pad_fft_op;	///< FFT operator on the oversampled grid
+
 	const struct linop_s* fft_op;	///< FFT operator
 
+	struct grid_tiles_s* tiles;	///< Binned trajectory for tiled gridding
+	struct grid_interp_s* interp;	///< Precomputed interpolation weights
+
+	struct workspace_s* workspace;	///< Scratch memory for oversampled grid and k-space
+
 	long* ksp_dims;			///< Kspace dimension
 	long* cim_dims;			///< Coil image dimension
 	long* cml_dims;			///< TODO
@@ -77,7 +99,10 @@ struct nufft_data {
 	long* wgh_dims;			///< Weights dimension
 
 	//!
-	long* cm2_dims;			///< 2x oversampled coil image dimension
+	long* cm2_dims;			///< Oversampled coil image dimension
+	long* cm2_strs;
+	long* gim_dims;			///< Oversampled image dimension
+	long* gim_strs;
 
 	long* ksp_strs;
 	long* cim_strs;
@@ -121,10 +146,34 @@ static complex float* compute_precond(unsigned int N, const long* pre_dims, cons
 
 
 static void toeplitz_mult(const struct nufft_data* data, complex float* dst, const complex float* src);
+static void fftmod_recompose(const struct nufft_data* data, complex float* gridX, bool adjoint);
+static void linphase_sum(const struct nufft_data* data, complex float* dst, bool roll);
 static complex float* compute_linphases(unsigned int N, long lph_dims[N + 3], const long img_dims[N]);
 static complex float* compute_psf2(unsigned int N, const long psf_dims[N + 3], const long trj_dims[N], const complex float* traj, const complex float* weights);
 
 
+/**
+ * Kaiser-Bessel kernel width for a given oversampling factor
+ *
+ * The half-width is increased for small oversampling to keep the
+ * aliasing error roughly at the level of the 2x grid (see bench).
+ *
+ * Beatty PJ, Nishimura DG, Pauly JM. Rapid gridding reconstruction
+ * with a minimal oversampling ratio. IEEE TMI 2005; 24:799-808.
+ */
+static float nufft_kernel_width(float os)
+{
+	if (os >= 1.9)
+		return 3.;
+
+	if (os >= 1.4)
+		return 3.5;
+
+	return 4.;
+}
+
+
+
 /**
  * NUFFT operator initialization
  */
@@ -145,8 +194,12 @@ struct linop_s* nufft_create(unsigned int N,			///< Number of dimension
 	data->traj = traj;
 	data->conf = conf;
 
-	data->width = 3.;
-	data->beta = calc_beta(2., data->width);
+	assert(conf.os > 1.);
+
+	data->os = conf.os;
+	data->pad = (2. != conf.os);
+	data->width = (0. != conf.width) ? conf.width : nufft_kernel_width(data->os);
+	data->beta = calc_beta(data->os, data->width);
 
 	// get dims
 
@@ -214,10 +267,14 @@ struct linop_s* nufft_create(unsigned int N,			///< Number of dimension
 
 
 	complex float* roll = md_alloc(ND, data->img_dims, CFL_SIZE);
-	rolloff_correction(2., data->width, data->beta, data->img_dims, roll);
+	rolloff_correction(data->os, data->width, data->beta, data->img_dims, roll);
 	data->roll = roll;
 
 
+	// shifted FFTs: needed for the 2x grid and for Toeplitz embedding
+
+	bool shifted = !data->pad || conf.toeplitz;
+
 	complex float* linphase = compute_linphases(N, data->lph_dims, data->img_dims);
 
 	md_calc_strides(ND, data->lph_strs, data->lph_dims, CFL_SIZE);
@@ -228,6 +285,12 @@ struct linop_s* nufft_create(unsigned int N,			///< Number of dimension
 
 	fftmod(ND, data->lph_dims, FFT_FLAGS, linphase, linphase);
 	fftscale(ND, data->lph_dims, FFT_FLAGS, linphase, linphase);
+
+	if (!shifted) {
+
+		md_free(linphase);
+		linphase = NULL;
+	}
 //	md_zsmul(ND, data->lph_dims, linphase, linphase, 1. / (float)(data->trj_dims[1] * data->trj_dims[2]));
 
 	complex float* fftm = md_alloc(ND, data->img_dims, CFL_SIZE);
@@ -261,17 +324,116 @@ struct linop_s* nufft_create(unsigned int N,			///< Number of dimension
 
 
 	data->cm2_dims = *TYPE_ALLOC(long[ND]);
-	// !
+	data->cm2_strs = *TYPE_ALLOC(long[ND]);
+	data->gim_dims = *TYPE_ALLOC(long[ND]);
+	data->gim_strs = *TYPE_ALLOC(long[ND]);
+
 	md_copy_dims(ND, data->cm2_dims, data->cim_dims);
-	for (int i = 0; i < 3; i++)
-		data->cm2_dims[i] = (1 == cim_dims[i]) ? 1 : (2 * cim_dims[i]);
 
+	for (int i = 0; i < 3; i++) {
+
+		// even size for the padded grid
+		long os_dim = data->pad ? (2 * (long)ceilf(data->os * cim_dims[i] / 2.)) : (2 * cim_dims[i]);
+		data->cm2_dims[i] = (1 == cim_dims[i]) ? 1 : os_dim;
+	}
+
+	md_calc_strides(ND, data->cm2_strs, data->cm2_dims, CFL_SIZE);
+	md_select_dims(ND, FFT_FLAGS, data->gim_dims, data->cm2_dims);
+	md_calc_strides(ND, data->gim_strs, data->gim_dims, CFL_SIZE);
+
+
+	data->grid = NULL;
+	data->fft_op = NULL;
+
+	if (shifted) {
 
+		data->grid = md_alloc(ND, data->cml_dims, CFL_SIZE);
+		data->fft_op = linop_fft_create(ND, data->cml_dims, FFT_FLAGS, use_gpu);
+	}
+
+	data->grid_traj = data->traj;
+	data->pad_pre = NULL;
+	data->pad_post = NULL;
+	data->pad_fft_op = NULL;
+	data->pad_offset = 0;
+
+	data->grid_os = 2.;
+
+	if (data->pad) {
+
+		// trajectory in units of the padded grid, whose size is
+		// rounded and can differ slightly from os * N
+
+		long scl_dims[ND];
+		long scl_strs[ND];
+		md_select_dims(ND, MD_BIT(0), scl_dims, data->trj_dims);
+		md_calc_strides(ND, scl_strs, scl_dims, CFL_SIZE);
+
+		complex float scale[3];
+
+		for (int i = 0; i < 3; i++)
+			scale[i] = (float)data->cm2_dims[i] / (float)data->cim_dims[i];
+
+		complex float* gtraj = md_alloc(ND, data->trj_dims, CFL_SIZE);
+		md_zmul2(ND, data->trj_dims, data->trj_strs, gtraj, data->trj_strs, traj, scl_strs, scale);
+		data->grid_traj = gtraj;
+
+		data->grid_os = 1.;
+
+		// centered FFT on the padded grid: fftmod before and after
+
+		complex float* post = md_alloc(ND, data->gim_dims, CFL_SIZE);
+		md_zfill(ND, data->gim_dims, post, 1.);
+		fftmod(ND, data->gim_dims, FFT_FLAGS, post, post);
+
+		for (int i = 0; i < 3; i++)
+			data->pad_offset += (data->cm2_dims[i] / 2 - data->cim_dims[i] / 2) * data->cm2_strs[i];
+
+		complex float* pre = md_alloc(ND, data->img_dims, CFL_SIZE);
+		md_copy2(ND, data->img_dims, data->img_strs, pre, data->gim_strs, (void*)post + data->pad_offset, CFL_SIZE);
+		md_zmul(ND, data->img_dims, pre, pre, data->roll);
+		fftscale(ND, data->img_dims, FFT_FLAGS, pre, pre);
 
-	data->grid = md_alloc(ND, data->cml_dims, CFL_SIZE);
+		// keep the overall scaling identical to the 2x grid
 
-	data->fft_op = linop_fft_create(ND, data->cml_dims, FFT_FLAGS, use_gpu);
+		double gain = kb_gain(3., calc_beta(2., 3.)) / kb_gain(data->width, data->beta);
+		int nd = 0;
 
+		for (int i = 0; i < 3; i++)
+			if (1 < cim_dims[i])
+				nd++;
+
+		md_zsmul(ND, data->img_dims, pre, pre, pow(gain, nd));
+
+		data->pad_pre = pre;
+		data->pad_post = post;
+		data->pad_fft_op = linop_fft_create(ND, data->cm2_dims, FFT_FLAGS, use_gpu);
+
+		debug_printf(DP_DEBUG1, "NUFFT: %.2fx oversampling, kernel width %.1f, grid: %ldx%ldx%ld\n",
+				data->os, data->width, data->cm2_dims[0], data->cm2_dims[1], data->cm2_dims[2]);
+	}
+
+	data->interp = grid2_interp_create(data->grid_os, data->width, data->beta, ND, data->trj_dims, data->grid_traj, data->cm2_dims, conf.max_interp_mem);
+
+	// scratch memory: oversampled grid, plus weighted k-space in the
+	// adjoint, plus k-space in the normal operator
+
+	long ksp_size = md_calc_size(ND, data->ksp_dims) * CFL_SIZE;
+	long ws_size = md_calc_size(ND, data->cm2_dims) * CFL_SIZE;
+
+	if (NULL != weights)
+		ws_size += ksp_size;
+
+	if (!conf.toeplitz)
+		ws_size += ksp_size;
+
+	data->workspace = (NULL != conf.workspace) ? workspace_ref(conf.workspace) : workspace_create(0);
+	workspace_reserve(data->workspace, ws_size + 3 * 64);
+
+	data->tiles = NULL;
+
+	if (conf.tiled)
+		data->tiles = grid2_tiles_create(data->grid_os, data->width, ND, data->trj_dims, data->grid_traj, data->cm2_dims, conf.tile_size);
 
 
 	return linop_create(N, ksp_dims, N, cim_dims,
@@ -526,13 +688,35 @@ static void nufft_free_data(const void* _data)
 	free(data->psf_strs);
 	free(data->wgh_strs);
 
+	free(data->cm2_dims);
+	free(data->cm2_strs);
+	free(data->gim_dims);
+	free(data->gim_strs);
+
 	md_free(data->grid);
 	md_free((void*)data->linphase);
 	md_free((void*)data->psf);
 	md_free((void*)data->fftmod);
 	md_free((void*)data->weights);
 
-	linop_free(data->fft_op);
+	if (NULL != data->fft_op)
+		linop_free(data->fft_op);
+
+	if (data->pad) {
+
+		md_free((void*)data->grid_traj);
+		md_free((void*)data->pad_pre);
+		md_free((void*)data->pad_post);
+		linop_free(data->pad_fft_op);
+	}
+
+	if (NULL != data->tiles)
+		grid_tiles_free(data->tiles);
+
+	if (NULL != data->interp)
+		grid_interp_free(data->interp);
+
+	workspace_free(data->workspace);
 
 	free(data);
 }
@@ -549,24 +733,30 @@ static void nufft_apply(const void* _data, complex float* dst, const complex flo
 
 	unsigned int ND = data->N + 3;
 
-	md_zmul2(ND, data->cml_dims, data->cml_strs, data->grid, data->cim_strs, src, data->lph_strs, data->linphase);
-	linop_forward(data->fft_op, ND, data->cml_dims, data->grid, ND, data->cml_dims, data->grid);
-	md_zmul2(ND, data->cml_dims, data->cml_strs, data->grid, data->cml_strs, data->grid, data->img_strs, data->fftmod);
+	complex float* gridX = md_workspace_alloc(data->workspace, data->N, data->cm2_dims, CFL_SIZE);
 
-	md_clear(ND, data->ksp_dims, dst, CFL_SIZE);
+	if (data->pad) {
 
-	complex float* gridX = md_alloc(data->N, data->cm2_dims, CFL_SIZE);
+		md_clear(ND, data->cm2_dims, gridX, CFL_SIZE);
+		md_zmul2(ND, data->cim_dims, data->cm2_strs, (void*)gridX + data->pad_offset, data->cim_strs, src, data->img_strs, data->pad_pre);
+		linop_forward(data->pad_fft_op, ND, data->cm2_dims, gridX, ND, data->cm2_dims, gridX);
+		md_zmul2(ND, data->cm2_dims, data->cm2_strs, gridX, data->cm2_strs, gridX, data->gim_strs, data->pad_post);
 
-	long factors[data->N];
+	} else {
 
-	for (unsigned int i = 0; i < data->N; i++)
-		factors[i] = ((data->img_dims[i] > 1) && (i < 3)) ? 2 : 1;
+		md_zmul2(ND, data->cml_dims, data->cml_strs, data->grid, data->cim_strs, src, data->lph_strs, data->linphase);
+		linop_forward(data->fft_op, ND, data->cml_dims, data->grid, ND, data->cml_dims, data->grid);
+		fftmod_recompose(data, gridX, false);
+	}
 
-	md_recompose(data->N, factors, data->cm2_dims, gridX, data->cml_dims, data->grid, CFL_SIZE);
+	md_clear(ND, data->ksp_dims, dst, CFL_SIZE);
 
-	grid2H(2., data->width, data->beta, ND, data->trj_dims, data->traj, data->ksp_dims, dst, data->cm2_dims, gridX);
+	if (NULL != data->interp)
+		grid2H_interp(data->interp, ND, data->trj_dims, data->ksp_dims, dst, data->cm2_dims, gridX);
+	else
+		grid2H(data->grid_os, data->width, data->beta, ND, data->trj_dims, data->grid_traj, data->ksp_dims, dst, data->cm2_dims, gridX);
 
-	md_free(gridX);
+	workspace_release(data->workspace, gridX);
 
 	if (NULL != data->weights)
 		md_zmul2(data->N, data->ksp_dims, data->ksp_strs, dst, data->ksp_strs, dst, data->wgh_strs, data->weights);
@@ -580,37 +770,43 @@ static void nufft_apply_adjoint(const void* _data, complex float* dst, const com
 
 	unsigned int ND = data->N + 3;
 
-	complex float* gridX = md_alloc(data->N, data->cm2_dims, CFL_SIZE);
+	complex float* gridX = md_workspace_alloc(data->workspace, data->N, data->cm2_dims, CFL_SIZE);
 	md_clear(data->N, data->cm2_dims, gridX, CFL_SIZE);
 
 	complex float* wdat = NULL;
 
 	if (NULL != data->weights) {
 
-		wdat = md_alloc(data->N, data->ksp_dims, CFL_SIZE);
+		wdat = md_workspace_alloc(data->workspace, data->N, data->ksp_dims, CFL_SIZE);
 		md_zmulc2(data->N, data->ksp_dims, data->ksp_strs, wdat, data->ksp_strs, src, data->wgh_strs, data->weights);
 		src = wdat;
 	}
 
-	grid2(2., data->width, data->beta, ND, data->trj_dims, data->traj, data->cm2_dims, gridX, data->ksp_dims, src);
+	if (NULL != data->tiles)
+		grid2_tiled(data->tiles, data->interp, data->grid_os, data->width, data->beta, ND, data->trj_dims, data->grid_traj, data->cm2_dims, gridX, data->ksp_dims, src);
+	else if (NULL != data->interp)
+		grid2_interp(data->interp, ND, data->trj_dims, data->cm2_dims, gridX, data->ksp_dims, src);
+	else
+		grid2(data->grid_os, data->width, data->beta, ND, data->trj_dims, data->grid_traj, data->cm2_dims, gridX, data->ksp_dims, src);
 
-	md_free(wdat);
+	workspace_release(data->workspace, wdat);
 
-	long factors[data->N];
+	if (data->pad) {
 
-	for (unsigned int i = 0; i < data->N; i++)
-		factors[i] = ((data->img_dims[i] > 1) && (i < 3)) ? 2 : 1;
+		md_zmulc2(ND, data->cm2_dims, data->cm2_strs, gridX, data->cm2_strs, gridX, data->gim_strs, data->pad_post);
+		linop_adjoint(data->pad_fft_op, ND, data->cm2_dims, gridX, ND, data->cm2_dims, gridX);
+		md_zmulc2(ND, data->cim_dims, data->cim_strs, dst, data->cm2_strs, (void*)gridX + data->pad_offset, data->img_strs, data->pad_pre);
 
-	md_decompose(data->N, factors, data->cml_dims, data->grid, data->cm2_dims, gridX, CFL_SIZE);
-	md_free(gridX);
-	md_zmulc2(ND, data->cml_dims, data->cml_strs, data->grid, data->cml_strs, data->grid, data->img_strs, data->fftmod);
-	linop_adjoint(data->fft_op, ND, data->cml_dims, data->grid, ND, data->cml_dims, data->grid);
+		workspace_release(data->workspace, gridX);
+		return;
+	}
 
-	md_clear(ND, data->cim_dims, dst, CFL_SIZE);
-	md_zfmacc2(ND, data->cml_dims, data->cim_strs, dst, data->cml_strs, data->grid, data->lph_strs, data->linphase);
+	fftmod_recompose(data, gridX, true);
+	workspace_release(data->workspace, gridX);
+
+	linop_adjoint(data->fft_op, ND, data->cml_dims, data->grid, ND, data->cml_dims, data->grid);
 
-	if (data->conf.toeplitz)
-		md_zmul2(ND, data->cim_dims, data->cim_strs, dst, data->cim_strs, dst, data->img_strs, data->roll);
+	linphase_sum(data, dst, data->conf.toeplitz);
 }
 
 
@@ -628,10 +824,10 @@ static void nufft_apply_normal(const void* _data, complex float* dst, const comp
 
 	} else {
 
-		complex float* tmp_ksp = md_alloc(data->N + 3, data->ksp_dims, CFL_SIZE);
+		complex float* tmp_ksp = md_workspace_alloc(data->workspace, data->N + 3, data->ksp_dims, CFL_SIZE);
 		nufft_apply((const void*)data, tmp_ksp, src);
 		nufft_apply_adjoint((const void*)data, dst, tmp_ksp);
-		md_free(tmp_ksp);
+		workspace_release(data->workspace, tmp_ksp);
 	}
 }
 
@@ -647,8 +843,79 @@ static void toeplitz_mult(const struct nufft_data* data, complex float* dst, con
 	md_zmul2(ND, data->cml_dims, data->cml_strs, data->grid, data->cml_strs, data->grid, data->psf_strs, data->psf);
 	linop_adjoint(data->fft_op, ND, data->cml_dims, data->grid, ND, data->cml_dims, data->grid);
 
-	md_clear(ND, data->cim_dims, dst, CFL_SIZE);
-	md_zfmacc2(ND, data->cml_dims, data->cim_strs, dst, data->cml_strs, data->grid, data->lph_strs, data->linphase);
+	linphase_sum(data, dst, false);
+}
+
+
+
+/**
+ * Multiply the shifted grids with fftmod and recompose them into the
+ * oversampled grid (or the reverse for the adjoint) in one pass.
+ */
+static void fftmod_recompose(const struct nufft_data* data, complex float* gridX, bool adjoint)
+{
+	unsigned int N = data->N;
+
+	assert(1 == md_calc_size(2, data->cml_dims + N + 1));
+
+	long factors[N];
+
+	for (unsigned int i = 0; i < N; i++)
+		factors[i] = ((data->img_dims[i] > 1) && (i < 3)) ? 2 : 1;
+
+	long dims2[2 * N];
+	long gstrs2[2 * N];
+	long xstrs2[2 * N];
+	long mstrs2[2 * N];
+
+	md_decompose_dims(N, dims2, gstrs2, xstrs2, factors, data->cml_dims, data->cml_strs, data->cm2_dims, data->cm2_strs);
+
+	// fftmod is the same for all shifts
+
+	md_copy_strides(N, mstrs2, data->img_strs);
+	md_set_dims(N, mstrs2 + N, 0);
+
+	struct md_zexpr_s* expr = md_zexpr_create(2 * N, dims2);
+
+	int mod = md_zexpr_input(expr, mstrs2, data->fftmod);
+
+	if (adjoint) {
+
+		int grid = md_zexpr_input(expr, xstrs2, gridX);
+		md_zexpr_store(expr, gstrs2, data->grid, md_zexpr_zmulc(expr, grid, mod));
+
+	} else {
+
+		int grid = md_zexpr_input(expr, gstrs2, data->grid);
+		md_zexpr_store(expr, xstrs2, gridX, md_zexpr_zmul(expr, grid, mod));
+	}
+
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
+}
+
+
+
+/**
+ * Sum over the shifted grids weighted with the conjugate linear
+ * phases (and the roll-off correction) without clearing dst first.
+ */
+static void linphase_sum(const struct nufft_data* data, complex float* dst, bool roll)
+{
+	unsigned int ND = data->N + 3;
+
+	struct md_zexpr_s* expr = md_zexpr_create(ND, data->cml_dims);
+
+	int grid = md_zexpr_input(expr, data->cml_strs, data->grid);
+	int lph = md_zexpr_input(expr, data->lph_strs, data->linphase);
+	int val = md_zexpr_zmulc(expr, grid, lph);
+
+	if (roll)
+		val = md_zexpr_zmul(expr, val, md_zexpr_input(expr, data->img_strs, data->roll));
+
+	md_zexpr_sum(expr, data->cim_strs, dst, val);
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
 }
 
 
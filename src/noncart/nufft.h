@@ -7,10 +7,17 @@
 
 struct operator_s;
 struct linop_s;
+struct workspace_s;
 
 struct nufft_conf_s {
 
 	_Bool toeplitz; ///< Toeplitz embedding boolean for A^T A
+	_Bool tiled;	///< Lock-free tiled gridding for the adjoint
+	long tile_size;	///< Tile size for tiled gridding (0: default)
+	long max_interp_mem;	///< Memory budget in bytes for precomputed interpolation weights
+	struct workspace_s* workspace;	///< Scratch memory shared with other operators (NULL: private)
+	float os;	///< Oversampling factor of the grid (2: shifted FFTs, otherwise zero-padded FFT)
+	float width;	///< Kernel half-width in grid units (0: chosen from os)
 };
 
 extern struct nufft_conf_s nufft_conf_defaults;
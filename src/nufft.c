@@ -62,6 +62,7 @@ int main_nufft(int argc, char* argv[])
 		{ 'D', true, opt_vec3, &coilim_dims, NULL },
 		{ 't', false, opt_set, &conf.toeplitz, "\tToeplitz embedding for inverse NUFFT" },
 		{ 'c', false, opt_set, &precond, "\tPreconditioning for inverse NUFFT" },
+		{ 'o', true, opt_float, &conf.os, " os\toversampling factor of the grid" },
 		{ 'l', true, opt_float, &lambda, " lambda\tl2 regularization" },
 		{ 'm', true, opt_int, &cgconf.maxiter, NULL },
 	};
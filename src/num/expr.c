@@ -0,0 +1,750 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ *
+ *
+ * Fused evaluation of chains of elementwise operations.
+ *
+ * An expression is built from input arrays, elementwise operations
+ * on complex floats and outputs, which all share one iteration space
+ * (zero strides broadcast an argument). It is evaluated in a single
+ * sweep over the memory: the dimensions are optimized for all arrays
+ * together and each row is processed in small blocks, which are kept
+ * in cache from the first load to the last store. Compared to a
+ * sequence of md_z* calls, intermediate results never go to memory.
+ *
+ * Outputs either store the result, add it to the output (acc), or
+ * store the sum over all dimensions where the output has zero stride
+ * (sum). The latter needs no separate md_clear of the output. All sum
+ * outputs of an expression have to sum over the same dimensions.
+ *
+ * An output may be identical to an input (same pointer and strides),
+ * but must not overlap with any argument otherwise.
+ *
+ * Example:
+ *
+ * struct md_zexpr_s* expr = md_zexpr_create(D, dims);
+ * int a = md_zexpr_input(expr, strs1, src1);
+ * int b = md_zexpr_input(expr, strs2, src2);
+ * md_zexpr_sum(expr, ostrs, dst, md_zexpr_zmul(expr, a, b));
+ * md_zexpr_eval(expr);
+ * md_zexpr_free(expr);
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <string.h>
+
+#include "num/multind.h"
+#include "num/flpmath.h"
+#include "num/optimize.h"
+
+#ifdef USE_CUDA
+#include "num/gpuops.h"
+#endif
+
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "expr.h"
+
+
+// automatic parallelization (flpmath.c)
+extern bool num_auto_parallelize;
+
+
+#define EXPR_MAX_VALS	16
+#define EXPR_MAX_ARGS	8
+
+// block length (in complex floats) for the evaluation of a row
+#define EXPR_BLK	256
+
+// rows are split into chunks of this length for parallelization
+#define EXPR_CHUNK	(32 * EXPR_BLK)
+
+
+enum expr_op { EXPR_INPUT, EXPR_ZMUL, EXPR_ZMULC, EXPR_ZADD, EXPR_ZSUB, EXPR_ZSMUL };
+enum expr_out { EXPR_STORE, EXPR_ACC, EXPR_SUM };
+
+struct expr_val {
+
+	enum expr_op op;
+	int a;		// argument (input) or values (operations)
+	int b;
+	complex float val;
+};
+
+struct expr_arg {
+
+	long* strs;
+	void* ptr;
+
+	bool output;
+	enum expr_out mode;
+	int val;
+};
+
+struct md_zexpr_s {
+
+	unsigned int D;
+	long* dims;
+
+	int nvals;
+	struct expr_val vals[EXPR_MAX_VALS];
+
+	int nargs;
+	struct expr_arg args[EXPR_MAX_ARGS];
+};
+
+
+
+struct md_zexpr_s* md_zexpr_create(unsigned int D, const long dims[D])
+{
+	PTR_ALLOC(struct md_zexpr_s, expr);
+
+	expr->D = D;
+	expr->dims = *TYPE_ALLOC(long[D]);
+	md_copy_dims(D, expr->dims, dims);
+
+	expr->nvals = 0;
+	expr->nargs = 0;
+
+	return expr;
+}
+
+
+void md_zexpr_free(struct md_zexpr_s* expr)
+{
+	for (int i = 0; i < expr->nargs; i++)
+		free(expr->args[i].strs);
+
+	free(expr->dims);
+	free(expr);
+}
+
+
+static int add_arg(struct md_zexpr_s* expr, const long* strs, void* ptr, bool output, enum expr_out mode, int val)
+{
+	assert(expr->nargs < EXPR_MAX_ARGS);
+
+	struct expr_arg* arg = &expr->args[expr->nargs];
+
+	arg->strs = *TYPE_ALLOC(long[expr->D]);
+	md_copy_strides(expr->D, arg->strs, strs);
+	arg->ptr = ptr;
+	arg->output = output;
+	arg->mode = mode;
+	arg->val = val;
+
+	return expr->nargs++;
+}
+
+
+static int add_val(struct md_zexpr_s* expr, enum expr_op op, int a, int b, complex float val)
+{
+	assert(expr->nvals < EXPR_MAX_VALS);
+
+	if (EXPR_INPUT != op) {
+
+		assert((0 <= a) && (a < expr->nvals));
+		assert((EXPR_ZSMUL == op) || ((0 <= b) && (b < expr->nvals)));
+	}
+
+	expr->vals[expr->nvals] = (struct expr_val){ op, a, b, val };
+
+	return expr->nvals++;
+}
+
+
+/**
+ * Add an input array and return its value.
+ */
+int md_zexpr_input(struct md_zexpr_s* expr, const long* strs, const complex float* ptr)
+{
+	int arg = add_arg(expr, strs, (void*)ptr, false, EXPR_STORE, -1);
+
+	return add_val(expr, EXPR_INPUT, arg, -1, 0.);
+}
+
+
+/**
+ * a * b
+ */
+int md_zexpr_zmul(struct md_zexpr_s* expr, int a, int b)
+{
+	return add_val(expr, EXPR_ZMUL, a, b, 0.);
+}
+
+
+/**
+ * a * conj(b)
+ */
+int md_zexpr_zmulc(struct md_zexpr_s* expr, int a, int b)
+{
+	return add_val(expr, EXPR_ZMULC, a, b, 0.);
+}
+
+
+/**
+ * a + b
+ */
+int md_zexpr_zadd(struct md_zexpr_s* expr, int a, int b)
+{
+	return add_val(expr, EXPR_ZADD, a, b, 0.);
+}
+
+
+/**
+ * a - b
+ */
+int md_zexpr_zsub(struct md_zexpr_s* expr, int a, int b)
+{
+	return add_val(expr, EXPR_ZSUB, a, b, 0.);
+}
+
+
+/**
+ * a * val
+ */
+int md_zexpr_zsmul(struct md_zexpr_s* expr, int a, complex float val)
+{
+	return add_val(expr, EXPR_ZSMUL, a, -1, val);
+}
+
+
+static unsigned int sum_flags(const struct md_zexpr_s* expr, const long* strs)
+{
+	unsigned int flags = 0;
+
+	for (unsigned int j = 0; j < expr->D; j++)
+		if ((1 < expr->dims[j]) && (0 == strs[j]))
+			flags = MD_SET(flags, j);
+
+	return flags;
+}
+
+
+static void add_output(struct md_zexpr_s* expr, const long* strs, complex float* ptr, int a, enum expr_out mode)
+{
+	assert((0 <= a) && (a < expr->nvals));
+
+	// sum outputs are initialized in the first sweep over the
+	// reduced dimensions, so they all need the same ones
+
+	if (EXPR_SUM == mode)
+		for (int i = 0; i < expr->nargs; i++)
+			if (expr->args[i].output && (EXPR_SUM == expr->args[i].mode))
+				assert(sum_flags(expr, expr->args[i].strs) == sum_flags(expr, strs));
+
+	add_arg(expr, strs, ptr, true, mode, a);
+}
+
+
+/**
+ * ptr = a
+ */
+void md_zexpr_store(struct md_zexpr_s* expr, const long* strs, complex float* ptr, int a)
+{
+	add_output(expr, strs, ptr, a, EXPR_STORE);
+}
+
+
+/**
+ * ptr += a
+ */
+void md_zexpr_acc(struct md_zexpr_s* expr, const long* strs, complex float* ptr, int a)
+{
+	add_output(expr, strs, ptr, a, EXPR_ACC);
+}
+
+
+/**
+ * ptr = sum of a over all dimensions where strs is zero
+ */
+void md_zexpr_sum(struct md_zexpr_s* expr, const long* strs, complex float* ptr, int a)
+{
+	add_output(expr, strs, ptr, a, EXPR_SUM);
+}
+
+
+
+
+struct expr_data {
+
+	const struct md_zexpr_s* expr;
+
+	long len;
+	long strs[EXPR_MAX_ARGS];
+	bool copy[EXPR_MAX_ARGS];	// inputs which are overwritten by an output
+	bool acc;			// sum outputs accumulate
+};
+
+
+static void expr_block(const struct expr_data* data, long n, void* ptr[], complex float (*buf)[EXPR_BLK])
+{
+	const struct md_zexpr_s* expr = data->expr;
+	const complex float* val[EXPR_MAX_VALS];
+
+	for (int i = 0; i < expr->nvals; i++) {
+
+		const struct expr_val* v = &expr->vals[i];
+		complex float* out = buf[i];
+
+		switch (v->op) {
+
+		case EXPR_INPUT: {
+
+			long str = data->strs[v->a];
+			const complex float* in = ptr[v->a];
+
+			if (((long)CFL_SIZE == str) && !data->copy[v->a]) {
+
+				val[i] = in;
+				continue;
+			}
+
+			for (long j = 0; j < n; j++)
+				out[j] = *(const complex float*)((const char*)in + j * str);
+
+			break;
+		}
+
+		case EXPR_ZMUL:
+
+			for (long j = 0; j < n; j++)
+				out[j] = val[v->a][j] * val[v->b][j];
+
+			break;
+
+		case EXPR_ZMULC:
+
+			for (long j = 0; j < n; j++)
+				out[j] = val[v->a][j] * conjf(val[v->b][j]);
+
+			break;
+
+		case EXPR_ZADD:
+
+			for (long j = 0; j < n; j++)
+				out[j] = val[v->a][j] + val[v->b][j];
+
+			break;
+
+		case EXPR_ZSUB:
+
+			for (long j = 0; j < n; j++)
+				out[j] = val[v->a][j] - val[v->b][j];
+
+			break;
+
+		case EXPR_ZSMUL:
+
+			for (long j = 0; j < n; j++)
+				out[j] = val[v->a][j] * v->val;
+
+			break;
+		}
+
+		val[i] = out;
+	}
+
+	for (int i = 0; i < expr->nargs; i++) {
+
+		const struct expr_arg* arg = &expr->args[i];
+
+		if (!arg->output)
+			continue;
+
+		long str = data->strs[i];
+		char* out = ptr[i];
+		const complex float* in = val[arg->val];
+
+		if ((EXPR_ACC == arg->mode) || ((EXPR_SUM == arg->mode) && data->acc)) {
+
+			// sequential, as the output may be constant along the row
+
+			for (long j = 0; j < n; j++)
+				*(complex float*)(out + j * str) += in[j];
+
+		} else {
+
+			if ((long)CFL_SIZE == str) {
+
+				if ((void*)out != (void*)in)
+					memcpy(out, in, n * CFL_SIZE);
+
+			} else {
+
+				for (long j = 0; j < n; j++)
+					*(complex float*)(out + j * str) = in[j];
+			}
+		}
+	}
+}
+
+
+static void expr_row(void* _data, void* ptr[])
+{
+	const struct expr_data* data = _data;
+	const struct md_zexpr_s* expr = data->expr;
+
+	complex float buf[expr->nvals][EXPR_BLK];
+
+	for (long o = 0; o < data->len; o += EXPR_BLK) {
+
+		void* ptr2[expr->nargs];
+
+		for (int i = 0; i < expr->nargs; i++)
+			ptr2[i] = ptr[i] + o * data->strs[i];
+
+		expr_block(data, MIN(EXPR_BLK, data->len - o), ptr2, buf);
+	}
+}
+
+
+/*
+ * Evaluate the expression for the sub-block of the iteration
+ * space given by dims and the start position pos.
+ */
+static void expr_sweep(const struct md_zexpr_s* expr, const long dims[expr->D], const long pos[expr->D], bool acc)
+{
+	unsigned int D = expr->D;
+	unsigned int N = expr->nargs;
+
+	if (0 == md_calc_size(D, dims))
+		return;
+
+	long tdims[D];
+	md_copy_dims(D, tdims, dims);
+
+	long tstrs[N][D];
+	long (*nstr[N])[D];
+	void* nptr[N];
+	size_t sizes[N];
+	unsigned int io = 0;
+
+	for (unsigned int i = 0; i < N; i++) {
+
+		const struct expr_arg* arg = &expr->args[i];
+
+		md_copy_strides(D, tstrs[i], arg->strs);
+		nstr[i] = &tstrs[i];
+		nptr[i] = arg->ptr + md_calc_offset(D, arg->strs, pos);
+		sizes[i] = CFL_SIZE;
+
+		if (arg->output)
+			io |= MD_BIT(i);
+	}
+
+	// inputs which are also outputs
+
+	bool copy[N];
+
+	for (unsigned int i = 0; i < N; i++) {
+
+		copy[i] = false;
+
+		for (unsigned int j = 0; j < N; j++) {
+
+			if ((i != j) && expr->args[j].output && (nptr[i] == nptr[j])) {
+
+				io |= MD_BIT(i);
+				copy[i] = true;
+			}
+		}
+	}
+
+	unsigned int ND = optimize_dims(N, D, tdims, nstr);
+
+	unsigned int flags = 0;
+
+	if (num_auto_parallelize)
+		flags = dims_parallel(N, io, ND, tdims, nstr, sizes);
+
+	debug_print_dims(DP_DEBUG4, ND, tdims);
+	debug_printf(DP_DEBUG4, "Expr: %d values, %d arguments, parallel: %d\n", expr->nvals, N, flags);
+
+	// the innermost dimension is processed by expr_row
+
+	struct expr_data data = { .expr = expr, .len = tdims[0], .acc = acc };
+
+	const long* nstr2[N];
+
+	for (unsigned int i = 0; i < N; i++) {
+
+		data.strs[i] = tstrs[i][0];
+		data.copy[i] = copy[i];
+		nstr2[i] = tstrs[i] + 1;
+	}
+
+	flags = MD_CLEAR(flags, 0) >> 1;
+
+	// If only the innermost dimension could be split, e.g. for sums
+	// over coils, process chunks of the rows in parallel instead.
+
+	bool split = num_auto_parallelize && (0 == flags) && (tdims[0] > EXPR_CHUNK);
+
+	for (unsigned int i = 0; i < N; i++)
+		if (MD_IS_SET(io, i) && (0 == tstrs[i][0]))
+			split = false;
+
+	if (!split) {
+
+		md_parallel_nary(N, ND - 1, tdims + 1, flags, nstr2, nptr, &data, expr_row);
+		return;
+	}
+
+	long chunks = (tdims[0] + EXPR_CHUNK - 1) / EXPR_CHUNK;
+
+	#pragma omp parallel for
+	for (long c = 0; c < chunks; c++) {
+
+		struct expr_data data2 = data;
+		data2.len = MIN(EXPR_CHUNK, tdims[0] - c * EXPR_CHUNK);
+
+		void* nptr2[N];
+
+		for (unsigned int i = 0; i < N; i++)
+			nptr2[i] = nptr[i] + c * EXPR_CHUNK * tstrs[i][0];
+
+		md_nary(N, ND - 1, tdims + 1, nstr2, nptr2, &data2, expr_row);
+	}
+}
+
+
+#ifdef USE_CUDA
+static void expr_step(unsigned int D, const long dims[D], const struct expr_val* v,
+		const long ostrs[D], complex float* optr, const long* strs[], complex float* ptr[])
+{
+	switch (v->op) {
+
+	case EXPR_ZMUL:
+		md_zmul2(D, dims, ostrs, optr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+		break;
+
+	case EXPR_ZMULC:
+		md_zmulc2(D, dims, ostrs, optr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+		break;
+
+	case EXPR_ZADD:
+		md_zadd2(D, dims, ostrs, optr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+		break;
+
+	case EXPR_ZSUB:
+		md_zsub2(D, dims, ostrs, optr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+		break;
+
+	case EXPR_ZSMUL:
+		md_zsmul2(D, dims, ostrs, optr, strs[v->a], ptr[v->a], v->val);
+		break;
+
+	default:
+		assert(0);
+	}
+}
+
+
+/*
+ * Operation by operation. A value which is only used by one output
+ * is computed directly into it (products which are accumulated with
+ * md_zfmac2 or md_zfmacc2). Other values use full-size temporaries,
+ * which are freed after their last use.
+ */
+static void expr_eval_steps(const struct md_zexpr_s* expr)
+{
+	unsigned int D = expr->D;
+	const long* dims = expr->dims;
+
+	long tstrs[D];
+	md_calc_strides(D, tstrs, dims, CFL_SIZE);
+
+	const long* strs[expr->nvals];
+	complex float* ptr[expr->nvals];
+	int users[expr->nvals];
+	int direct[expr->nvals];	// output which computes the value, or -1
+
+	for (int i = 0; i < expr->nvals; i++) {
+
+		users[i] = 0;
+		direct[i] = -1;
+		ptr[i] = NULL;
+	}
+
+	for (int i = 0; i < expr->nvals; i++) {
+
+		const struct expr_val* v = &expr->vals[i];
+
+		if (EXPR_INPUT == v->op)
+			continue;
+
+		users[v->a]++;
+
+		if (EXPR_ZSMUL != v->op)
+			users[v->b]++;
+	}
+
+	for (int i = 0; i < expr->nargs; i++)
+		if (expr->args[i].output)
+			users[expr->args[i].val]++;
+
+	for (int i = 0; i < expr->nargs; i++) {
+
+		const struct expr_arg* arg = &expr->args[i];
+
+		if (!arg->output || (1 != users[arg->val]))
+			continue;
+
+		const struct expr_val* v = &expr->vals[arg->val];
+
+		if (EXPR_INPUT == v->op)
+			continue;
+
+		if ((EXPR_STORE != arg->mode) && (EXPR_ZMUL != v->op) && (EXPR_ZMULC != v->op))
+			continue;
+
+		// the output is cleared (sum) or written before the operands are read
+
+		bool alias = false;
+
+		for (int j = 0; j < expr->nargs; j++)
+			if (!expr->args[j].output && (expr->args[j].ptr == arg->ptr))
+				alias = true;
+
+		if (!alias)
+			direct[arg->val] = i;
+	}
+
+	for (int i = 0; i < expr->nvals; i++) {
+
+		const struct expr_val* v = &expr->vals[i];
+
+		if (EXPR_INPUT == v->op) {
+
+			strs[i] = expr->args[v->a].strs;
+			ptr[i] = expr->args[v->a].ptr;
+			continue;
+		}
+
+		if (-1 != direct[i])
+			continue;
+
+		strs[i] = tstrs;
+		ptr[i] = md_alloc_sameplace(D, dims, CFL_SIZE, expr->args[0].ptr);
+
+		expr_step(D, dims, v, tstrs, ptr[i], strs, ptr);
+
+		if ((EXPR_INPUT != expr->vals[v->a].op) && (0 == --users[v->a]))
+			md_free(ptr[v->a]);
+
+		if ((EXPR_ZSMUL != v->op) && (EXPR_INPUT != expr->vals[v->b].op) && (0 == --users[v->b]))
+			md_free(ptr[v->b]);
+	}
+
+	for (int i = 0; i < expr->nargs; i++) {
+
+		const struct expr_arg* arg = &expr->args[i];
+
+		if (!arg->output)
+			continue;
+
+		int n = arg->val;
+		const struct expr_val* v = &expr->vals[n];
+
+		if (i == direct[n]) {
+
+			if (EXPR_SUM == arg->mode)
+				md_clear2(D, dims, arg->strs, arg->ptr, CFL_SIZE);
+
+			if (EXPR_STORE == arg->mode)
+				expr_step(D, dims, v, arg->strs, arg->ptr, strs, ptr);
+			else
+			if (EXPR_ZMUL == v->op)
+				md_zfmac2(D, dims, arg->strs, arg->ptr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+			else
+				md_zfmacc2(D, dims, arg->strs, arg->ptr, strs[v->a], ptr[v->a], strs[v->b], ptr[v->b]);
+
+			if ((EXPR_INPUT != expr->vals[v->a].op) && (0 == --users[v->a]))
+				md_free(ptr[v->a]);
+
+			if ((EXPR_ZSMUL != v->op) && (EXPR_INPUT != expr->vals[v->b].op) && (0 == --users[v->b]))
+				md_free(ptr[v->b]);
+
+			continue;
+		}
+
+		switch (arg->mode) {
+
+		case EXPR_STORE:
+			md_copy2(D, dims, arg->strs, arg->ptr, strs[n], ptr[n], CFL_SIZE);
+			break;
+
+		case EXPR_SUM:
+			md_clear2(D, dims, arg->strs, arg->ptr, CFL_SIZE);
+			// fall through
+		case EXPR_ACC:
+			md_zadd2(D, dims, arg->strs, arg->ptr, arg->strs, arg->ptr, strs[n], ptr[n]);
+			break;
+		}
+
+		if ((EXPR_INPUT != v->op) && (0 == --users[n]))
+			md_free(ptr[n]);
+	}
+}
+#endif
+
+
+/**
+ * Evaluate the expression.
+ */
+void md_zexpr_eval(const struct md_zexpr_s* expr)
+{
+	unsigned int D = expr->D;
+	const long* dims = expr->dims;
+
+#ifdef USE_CUDA
+	bool gpu = false;
+
+	for (int i = 0; i < expr->nargs; i++)
+		gpu |= cuda_ondevice(expr->args[i].ptr);
+
+	if (gpu) {
+
+		expr_eval_steps(expr);
+		return;
+	}
+#endif
+
+	// dimensions which are summed over
+
+	unsigned int rflags = 0;
+
+	for (int i = 0; i < expr->nargs; i++)
+		if (expr->args[i].output && (EXPR_SUM == expr->args[i].mode))
+			rflags = sum_flags(expr, expr->args[i].strs);
+
+	// the first element along the summed dimensions
+	// initializes the output, the rest is added to it
+
+	long sdims[D];
+	long pos[D];
+
+	md_select_dims(D, ~rflags, sdims, dims);
+	md_set_dims(D, pos, 0);
+
+	expr_sweep(expr, sdims, pos, false);
+
+	for (unsigned int r = 0; r < D; r++) {
+
+		if (!MD_IS_SET(rflags, r))
+			continue;
+
+		sdims[r] = dims[r] - 1;
+		pos[r] = 1;
+
+		expr_sweep(expr, sdims, pos, true);
+
+		sdims[r] = dims[r];
+		pos[r] = 0;
+	}
+}
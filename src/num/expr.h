@@ -0,0 +1,34 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ */
+
+#ifndef __EXPR_H
+#define __EXPR_H	1
+
+#include <complex.h>
+
+#include "misc/cppwrap.h"
+
+struct md_zexpr_s;
+
+extern struct md_zexpr_s* md_zexpr_create(unsigned int D, const long dims[__VLA(D)]);
+extern void md_zexpr_free(struct md_zexpr_s* expr);
+
+extern int md_zexpr_input(struct md_zexpr_s* expr, const long* strs, const _Complex float* ptr);
+
+extern int md_zexpr_zmul(struct md_zexpr_s* expr, int a, int b);
+extern int md_zexpr_zmulc(struct md_zexpr_s* expr, int a, int b);
+extern int md_zexpr_zadd(struct md_zexpr_s* expr, int a, int b);
+extern int md_zexpr_zsub(struct md_zexpr_s* expr, int a, int b);
+extern int md_zexpr_zsmul(struct md_zexpr_s* expr, int a, _Complex float val);
+
+extern void md_zexpr_store(struct md_zexpr_s* expr, const long* strs, _Complex float* ptr, int a);
+extern void md_zexpr_acc(struct md_zexpr_s* expr, const long* strs, _Complex float* ptr, int a);
+extern void md_zexpr_sum(struct md_zexpr_s* expr, const long* strs, _Complex float* ptr, int a);
+
+extern void md_zexpr_eval(const struct md_zexpr_s* expr);
+
+#include "misc/cppwrap.h"
+
+#endif // __EXPR_H
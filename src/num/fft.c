@@ -15,13 +15,23 @@
  * Wissenschaften, Göttingen, 1866
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <complex.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include <math.h>
 
 #include <fftw3.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "num/multind.h"
 #include "num/flpmath.h"
 #include "num/ops.h"
@@ -204,6 +214,184 @@ struct fft_plan_s {
 
 
 
+static enum fft_planner fft_planner = FFT_ESTIMATE;
+static bool fft_init_done = false;
+static bool fft_wisdom_init = false;
+static bool fft_wisdom_new = false;
+static unsigned int fft_num_threads = 1;
+#ifdef FFTWTHREADS
+static bool fft_threads_init = false;
+#endif
+
+static const unsigned int fft_planner_flags[] = {
+
+	[FFT_ESTIMATE] = FFTW_ESTIMATE,
+	[FFT_MEASURE] = FFTW_MEASURE,
+	[FFT_PATIENT] = FFTW_PATIENT,
+};
+
+static const char* fft_planner_names[] = {
+
+	[FFT_ESTIMATE] = "estimate",
+	[FFT_MEASURE] = "measure",
+	[FFT_PATIENT] = "patient",
+};
+
+
+/*
+ * The wisdom file is specific to the machine (and FFTW build),
+ * so the host name is part of the default file name.
+ */
+static char* fft_wisdom_file(void)
+{
+	const char* file = getenv("BART_FFTW_WISDOM");
+
+	if (NULL != file)
+		return strdup(file);
+
+	const char* home = getenv("HOME");
+
+	if (NULL == home)
+		return NULL;
+
+	char host[256];
+
+	if (0 != gethostname(host, sizeof(host)))
+		strcpy(host, "localhost");
+
+	host[sizeof(host) - 1] = '\0';
+
+	char* path = xmalloc(strlen(home) + strlen(host) + 32);
+	sprintf(path, "%s/.bart-fftwf-wisdom-%s", home, host);
+
+	return path;
+}
+
+
+static void fft_wisdom_save(void)
+{
+	if (!fft_wisdom_new)
+		return;
+
+	char* file = fft_wisdom_file();
+
+	if (NULL == file)
+		return;
+
+	// write to a temporary file first so that concurrent
+	// processes never see a partially written file
+
+	char* tmp = xmalloc(strlen(file) + 32);
+	sprintf(tmp, "%s.%ld", file, (long)getpid());
+
+	if (fftwf_export_wisdom_to_filename(tmp) && (0 == rename(tmp, file))) {
+
+		debug_printf(DP_DEBUG1, "FFTW wisdom saved to %s\n", file);
+
+	} else {
+
+		debug_printf(DP_WARN, "Could not save FFTW wisdom to %s.\n", file);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(file);
+}
+
+
+static void fft_wisdom_load(void)
+{
+	if (fft_wisdom_init)
+		return;
+
+	fft_wisdom_init = true;
+
+	char* file = fft_wisdom_file();
+
+	if (NULL == file)
+		return;
+
+	if (fftwf_import_wisdom_from_filename(file))
+		debug_printf(DP_DEBUG1, "FFTW wisdom loaded from %s\n", file);
+
+	free(file);
+
+	atexit(fft_wisdom_save);
+}
+
+
+void fft_set_planner(enum fft_planner planner)
+{
+	fft_planner = planner;
+
+	if (FFT_ESTIMATE != planner)
+		fft_wisdom_load();
+}
+
+
+/*
+ * Select the FFTW planner with BART_FFTW_PLANNER=estimate|measure|patient.
+ * Plans found by measuring are kept as wisdom in a file (BART_FFTW_WISDOM,
+ * by default in the home directory), so the planning cost is paid only
+ * once per machine. This is called from num_init or before the first plan.
+ */
+void fft_init(void)
+{
+	if (fft_init_done)
+		return;
+
+	fft_init_done = true;
+
+	const char* str = getenv("BART_FFTW_PLANNER");
+
+	if (NULL == str)
+		return;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(fft_planner_names); i++) {
+
+		if (0 == strcasecmp(str, fft_planner_names[i])) {
+
+			fft_set_planner(i);
+			return;
+		}
+	}
+
+	debug_printf(DP_WARN, "Unknown FFTW planner: %s\n", str);
+}
+
+
+// number of elements spanned by a strided array
+static long fft_extent(unsigned int D, const long dimensions[D], const long strides[D])
+{
+	long ext = 1;
+
+	for (unsigned int i = 0; i < D; i++) {
+
+		if (strides[i] < 0)
+			return -1;
+
+		ext += (dimensions[i] - 1) * (strides[i] / CFL_SIZE);
+	}
+
+	return ext;
+}
+
+
+/*
+ * Plans created inside a parallel region (e.g. for the operators
+ * of one slice) are single-threaded, so that this does not have
+ * to be changed globally.
+ */
+static unsigned int fft_plan_threads(void)
+{
+#ifdef _OPENMP
+	if (omp_in_parallel())
+		return 1;
+#endif
+	return fft_num_threads;
+}
+
+
 static fftwf_plan fft_fftwf_plan(unsigned int D, const long dimensions[D], unsigned long flags, const long ostrides[D], complex float* dst, const long istrides[D], const complex float* src, bool backwards)
 {
 	unsigned int N = D;
@@ -233,10 +421,61 @@ static fftwf_plan fft_fftwf_plan(unsigned int D, const long dimensions[D], unsig
 		}
 	}
 
+	#pragma omp critical
+	fft_init();
+
+	enum fft_planner planner = fft_planner;
+
+	long oext = fft_extent(D, dimensions, ostrides);
+	long iext = fft_extent(D, dimensions, istrides);
+
+	if ((oext < 0) || (iext < 0))
+		planner = FFT_ESTIMATE;
+
+	unsigned int fftw_flags = fft_planner_flags[planner];
+
+	complex float* pdst = dst;
+	complex float* psrc = (complex float*)src;
+	complex float* scratch = NULL;
+
+	if (FFT_ESTIMATE != planner) {
+
+		// measuring overwrites the arrays (which might also
+		// live on the GPU), so plan on scratch memory with
+		// the same layout
+
+		bool inplace = ((void*)dst == (void*)src);
+		long off = inplace ? 0 : ((oext + 7) & ~7L);
+
+		scratch = fftwf_malloc(CFL_SIZE * (inplace ? MAX(oext, iext) : (off + iext)));
+
+		if (NULL == scratch)
+			error("FFTW out of memory\n");
+
+		pdst = scratch;
+		psrc = scratch + off;
+
+		if (   ((NULL != dst) && (0 != fftwf_alignment_of((float*)dst)))
+		    || ((NULL != src) && (0 != fftwf_alignment_of((float*)src))))
+			fftw_flags |= FFTW_UNALIGNED;
+	}
+
 	fftwf_plan fftwf;
 
 	#pragma omp critical
-	fftwf = fftwf_plan_guru_dft(k, dims, l, hmdims, (complex float*)src, dst, backwards ? 1 : (-1), FFTW_ESTIMATE);
+	{
+#ifdef FFTWTHREADS
+		if (fft_threads_init)
+			fftwf_plan_with_nthreads(fft_plan_threads());
+#endif
+		fftwf = fftwf_plan_guru_dft(k, dims, l, hmdims, psrc, pdst, backwards ? 1 : (-1), fftw_flags);
+
+		if (FFT_ESTIMATE != planner)
+			fft_wisdom_new = true;
+	}
+
+	if (NULL != scratch)
+		fftwf_free(scratch);
 
 	return fftwf;
 }
@@ -269,6 +508,7 @@ static void fft_free_plan(const void* _data)
 {
 	const struct fft_plan_s* plan = _data;
 
+	#pragma omp critical
 	fftwf_destroy_plan(plan->fftw);
 #ifdef	USE_CUDA
 	if (NULL != plan->cuplan)
@@ -317,32 +557,228 @@ void fft_free(const struct operator_s* o)
 }
 
 
+/*
+ * LRU cache of FFTW plans for the convenience functions, which are
+ * often called repeatedly with the same geometry. A plan can only be
+ * reused for arrays with the same alignment and in-place property, so
+ * both are part of the key. Entries in use are never evicted.
+ */
+
+#define FFT_CACHE_SIZE 32
+
+struct fft_cache_entry {
+
+	unsigned int D;
+	long* dims;			///< dims, ostrides, istrides
+	unsigned long flags;
+	bool backwards;
+	bool inplace;
+	int oalign;
+	int ialign;
+	enum fft_planner planner;
+	unsigned int nthreads;
+
+	fftwf_plan fftw;
+	long last_use;
+	int users;
+	bool temporary;
+};
+
+static struct fft_cache_entry fft_cache[FFT_CACHE_SIZE];
+static long fft_cache_clock = 0;
+static long fft_cache_hits = 0;
+static long fft_cache_misses = 0;
+static bool fft_cache_init = false;
+
+
+static void fft_cache_free(void)
+{
+	debug_printf(DP_DEBUG1, "FFT plan cache: %ld hits, %ld misses.\n", fft_cache_hits, fft_cache_misses);
+
+	for (int i = 0; i < FFT_CACHE_SIZE; i++) {
+
+		if (NULL == fft_cache[i].fftw)
+			continue;
+
+		fftwf_destroy_plan(fft_cache[i].fftw);
+		free(fft_cache[i].dims);
+
+		fft_cache[i].fftw = NULL;
+	}
+}
+
+
+static bool fft_cache_match(const struct fft_cache_entry* a, const struct fft_cache_entry* b)
+{
+	return (a->D == b->D) && (a->flags == b->flags)
+		&& (a->backwards == b->backwards) && (a->inplace == b->inplace)
+		&& (a->oalign == b->oalign) && (a->ialign == b->ialign)
+		&& (a->planner == b->planner) && (a->nthreads == b->nthreads)
+		&& (0 == memcmp(a->dims, b->dims, 3 * a->D * sizeof(long)));
+}
+
+
+static struct fft_cache_entry* fft_cache_get(unsigned int D, const long dimensions[D], unsigned long flags, const long ostrides[D], complex float* dst, const long istrides[D], const complex float* src, bool backwards)
+{
+	long key_dims[3 * D];
+
+	md_copy_dims(D, key_dims + 0 * D, dimensions);
+	md_copy_dims(D, key_dims + 1 * D, ostrides);
+	md_copy_dims(D, key_dims + 2 * D, istrides);
+
+	struct fft_cache_entry key = {
+
+		.D = D,
+		.dims = key_dims,
+		.flags = flags,
+		.backwards = backwards,
+		.inplace = ((void*)dst == (void*)src),
+		.oalign = fftwf_alignment_of((float*)dst),
+		.ialign = fftwf_alignment_of((float*)src),
+		.planner = fft_planner,
+		.nthreads = fft_plan_threads(),
+	};
+
+	struct fft_cache_entry* entry = NULL;
+
+	#pragma omp critical (fft_cache)
+	{
+		if (!fft_cache_init) {
+
+			fft_cache_init = true;
+			atexit(fft_cache_free);
+		}
+
+		for (int i = 0; i < FFT_CACHE_SIZE; i++) {
+
+			if ((NULL != fft_cache[i].fftw) && fft_cache_match(&fft_cache[i], &key)) {
+
+				entry = &fft_cache[i];
+				entry->users++;
+				entry->last_use = ++fft_cache_clock;
+				fft_cache_hits++;
+				break;
+			}
+		}
+
+		if (NULL == entry)
+			fft_cache_misses++;
+	}
+
+	if (NULL != entry)
+		return entry;
+
+	fftwf_plan fftw = fft_fftwf_plan(D, dimensions, flags, ostrides, dst, istrides, src, backwards);
+
+	#pragma omp critical (fft_cache)
+	{
+		// free slot or least recently used entry not in use
+
+		for (int i = 0; i < FFT_CACHE_SIZE; i++) {
+
+			if (0 != fft_cache[i].users)
+				continue;
+
+			if ((NULL == entry) || (NULL == fft_cache[i].fftw) || (fft_cache[i].last_use < entry->last_use))
+				entry = &fft_cache[i];
+
+			if (NULL == entry->fftw)
+				break;
+		}
+
+		if (NULL != entry) {
+
+			if (NULL != entry->fftw) {
+
+				#pragma omp critical
+				fftwf_destroy_plan(entry->fftw);
+
+				free(entry->dims);
+			}
+
+			*entry = key;
+			entry->dims = xmalloc(3 * D * sizeof(long));
+			memcpy(entry->dims, key_dims, 3 * D * sizeof(long));
+			entry->fftw = fftw;
+			entry->users = 1;
+			entry->last_use = ++fft_cache_clock;
+		}
+	}
+
+	if (NULL == entry) {
+
+		// all entries in use
+
+		PTR_ALLOC(struct fft_cache_entry, tmp);
+		*tmp = key;
+		tmp->dims = NULL;
+		tmp->fftw = fftw;
+		tmp->temporary = true;
+
+		entry = tmp;
+	}
+
+	return entry;
+}
+
+
+static void fft_cache_put(struct fft_cache_entry* entry)
+{
+	if (entry->temporary) {
+
+		#pragma omp critical
+		fftwf_destroy_plan(entry->fftw);
+
+		free(entry);
+		return;
+	}
+
+	#pragma omp critical (fft_cache)
+	entry->users--;
+}
+
+
+static void fft_cached(unsigned int D, const long dimensions[D], unsigned long flags, const long ostrides[D], complex float* dst, const long istrides[D], const complex float* src, bool backwards)
+{
+#ifdef  USE_CUDA
+	if (cuda_ondevice(src)) {
+
+		const struct operator_s* plan = fft_create2(D, dimensions, flags, ostrides, dst, istrides, src, backwards);
+		fft_exec(plan, dst, src);
+		fft_free(plan);
+		return;
+	}
+#endif
+	struct fft_cache_entry* entry = fft_cache_get(D, dimensions, flags, ostrides, dst, istrides, src, backwards);
+
+	fftwf_execute_dft(entry->fftw, (complex float*)src, dst);
+
+	fft_cache_put(entry);
+}
+
+
 void fft2(unsigned int D, const long dimensions[D], unsigned long flags, const long ostrides[D], complex float* dst, const long istrides[D], const complex float* src)
 {
-	const struct operator_s* plan = fft_create2(D, dimensions, flags, ostrides, dst, istrides, src, false);
-	fft_exec(plan, dst, src);
-	fft_free(plan);
+	fft_cached(D, dimensions, flags, ostrides, dst, istrides, src, false);
 }
 
 void ifft2(unsigned int D, const long dimensions[D], unsigned long flags, const long ostrides[D], complex float* dst, const long istrides[D], const complex float* src)
 {
-	const struct operator_s* plan = fft_create2(D, dimensions, flags, ostrides, dst, istrides, src, true);
-	fft_exec(plan, dst, src);
-	fft_free(plan);
+	fft_cached(D, dimensions, flags, ostrides, dst, istrides, src, true);
 }
 
 void fft(unsigned int D, const long dimensions[D], unsigned long flags, complex float* dst, const complex float* src)
 {
-	const struct operator_s* plan = fft_create(D, dimensions, flags, dst, src, false);
-	fft_exec(plan, dst, src);
-	fft_free(plan);
+	long strides[D];
+	md_calc_strides(D, strides, dimensions, CFL_SIZE);
+	fft2(D, dimensions, flags, strides, dst, strides, src);
 }
 
 void ifft(unsigned int D, const long dimensions[D], unsigned long flags, complex float* dst, const complex float* src)
 {
-	const struct operator_s* plan = fft_create(D, dimensions, flags, dst, src, true);
-	fft_exec(plan, dst, src);
-	fft_free(plan);
+	long strides[D];
+	md_calc_strides(D, strides, dimensions, CFL_SIZE);
+	ifft2(D, dimensions, flags, strides, dst, strides, src);
 }
 
 void fftc(unsigned int D, const long dimensions[__VLA(D)], unsigned long flags, complex float* dst, const complex float* src)
@@ -422,8 +858,6 @@ void ifftuc2(unsigned int D, const long dimensions[D], unsigned long flags, cons
 }
 
 
-bool fft_threads_init = false;
-
 void fft_set_num_threads(unsigned int n)
 {
 #ifdef FFTWTHREADS
@@ -433,12 +867,10 @@ void fft_set_num_threads(unsigned int n)
 		fft_threads_init = true;
 		fftwf_init_threads();
 	}
-
-	#pragma omp critical
-        fftwf_plan_with_nthreads(n);
-#else
-	UNUSED(n);
 #endif
+	// used for the next plans, see fft_fftwf_plan
+
+	fft_num_threads = n;
 }
 
 
@@ -90,6 +90,13 @@ extern void fft_free(const struct operator_s* plan);
 extern void fft_set_num_threads(unsigned int n);
 
 
+// FFTW planner effort
+enum fft_planner { FFT_ESTIMATE, FFT_MEASURE, FFT_PATIENT };
+
+extern void fft_set_planner(enum fft_planner planner);
+extern void fft_init(void);
+
+
 #ifdef __cplusplus
 }
 #endif
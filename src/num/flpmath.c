@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 
 #include "num/multind.h"
@@ -44,6 +45,11 @@
 extern bool num_auto_parallelize;
 bool num_auto_parallelize = true;
 
+// minimal size for parallel inner products
+#define SCALAR_PAR_MIN (64 * 1024)
+// maximum number of blocks of a parallel inner product
+#define SCALAR_PAR_BLOCKS 64
+
 
 #ifdef USE_CUDA
 #include "num/gpuops.h"
@@ -251,6 +257,171 @@ static void optimized_threeop_oii(unsigned int D, const long dim[D], const long
 
 
 
+static void nary_add(void* _data, void* ptr[])
+{
+	struct data_s* data = _data;
+
+	data->ops->add(data->size, ptr[0], ptr[0], ptr[1]);
+}
+
+static void nary_addD(void* _data, void* ptr[])
+{
+	struct data_s* data = _data;
+	double* dst = ptr[0];
+	const double* src = ptr[1];
+
+	for (long i = 0; i < data->size; i++)
+		dst[i] += src[i];
+}
+
+
+
+/**
+ * Optimized n-op for operations which accumulate into the output,
+ * i.e. optr = optr + f(iptr1, ...).
+ *
+ * If the output does not allow parallelization because it is
+ * reduced along some dimension, this dimension is split into
+ * parts which are accumulated in parallel into private (zeroed)
+ * copies of the output. These partial sums are then added to
+ * the output in a fixed order, so the result does not depend
+ * on the number of threads.
+ *
+ * @param bsize size of the scalar type of the output, i.e. float or double
+ */
+static void optimized_reduce_nop(unsigned int N, unsigned int io, unsigned int D, const long dim[D], const long (*nstr[N])[D], void* const nptr[N], size_t sizes[N], md_nary_fun_t too, void* data_ptr, size_t bsize)
+{
+#ifdef USE_CUDA
+	if (!num_auto_parallelize || use_gpu(N, (void**)nptr)) {
+#else
+	if (!num_auto_parallelize) {
+#endif
+		optimized_nop(N, io, D, dim, nstr, nptr, sizes, too, data_ptr);
+		return;
+	}
+
+	long tdims[D];
+	md_copy_dims(D, tdims, dim);
+
+	long tstrs[N][D];
+	long (*nstr1[N])[D];
+
+	for (unsigned int i = 0; i < N; i++) {
+
+		md_copy_strides(D, tstrs[i], *nstr[i]);
+		nstr1[i] = &tstrs[i];
+	}
+
+	unsigned int ND = optimize_dims(N, D, tdims, nstr1);
+
+	long parts = 0;
+	int r = -1;
+
+	if (0 == dims_parallel(N, io, ND, tdims, nstr1, sizes))
+		r = dims_reduction(ND, &parts, tdims, tstrs[0], sizes[0]);
+
+	if (-1 == r) {
+
+		optimized_nop(N, io, D, dim, nstr, nptr, sizes, too, data_ptr);
+		return;
+	}
+
+	debug_printf(DP_DEBUG4, "Reduction: dim %d, %ld parts\n", r, parts);
+
+	// compact layout of the partial sums
+
+	long odims[ND];
+	long bstrs[ND];
+
+	for (unsigned int i = 0; i < ND; i++)
+		odims[i] = (0 == tstrs[0][i]) ? 1 : tdims[i];
+
+	md_calc_strides(ND, bstrs, odims, sizes[0]);
+
+	for (unsigned int i = 0; i < ND; i++)
+		if (0 == tstrs[0][i])
+			bstrs[i] = 0;
+
+	long osize = md_calc_size(ND, odims);
+
+	char* buf = md_alloc(1, MD_DIMS(parts * osize), sizes[0]);
+	memset(buf, 0, parts * osize * sizes[0]);
+
+	#pragma omp parallel for
+	for (long p = 0; p < parts; p++) {
+
+		long start = p * tdims[r] / parts;
+
+		long pdims[ND];
+		md_copy_dims(ND, pdims, tdims);
+		pdims[r] = (p + 1) * tdims[r] / parts - start;
+
+		const long (*pstr[N])[ND];
+		void* pptr[N];
+
+		pstr[0] = (const long (*)[ND])bstrs;
+		pptr[0] = buf + p * osize * sizes[0];
+
+		for (unsigned int i = 1; i < N; i++) {
+
+			pstr[i] = (const long (*)[ND])tstrs[i];
+			pptr[i] = (char*)nptr[i] + start * tstrs[i][r];
+		}
+
+		optimized_nop(N, io, ND, pdims, pstr, pptr, sizes, too, data_ptr);
+	}
+
+	// add partial sums to the output in order
+
+	long cdims[ND + 1];
+	long costrs[ND + 1];
+	long cbstrs[ND + 1];
+
+	cdims[0] = sizes[0] / bsize;
+	costrs[0] = bsize;
+	cbstrs[0] = bsize;
+
+	md_copy_dims(ND, cdims + 1, odims);
+	md_copy_strides(ND, costrs + 1, tstrs[0]);
+	md_copy_strides(ND, cbstrs + 1, bstrs);
+
+	for (long p = 0; p < parts; p++) {
+
+		const long (*cstr[2])[ND + 1] = { (const long (*)[ND + 1])costrs, (const long (*)[ND + 1])cbstrs };
+		void* cptr[2] = { nptr[0], buf + p * osize * sizes[0] };
+
+		optimized_nop(2, 1u, ND + 1, cdims, cstr, cptr, (size_t[2]){ bsize, bsize },
+				(DL_SIZE == bsize) ? nary_addD : nary_add, NULL);
+	}
+
+	md_free(buf);
+}
+
+
+
+/**
+ * Optimized threeop wrapper for accumulating operations.
+ * Use when inputs are constants
+ *
+ * @param bsize size of the scalar type of the output
+ */
+static void optimized_threeop_acc(unsigned int D, const long dim[D], const long ostr[D], void* optr, const long istr1[D], const void* iptr1, const long istr2[D], const void* iptr2, size_t sizes[3], md_nary_fun_t too, void* data_ptr, size_t bsize)
+{
+	const long (*nstr[3])[D] = { (const long (*)[D])ostr, (const long (*)[D])istr1, (const long (*)[D])istr2 };
+	void *nptr[3] = { optr, (void*)iptr1, (void*)iptr2 };
+
+	unsigned int io = 1 + ((iptr1 == optr) ? 2 : 0) + ((iptr2 == optr) ? 4 : 0);
+
+	// inputs aliasing the output cannot be split
+
+	if (1 != io)
+		optimized_nop(3, io, D, dim, nstr, nptr, sizes, too, data_ptr);
+	else
+		optimized_reduce_nop(3, io, D, dim, nstr, nptr, sizes, too, data_ptr, bsize);
+}
+
+
+
 /* HELPER FUNCTIONS
  *
  * The following functions, typedefs, and macros are used internally in flpmath.c
@@ -362,6 +533,12 @@ static void make_z3op(size_t offset, unsigned int D, const long dim[D], const lo
 				(size_t[3]){ [0 ... 2] = CFL_SIZE }, nary_z3op, &offset);
 }
 
+static void make_z3op_acc(size_t offset, unsigned int D, const long dim[D], const long ostr[D], complex float* optr, const long istr1[D], const complex float* iptr1, const long istr2[D], const complex float* iptr2)
+{
+	optimized_threeop_acc(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
+			(size_t[3]){ [0 ... 2] = CFL_SIZE }, nary_z3op, &offset, FL_SIZE);
+}
+
 static void nary_3op(void* _data, void* ptr[])
 {
 	struct data_s* data = _data;
@@ -376,6 +553,12 @@ static void make_3op(size_t offset, unsigned int D, const long dim[D], const lon
 				(size_t[3]){ [0 ... 2] = FL_SIZE }, nary_3op, &offset);
 }
 
+static void make_3op_acc(size_t offset, unsigned int D, const long dim[D], const long ostr[D], float* optr, const long istr1[D], const float* iptr1, const long istr2[D], const float* iptr2)
+{
+	optimized_threeop_acc(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
+			(size_t[3]){ [0 ... 2] = FL_SIZE }, nary_3op, &offset, FL_SIZE);
+}
+
 static void nary_z3opd(void* _data, void* ptr[])
 {
 	struct data_s* data = _data;
@@ -386,8 +569,10 @@ static void nary_z3opd(void* _data, void* ptr[])
 
 static void make_z3opd(size_t offset, unsigned int D, const long dim[D], const long ostr[D], complex double* optr, const long istr1[D], const complex float* iptr1, const long istr2[D], const complex float* iptr2)
 {
-	optimized_threeop_oii(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
-			(size_t[3]){ CDL_SIZE, CFL_SIZE, CFL_SIZE }, nary_z3opd, &offset);
+	// only used for accumulation
+
+	optimized_threeop_acc(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
+			(size_t[3]){ CDL_SIZE, CFL_SIZE, CFL_SIZE }, nary_z3opd, &offset, DL_SIZE);
 }
 
 static void nary_3opd(void* _data, void* ptr[])
@@ -400,8 +585,10 @@ static void nary_3opd(void* _data, void* ptr[])
 
 static void make_3opd(size_t offset, unsigned int D, const long dim[D], const long ostr[D], double* optr, const long istr1[D], const float* iptr1, const long istr2[D], const float* iptr2)
 {
-	optimized_threeop_oii(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
-			(size_t[3]){ DL_SIZE, FL_SIZE, FL_SIZE }, nary_3opd, &offset);
+	// only used for accumulation
+
+	optimized_threeop_acc(D, dim, ostr, optr, istr1, iptr1, istr2, iptr2,
+			(size_t[3]){ DL_SIZE, FL_SIZE, FL_SIZE }, nary_3opd, &offset, DL_SIZE);
 }
 
 static void nary_z2op(void* _data, void* ptr[])
@@ -625,6 +812,8 @@ static void make_z2opf_from_real(size_t offset, unsigned int D, const long dims[
 #define MAKE_Z2OPF(fun, ...)	(TYPE_CHECK(z2opf_t, cpu_ops.fun), make_z2opf(offsetof(struct vec_ops, fun),  __VA_ARGS__))
 #define MAKE_3OPD(fun, ...)	(TYPE_CHECK(r3opd_t, cpu_ops.fun), make_3opd(offsetof(struct vec_ops, fun),  __VA_ARGS__))
 #define MAKE_Z3OPD(fun, ...)	(TYPE_CHECK(z3opd_t, cpu_ops.fun), make_z3opd(offsetof(struct vec_ops, fun),  __VA_ARGS__))
+#define MAKE_3OP_ACC(fun, ...)	(TYPE_CHECK(r3op_t, cpu_ops.fun), make_3op_acc(offsetof(struct vec_ops, fun),  __VA_ARGS__))
+#define MAKE_Z3OP_ACC(fun, ...)	(TYPE_CHECK(z3op_t, cpu_ops.fun), make_z3op_acc(offsetof(struct vec_ops, fun),  __VA_ARGS__))
 #define MAKE_Z3OP_FROM_REAL(fun, ...) \
 				(TYPE_CHECK(r3op_t, cpu_ops.fun), make_z3op_from_real(offsetof(struct vec_ops, fun), __VA_ARGS__))
 #define MAKE_Z2OPD_FROM_REAL(fun, ...) \
@@ -1206,7 +1395,7 @@ void md_zmatmul(unsigned int D, const long out_dims[D], complex float* dst, cons
  */
 void md_zfmac2(unsigned int D, const long dims[D], const long ostr[D], complex float* optr, const long istr1[D], const complex float* iptr1, const long istr2[D], const complex float* iptr2)
 {
-	MAKE_Z3OP(zfmac, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
+	MAKE_Z3OP_ACC(zfmac, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
 }
 
 
@@ -1254,7 +1443,7 @@ void md_zfmacD(unsigned int D, const long dims[D], complex double* optr, const c
  */
 void md_fmac2(unsigned int D, const long dims[D], const long ostr[D], float* optr, const long istr1[D], const float* iptr1, const long istr2[D], const float* iptr2)
 {
-	MAKE_3OP(fmac, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
+	MAKE_3OP_ACC(fmac, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
 }
 
 
@@ -1302,7 +1491,7 @@ void md_fmacD(unsigned int D, const long dims[D], double* optr, const float* ipt
  */
 void md_zfmacc2(unsigned int D, const long dims[D], const long ostr[D], complex float* optr, const long istr1[D], const complex float* iptr1, const long istr2[D], const complex float* iptr2)
 {
-	MAKE_Z3OP(zfmacc, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
+	MAKE_Z3OP_ACC(zfmacc, D, dims, ostr, optr, istr1, iptr1, istr2, iptr2);
 }
 
 
@@ -1916,6 +2105,35 @@ void md_zarg(unsigned int D, const long dims[D], complex float* optr, const comp
 }
 
 
+/*
+ * Inner product of large contiguous arrays. The number of blocks
+ * depends only on N and the partial sums are added in order, so
+ * the result does not depend on the number of threads.
+ */
+static double scalar_blocked(long N, const float* ptr1, const float* ptr2)
+{
+	long blocks = MIN(SCALAR_PAR_BLOCKS, N / SCALAR_PAR_MIN);
+	double sums[blocks];
+
+	#pragma omp parallel for
+	for (long b = 0; b < blocks; b++) {
+
+		long start = b * N / blocks;
+		long end = (b + 1) * N / blocks;
+
+		sums[b] = cpu_ops.dot(end - start, ptr1 + start, ptr2 + start);
+	}
+
+	double ret = 0.;
+
+	for (long b = 0; b < blocks; b++)
+		ret += sums[b];
+
+	return ret;
+}
+
+
+
 /**
  * Calculate inner product between two scalar arrays (with strides)
  *
@@ -1935,7 +2153,12 @@ float md_scalar2(unsigned int D, const long dim[D], const long str1[D], const fl
 			return gpu_ops.dot(md_calc_size(D, dim), ptr1, ptr2);
 		}
 #endif
-		return cpu_ops.dot(md_calc_size(D, dim), ptr1, ptr2);
+		long N = md_calc_size(D, dim);
+
+		if (!num_auto_parallelize || (N < SCALAR_PAR_MIN))
+			return cpu_ops.dot(N, ptr1, ptr2);
+
+		return scalar_blocked(N, ptr1, ptr2);
 	}
 #endif
 
@@ -60,6 +60,7 @@ void num_init(void)
 #ifdef FFTWTHREADS
 	fft_set_num_threads(p);
 #endif
+	fft_init();
 }
 
 
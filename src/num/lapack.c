@@ -16,6 +16,8 @@
 #include <math.h>
 #include <complex.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <assert.h>
 
 #ifdef USE_CUDA
@@ -48,6 +50,7 @@ extern void zgesdd(const char jobz, long M, long N, complex double A[M][N], long
 extern void cgesvd(char jobu, char jobvt, long M, long N, complex float a[M][N], long lda, float* S, complex float u[M][N], long ldu, complex float vt[M][N], long ldvt, long *info);
 extern void cgemm(const char transa, const char transb, long M, long N,  long K, const complex float* alpha, const complex float A[M][K], const long lda, const complex float B[K][N], const long ldb, const complex float* beta, complex float C[M][N], const long ldc );
 extern void csyrk(char uplo, char transa, long N, long K, const complex float *alpha, const complex float A[K][N], const long lda, const complex float *beta, const complex float C[N][N], const long ldc);
+extern void cherk(char uplo, char transa, long N, long K, float alpha, const complex float A[K][N], const long lda, float beta, complex float C[N][N], const long ldc);
 extern void cpotrf_(char uplo, const long N, complex float A[N][N], long lda, long* info);
 #else
 // FIXME: this strategy would work but needs explicit casts below
@@ -63,120 +66,330 @@ extern void zgesdd_(const char jobz[1], const long* M, const long* N, complex do
 extern void cgesvd_(const char jobu[1], const char jobvt[1], const long* M, const long* N, complex float A[*M][*N], const long* lda, float* s, complex float U[*M][*N], long* ldu, complex float VH[*M][*N], long* ldvt, complex float* work, long* lwork, float* rwork, const long* iwork, long* info);
 extern void cgemm_(const char transa[1], const char transb[1], const long* M, const long* N, const long* K, const complex float* alpha, const complex float A[*M][*K], const long* lda, const complex float B[*K][*N], const long* ldb, const complex float* beta, complex float C[*M][*N], const long* ldc );
 extern void csyrk_(const char uplo[1], const char trans[1], const long* N, const long* K, const complex float* alpha, const complex float A[*N][*K], const long* lda, const complex float* beta, const complex float C[*N][*N], const long* ldc);
+extern void cherk_(const char uplo[1], const char trans[1], const long* N, const long* K, const float* alpha, const complex float A[*N][*K], const long* lda, const float* beta, complex float C[*N][*N], const long* ldc);
 extern void cpotrf_(const char uplo[1], const long* N, complex float A[*N][*N], const long* lda, long* info);
 #endif
 
-void batch_svthresh(long M, long N, long num_blocks, float lambda, complex float* dst, const complex float* src)
-{
-	long info = 0;
+/*
+ * Per-thread workspace for batch_svthresh
+ */
+struct svthresh_work_s {
+
+	complex float* U;
+	complex float* VT;
+	float* S;
+	complex float* AA;
+
+#ifndef USE_ACML
+	long lwork;
+	complex float* work;
+	float* rwork;
+	long* iwork;
+
+	long lwork_eig;
+	complex float* work_eig;
+	float* rwork_eig;
+#endif
+};
+
 
+static void svthresh_work_init(struct svthresh_work_s* ws, long M, long N, bool gram)
+{
 	long minMN = MIN(M, N);
-	// create u, v, s
-	complex float* U = xmalloc(M * minMN * sizeof(complex float));
-	complex float* VT = xmalloc(minMN * N * sizeof(complex float));
-	float* S = xmalloc(minMN * sizeof(float));
 
+	ws->U = xmalloc(M * minMN * sizeof(complex float));
+	ws->VT = xmalloc(minMN * N * sizeof(complex float));
+	ws->S = xmalloc(minMN * sizeof(float));
+	ws->AA = xmalloc(minMN * minMN * sizeof(complex float));
 
 #ifndef USE_ACML
-	// create lrwork
-	long lwork = -1;
+	long info = 0;
+
+	ws->work = NULL;
+	ws->rwork = NULL;
+	ws->iwork = NULL;
+	ws->work_eig = NULL;
+	ws->rwork_eig = NULL;
+
 	complex float work1[1];
-	float* rwork = xmalloc(5 * N * sizeof(float));
-	long* iwork = xmalloc(8 * minMN * sizeof(long));
 
-	// get optimal block size, create work
-	// i + j * lda
-	cgesvd_("S", "S", &M, &N, (complex float (*)[N])src, &M, S, (complex float (*)[minMN])U, &M, (complex float (*)[N])VT, &minMN, work1, &lwork, rwork, iwork, &info);
+	if (!gram) {
 
-	lwork = (int)work1[0];
-	complex float* work = xmalloc(lwork * sizeof(complex float));
+		// create lrwork
+		ws->lwork = -1;
+		ws->rwork = xmalloc(5 * N * sizeof(float));
+		ws->iwork = xmalloc(8 * minMN * sizeof(long));
+
+		// get optimal block size, create work
+		// i + j * lda
+		cgesvd_("S", "S", &M, &N, (complex float (*)[N])ws->VT, &M, ws->S, (complex float (*)[minMN])ws->U, &M, (complex float (*)[N])ws->VT, &minMN, work1, &ws->lwork, ws->rwork, ws->iwork, &info);
+
+		ws->lwork = (int)work1[0];
+		ws->work = xmalloc(ws->lwork * sizeof(complex float));
+
+	} else {
+
+		ws->lwork_eig = -1;
+		ws->rwork_eig = xmalloc(MAX(1, 3 * minMN - 2) * sizeof(float));
+
+		cheev_("V", "U", &minMN, (complex float (*)[minMN])ws->AA, &minMN, ws->S, work1, &ws->lwork_eig, ws->rwork_eig, &info);
+
+		ws->lwork_eig = (int)work1[0];
+		ws->work_eig = xmalloc(ws->lwork_eig * sizeof(complex float));
+	}
+#else
+	UNUSED(gram);
 #endif
+}
 
 
-	// create AA
-	complex float* AA = xmalloc(minMN * minMN * sizeof(complex float));
+static void svthresh_work_free(struct svthresh_work_s* ws)
+{
+	free(ws->U);
+	free(ws->VT);
+	free(ws->S);
+	free(ws->AA);
+
+#ifndef USE_ACML
+	free(ws->work);
+	free(ws->iwork);
+	free(ws->rwork);
+	free(ws->work_eig);
+	free(ws->rwork_eig);
+#endif
+}
 
 
-	for (int b = 0; b < num_blocks; b++) {
+/*
+ * Singular value thresholding of one block using the SVD.
+ */
+static void svthresh_block_svd(struct svthresh_work_s* ws, long M, long N, float lambda, complex float* dst_b, complex float* src_b)
+{
+	long info = 0;
+	long minMN = MIN(M, N);
 
-		const complex float* src_b = src + b * M * N;
-		complex float* dst_b = dst + b * M * N;
+	complex float* U = ws->U;
+	complex float* VT = ws->VT;
+	float* S = ws->S;
+	complex float* AA = ws->AA;
 
-		// Compute upper bound | A^T A |_inf
-		float s_upperbound = 0;
+	// Compute upper bound | A^T A |_inf
+	float s_upperbound = 0;
 
-		if (M <= N)
+	if (M <= N)
 #ifdef USE_ACML
-			csyrk('U', 'N', M, N, &(const complex float){ 1. }, (const complex float (*)[])src_b, M, &(const complex float){ 0. }, (const complex float (*)[])AA, minMN);
+		csyrk('U', 'N', M, N, &(const complex float){ 1. }, (const complex float (*)[])src_b, M, &(const complex float){ 0. }, (const complex float (*)[])AA, minMN);
 #else
-			csyrk_("U", "N", &M, &N, &(const complex float){ 1. }, (const complex float (*)[])src_b, &M, &(const complex float){ 0. }, (const complex float (*)[])AA, &minMN);
+		csyrk_("U", "N", &M, &N, &(const complex float){ 1. }, (const complex float (*)[])src_b, &M, &(const complex float){ 0. }, (const complex float (*)[])AA, &minMN);
 #endif
-		else
+	else
 #ifdef USE_ACML
-			csyrk('U', 'T', N, M, &(const complex float){ 1. }, (const complex float(*)[])src_b, M, &(const complex float){ 0. }, (const complex float (*)[])AA, minMN);
+		csyrk('U', 'T', N, M, &(const complex float){ 1. }, (const complex float(*)[])src_b, M, &(const complex float){ 0. }, (const complex float (*)[])AA, minMN);
 #else
-			csyrk_("U", "T", &N, &M, &(const complex float){ 1. }, (const complex float(*)[])src_b, &M, &(const complex float){ 0. }, (const complex float (*)[]) AA, &minMN);
+		csyrk_("U", "T", &N, &M, &(const complex float){ 1. }, (const complex float(*)[])src_b, &M, &(const complex float){ 0. }, (const complex float (*)[]) AA, &minMN);
 #endif
 
 
 
-		// lambda_max( A ) <= max_i sum_j | a_i^T a_j |
-		for (int i = 0; i < minMN; i++)
-		{
-			float s = 0;
+	// lambda_max( A ) <= max_i sum_j | a_i^T a_j |
+	for (int i = 0; i < minMN; i++)
+	{
+		float s = 0;
 
-			for (int j = 0; j < minMN; j++)
-				s += cabsf(AA[MIN(i, j) + MAX(i, j) * minMN]);
+		for (int j = 0; j < minMN; j++)
+			s += cabsf(AA[MIN(i, j) + MAX(i, j) * minMN]);
 
-			s_upperbound = MAX(s_upperbound, s);
-		}
+		s_upperbound = MAX(s_upperbound, s);
+	}
 
-		if (s_upperbound < lambda * lambda) {
+	if (s_upperbound < lambda * lambda) {
 
-			for (int i = 0; i < M * N; i++)
-				dst_b[i] = 0.;
+		for (int i = 0; i < M * N; i++)
+			dst_b[i] = 0.;
 
-		} else {
+		return;
+	}
 
 
 #ifdef USE_ACML
-			cgesvd('S', 'S', M, N, (complex float (*)[])src_b, M, S, (complex float (*)[])U, M, (complex float (*)[])VT, minMN, &info);
+	cgesvd('S', 'S', M, N, (complex float (*)[])src_b, M, S, (complex float (*)[])U, M, (complex float (*)[])VT, minMN, &info);
 #else
-			cgesvd_("S", "S", &M, &N, (complex float (*)[])src_b, &M, S, (complex float (*)[])U, &M, (complex float (*)[]) VT, &minMN, work, &lwork, rwork, iwork, &info);
+	cgesvd_("S", "S", &M, &N, (complex float (*)[])src_b, &M, S, (complex float (*)[])U, &M, (complex float (*)[]) VT, &minMN, ws->work, &ws->lwork, ws->rwork, ws->iwork, &info);
 #endif
 
 
-			// Soft Threshold
-			for (int i = 0; i < minMN; i++ ) {
+	// Soft Threshold
+	for (int i = 0; i < minMN; i++ ) {
 
-				float s = S[i] - lambda;
+		float s = S[i] - lambda;
 
-				s = (s + fabsf(s)) / 2.;
+		s = (s + fabsf(s)) / 2.;
 
-				for ( int j = 0; j < N; j++ )
-					VT[i + j * minMN] *= s;
-			}
+		for ( int j = 0; j < N; j++ )
+			VT[i + j * minMN] *= s;
+	}
 
 #ifdef USE_ACML
-			cgemm('N', 'N', M, N, minMN, &(complex float){ 1. }, (const complex float (*)[])U, M, (const complex float (*)[])VT, minMN, &(const complex float){ 0. }, (complex float (*)[])dst_b, M);
+	cgemm('N', 'N', M, N, minMN, &(complex float){ 1. }, (const complex float (*)[])U, M, (const complex float (*)[])VT, minMN, &(const complex float){ 0. }, (complex float (*)[])dst_b, M);
 #else
-			cgemm_("N", "N", &M, &N, &minMN, &(complex float){ 1. }, (const complex float (*)[])U, &M, (const complex float (*)[])VT, &minMN, &(complex float){ 0. }, (complex float (*)[])dst_b, &M);
+	cgemm_("N", "N", &M, &N, &minMN, &(complex float){ 1. }, (const complex float (*)[])U, &M, (const complex float (*)[])VT, &minMN, &(complex float){ 0. }, (complex float (*)[])dst_b, &M);
 #endif
+}
 
-		}
+
+/*
+ * Singular value thresholding of one block using the eigendecomposition
+ * of the small Gram matrix G = A A^H (or A^H A) = W S^2 W^H:
+ *
+ * A -> W f(S) W^H A	with f(s) = max(s - lambda, 0) / s
+ *
+ * This is much cheaper than the SVD for tall or wide blocks, but
+ * singular values below sqrt(eps) * s_max are not accurate.
+ */
+static void svthresh_block_gram(struct svthresh_work_s* ws, long M, long N, float lambda, complex float* dst_b, const complex float* src_b)
+{
+	long info = 0;
+	long K = MIN(M, N);
+
+	complex float* W = ws->AA;
+	float* S = ws->S;
+
+#ifdef USE_ACML
+	if (M <= N)
+		cherk('U', 'N', M, N, 1., (complex float (*)[])src_b, M, 0., (complex float (*)[])W, K);
+	else
+		cherk('U', 'C', N, M, 1., (complex float (*)[])src_b, M, 0., (complex float (*)[])W, K);
+#else
+	if (M <= N)
+		cherk_("U", "N", &M, &N, &(float){ 1. }, (const complex float (*)[])src_b, &M, &(float){ 0. }, (complex float (*)[])W, &K);
+	else
+		cherk_("U", "C", &N, &M, &(float){ 1. }, (const complex float (*)[])src_b, &M, &(float){ 0. }, (complex float (*)[])W, &K);
+#endif
+
+	// lambda_max( G ) <= max_i sum_j | g_ij |
+	float s_upperbound = 0;
+
+	for (int i = 0; i < K; i++) {
+
+		float s = 0;
+
+		for (int j = 0; j < K; j++)
+			s += cabsf(W[MIN(i, j) + MAX(i, j) * K]);
+
+		s_upperbound = MAX(s_upperbound, s);
 	}
 
-	free(U);
-	free(VT);
-	free(S);
-	free(AA);
+	if (s_upperbound < lambda * lambda) {
 
-#ifndef USE_ACML
+		for (int i = 0; i < M * N; i++)
+			dst_b[i] = 0.;
 
-	free(work);
-	free(iwork);
-	free(rwork);
+		return;
+	}
+
+#ifdef USE_ACML
+	cheev('V', 'U', K, (complex float (*)[])W, K, S, &info);
+#else
+	cheev_("V", "U", &K, (complex float (*)[])W, &K, S, ws->work_eig, &ws->lwork_eig, ws->rwork_eig, &info);
+#endif
+
+	if (0 != info)
+		error("cheev failed\n");
+
+	for (int i = 0; i < K; i++) {
+
+		float s = sqrtf(MAX(S[i], 0.));
+
+		S[i] = (s > lambda) ? ((s - lambda) / s) : 0.;
+	}
+
+	if (M <= N) {
+
+		// B = W^H A, scale rows, W B
+
+		complex float* B = ws->VT;
+
+#ifdef USE_ACML
+		cgemm('C', 'N', K, N, M, &(complex float){ 1. }, (const complex float (*)[])W, K, (const complex float (*)[])src_b, M, &(complex float){ 0. }, (complex float (*)[])B, K);
+#else
+		cgemm_("C", "N", &K, &N, &M, &(complex float){ 1. }, (const complex float (*)[])W, &K, (const complex float (*)[])src_b, &M, &(complex float){ 0. }, (complex float (*)[])B, &K);
+#endif
+		for (int j = 0; j < N; j++)
+			for (int i = 0; i < K; i++)
+				B[i + j * K] *= S[i];
+
+#ifdef USE_ACML
+		cgemm('N', 'N', M, N, K, &(complex float){ 1. }, (const complex float (*)[])W, K, (const complex float (*)[])B, K, &(complex float){ 0. }, (complex float (*)[])dst_b, M);
+#else
+		cgemm_("N", "N", &M, &N, &K, &(complex float){ 1. }, (const complex float (*)[])W, &K, (const complex float (*)[])B, &K, &(complex float){ 0. }, (complex float (*)[])dst_b, &M);
 #endif
+
+	} else {
+
+		// C = A W, scale columns, C W^H
+
+		complex float* C = ws->U;
+
+#ifdef USE_ACML
+		cgemm('N', 'N', M, N, N, &(complex float){ 1. }, (const complex float (*)[])src_b, M, (const complex float (*)[])W, K, &(complex float){ 0. }, (complex float (*)[])C, M);
+#else
+		cgemm_("N", "N", &M, &N, &N, &(complex float){ 1. }, (const complex float (*)[])src_b, &M, (const complex float (*)[])W, &K, &(complex float){ 0. }, (complex float (*)[])C, &M);
+#endif
+		for (int i = 0; i < N; i++)
+			for (int j = 0; j < M; j++)
+				C[j + i * M] *= S[i];
+
+#ifdef USE_ACML
+		cgemm('N', 'C', M, N, N, &(complex float){ 1. }, (const complex float (*)[])C, M, (const complex float (*)[])W, K, &(complex float){ 0. }, (complex float (*)[])dst_b, M);
+#else
+		cgemm_("N", "C", &M, &N, &N, &(complex float){ 1. }, (const complex float (*)[])C, &M, (const complex float (*)[])W, &K, &(complex float){ 0. }, (complex float (*)[])dst_b, &M);
+#endif
+	}
+}
+
+
+/*
+ * Singular value thresholding of num_blocks M x N blocks. The blocks
+ * are processed in parallel, each thread has its own workspace.
+ * The SVD destroys the input.
+ *
+ * SVT_GRAM computes the SVD from the eigendecomposition of the Gram
+ * matrix, which is faster for tall or wide blocks but squares the
+ * condition number, so small singular values are less accurate.
+ * SVT_AUTO uses it if one side is at least four times the other.
+ */
+void batch_svthresh2(long M, long N, long num_blocks, float lambda, complex float* dst, complex float* src, enum svthresh_alg alg)
+{
+	if (SVT_AUTO == alg)
+		alg = (MAX(M, N) >= 4 * MIN(M, N)) ? SVT_GRAM : SVT_SVD;
+
+	bool gram = (SVT_GRAM == alg);
+
+	#pragma omp parallel
+	{
+		struct svthresh_work_s ws;
+		svthresh_work_init(&ws, M, N, gram);
+
+		#pragma omp for schedule(dynamic, 16)
+		for (long b = 0; b < num_blocks; b++) {
+
+			complex float* src_b = src + b * M * N;
+			complex float* dst_b = dst + b * M * N;
+
+			if (gram)
+				svthresh_block_gram(&ws, M, N, lambda, dst_b, src_b);
+			else
+				svthresh_block_svd(&ws, M, N, lambda, dst_b, src_b);
+		}
+
+		svthresh_work_free(&ws);
+	}
+}
+
+
+void batch_svthresh(long M, long N, long num_blocks, float lambda, complex float* dst, const complex float* src)
+{
+	batch_svthresh2(M, N, num_blocks, lambda, dst, (complex float*)src, SVT_SVD);
 }
 
 
@@ -22,7 +22,10 @@ extern void lapack_svd_double(long M, long N, complex double U[M][M], complex do
 extern void lapack_matrix_multiply(long M, long N, long K, complex float C[M][N], const complex float A[M][K], const complex float B[K][N]);
 extern void cgemm_sameplace(const char transa, const char transb, long M, long N, long K, const complex float* alpha, const complex float A[M][K], const long lda, const complex float B[K][N], const long ldb, const complex float* beta, complex float C[M][N], const long ldc);
 
+enum svthresh_alg { SVT_AUTO, SVT_SVD, SVT_GRAM };
+
 extern void batch_svthresh(long M, long N, long num_blocks, float lambda, complex float* dst, const complex float* src);
+extern void batch_svthresh2(long M, long N, long num_blocks, float lambda, complex float* dst, complex float* src, enum svthresh_alg alg);
 
 extern void lapack_cholesky(long N, complex float A[N][N]);
 
@@ -72,7 +72,8 @@ void md_nary(unsigned int C, unsigned int D, const long dim[D], const long* str[
  * Generic functions which loops over all dimensions of a set of
  * multi-dimensional arrays and calls a given function for each position.
  * This functions tries to parallelize over the dimensions indicated
- * with flags.
+ * with flags. All of them are collapsed into a single parallel loop,
+ * so that only one parallel region is opened.
  */
 void md_parallel_nary(unsigned int C, unsigned int D, const long dim[D], unsigned int flags, const long* str[C], void* ptr[C], void* data, md_nary_fun_t fun)
 {
@@ -82,27 +83,43 @@ void md_parallel_nary(unsigned int C, unsigned int D, const long dim[D], unsigne
 		return;
 	}
 
-	int b = ffs(flags & -flags) - 1;
-	assert(MD_IS_SET(flags, b));
+	long dimc[D];
+	md_select_dims(D, ~flags, dimc, dim);
 
-	flags = MD_CLEAR(flags, b);
+	unsigned int P = 0;
+	unsigned int pdims[D];
 
-	long dimc[D];
-	md_select_dims(D, ~MD_BIT(b), dimc, dim);
+	for (unsigned int i = 0; i < D; i++)
+		if (MD_IS_SET(flags, i))
+			pdims[P++] = i;
+
+	long total = 1;
 
-	debug_printf(DP_DEBUG4, "Parallelize: %d\n", dim[b]);
+	for (unsigned int p = 0; p < P; p++)
+		total *= dim[pdims[p]];
 
-	// FIXME: this probably doesn't nest
-	// (maybe collect all parallelizable dims into one giant loop?)
-	#pragma omp parallel for
-	for (long i = 0; i < dim[b]; i++) {
+	debug_printf(DP_DEBUG4, "Parallelize: %ld\n", total);
+
+	#pragma omp parallel for schedule(static)
+	for (long i = 0; i < total; i++) {
 
 		void* moving_ptr[C];
 
 		for (unsigned int j = 0; j < C; j++)
-			moving_ptr[j] = ptr[j] + i * str[j][b];
+			moving_ptr[j] = ptr[j];
+
+		long r = i;
+
+		for (unsigned int p = 0; p < P; p++) {
+
+			long k = r % dim[pdims[p]];
+			r /= dim[pdims[p]];
 
-		md_parallel_nary(C, D, dimc, flags, str, moving_ptr, data, fun);
+			for (unsigned int j = 0; j < C; j++)
+				moving_ptr[j] += k * str[j][pdims[p]];
+		}
+
+		md_nary(C, D, dimc, str, moving_ptr, data, fun);
 	}
 }
 
@@ -535,6 +552,40 @@ static void nary_strided_copy(void* _data, void* ptr[])
 }
 #endif
 
+/*
+ * Copy along the innermost dimension on the CPU. Small element sizes
+ * are handled separately so that the compiler can inline the copy.
+ */
+static void nary_strided_copy_cpu(void* _data, void* ptr[])
+{
+	struct strided_copy_s* data = _data;
+
+	char* dst = ptr[0];
+	const char* src = ptr[1];
+
+	switch (data->sizes[0]) {
+
+	case 4:
+		for (long i = 0; i < data->sizes[1]; i++)
+			memcpy(dst + i * data->ostr, src + i * data->istr, 4);
+		break;
+
+	case 8:
+		for (long i = 0; i < data->sizes[1]; i++)
+			memcpy(dst + i * data->ostr, src + i * data->istr, 8);
+		break;
+
+	case 16:
+		for (long i = 0; i < data->sizes[1]; i++)
+			memcpy(dst + i * data->ostr, src + i * data->istr, 16);
+		break;
+
+	default:
+		for (long i = 0; i < data->sizes[1]; i++)
+			memcpy(dst + i * data->ostr, src + i * data->istr, data->sizes[0]);
+	}
+}
+
 static void nary_copy(void* _data, void* ptr[])
 {
 	struct data_s* data = (struct data_s*)_data;
@@ -608,6 +659,23 @@ void md_copy2(unsigned int D, const long dim[D], const long ostr[D], void* optr,
 	struct data_s data = { md_calc_size(skip, tdims) * size };
 #endif
 
+#ifdef  USE_CUDA
+	if (!data.use_gpu && (skip < ND)) {
+#else
+	if (skip < ND) {
+#endif
+		// avoid a function call for each (small) block
+
+		struct strided_copy_s data2 = { { md_calc_size(skip, tdims) * size, tdims[skip] }, (*nstr2[0])[skip], (*nstr2[1])[skip] };
+
+		skip++;
+
+		const long* nstr3[2] = { *nstr2[0] + skip, *nstr2[1] + skip };
+
+		md_nary(2, ND - skip, tdims + skip, nstr3, nptr, (void*)&data2, &nary_strided_copy_cpu);
+		return;
+	}
+
 	md_nary(2, ND - skip, tdims + skip, nstr, nptr, (void*)&data, &nary_copy);
 }
 
@@ -1053,7 +1121,7 @@ void md_transpose(unsigned int D, unsigned int dim1, unsigned int dim2, const lo
 {
 	md_transpose2(D, dim1, dim2,
 			odims, MD_STRIDES(D, odims, size), optr,
-			idims, MD_STRIDES(D, odims, size), iptr, size);
+			idims, MD_STRIDES(D, idims, size), iptr, size);
 }
 
 
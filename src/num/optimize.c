@@ -10,10 +10,12 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <math.h>
 
 #include <stdio.h>
@@ -267,6 +269,372 @@ static bool split_dims(unsigned int D, unsigned int N, long dims[N + 1], long (*
 }
 
 
+/*
+ * Cache blocking
+ *
+ * Operations which access arguments along different dimensions
+ * (e.g. transpose) are split into tiles which fit into the cache.
+ * The cache budget is taken from BART_BLOCK_KB, from the result of
+ * a previous tuning run (stored per machine in the home directory),
+ * or is a quarter of the L2 cache size reported by the kernel.
+ */
+
+static long block_size = 0;
+
+/**
+ * set cache budget for blocking in bytes,
+ * 0 restores the default, negative values disable blocking
+ */
+void num_set_block_size(long bytes)
+{
+	#pragma omp atomic write
+	block_size = (0 == bytes) ? 0 : MAX(-1, bytes);
+}
+
+
+/**
+ * size of data or unified cache of given level in bytes (Linux only),
+ * returns 0 if unknown
+ */
+long num_cache_size(unsigned int level)
+{
+	long ret = 0;
+
+	for (int i = 0; i < 8; i++) {
+
+		char path[128];
+		char type[32] = "";
+		unsigned int lvl;
+		long size;
+		char unit;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+
+		FILE* fp = fopen(path, "r");
+
+		if (NULL == fp)
+			break;
+
+		bool ok = (1 == fscanf(fp, "%u", &lvl));
+		fclose(fp);
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+
+		if (ok && (NULL != (fp = fopen(path, "r")))) {
+
+			ok = (1 == fscanf(fp, "%31s", type));
+			fclose(fp);
+		}
+
+		if (!ok || (lvl != level) || (0 == strcmp(type, "Instruction")))
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+
+		if (NULL != (fp = fopen(path, "r"))) {
+
+			int n = fscanf(fp, "%ld%c", &size, &unit);
+			fclose(fp);
+
+			if (n < 1)
+				continue;
+
+			if ((2 == n) && ('K' == unit))
+				size *= 1024;
+
+			if ((2 == n) && ('M' == unit))
+				size *= 1024 * 1024;
+
+			ret = size;
+		}
+	}
+
+	return ret;
+}
+
+
+static char* block_size_file(void)
+{
+	const char* home = getenv("HOME");
+
+	if (NULL == home)
+		return NULL;
+
+	char host[256];
+
+	if (0 != gethostname(host, sizeof(host)))
+		strcpy(host, "localhost");
+
+	host[sizeof(host) - 1] = '\0';
+
+	char* path = xmalloc(strlen(home) + strlen(host) + 32);
+	sprintf(path, "%s/.bart-blocking-%s", home, host);
+
+	return path;
+}
+
+
+static long get_block_size(void)
+{
+	long ret;
+
+	#pragma omp atomic read
+	ret = block_size;
+
+	if (0 != ret)
+		return ret;
+
+	const char* str = getenv("BART_BLOCK_KB");
+
+	if (NULL != str)
+		ret = atol(str) * 1024;
+
+	char* file = block_size_file();
+
+	if ((0 == ret) && (NULL != file)) {
+
+		FILE* fp = fopen(file, "r");
+
+		if (NULL != fp) {
+
+			if (1 != fscanf(fp, "%ld", &ret))
+				ret = 0;
+
+			fclose(fp);
+		}
+	}
+
+	free(file);
+
+	if (0 == ret)
+		ret = num_cache_size(2) / 4;
+
+	if (0 == ret)
+		ret = 128 * 1024;
+
+	num_set_block_size(ret);
+
+	return ret;
+}
+
+
+/**
+ * Try different cache budgets on a transpose and store the
+ * fastest in a file specific to this machine.
+ */
+void num_tune_blocking(void)
+{
+	long l1 = num_cache_size(1);
+	long l2 = num_cache_size(2);
+
+	if (0 == l1)
+		l1 = 32 * 1024;
+
+	if (0 == l2)
+		l2 = 8 * l1;
+
+	long cand[] = { l1 / 4, l1 / 2, l1, 2 * l1, l2 / 4, l2 / 2, l2 };
+
+	long dims[2] = { 1536, 1536 };
+	long istrs[2] = { 8, 8 * dims[0] };
+	long ostrs[2] = { 8 * dims[1], 8 };
+
+	void* x = md_alloc(2, dims, 8);
+	void* y = md_alloc(2, dims, 8);
+
+	md_clear(2, dims, x, 8);
+
+	long best = l1;
+	double best_time = -1.;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(cand); i++) {
+
+		num_set_block_size(cand[i]);
+
+		double min = -1.;
+
+		for (int r = 0; r < 3; r++) {
+
+			double tic = timestamp();
+
+			md_copy2(2, dims, ostrs, y, istrs, x, 8);
+
+			double t = timestamp() - tic;
+
+			if ((min < 0.) || (t < min))
+				min = t;
+		}
+
+		debug_printf(DP_INFO, "Blocking %7ld bytes: %f s\n", cand[i], min);
+
+		if ((best_time < 0.) || (min < best_time)) {
+
+			best_time = min;
+			best = cand[i];
+		}
+	}
+
+	md_free(x);
+	md_free(y);
+
+	num_set_block_size(best);
+
+	char* file = block_size_file();
+
+	FILE* fp = (NULL != file) ? fopen(file, "w") : NULL;
+
+	if (NULL != fp) {
+
+		fprintf(fp, "%ld\n", best);
+		fclose(fp);
+
+		debug_printf(DP_INFO, "Blocking %ld bytes saved to %s\n", best, file);
+
+	} else {
+
+		debug_printf(DP_WARN, "Could not save blocking parameters.\n");
+	}
+
+	free(file);
+}
+
+
+static long largest_divisor(long n, long max)
+{
+	for (long b = MIN(n, max); b > 1; b--)
+		if (0 == n % b)
+			return b;
+
+	return 1;
+}
+
+
+/*
+ * If arguments have different fastest dimensions, tile these
+ * dimensions so that one tile of all arguments fits into the cache
+ * budget, and loop over tiles in the outer dimensions. Returns
+ * false if no blocking is done.
+ */
+static bool cache_blocking(unsigned int D, unsigned int N, unsigned int* pND, long dims[N], long (*strs[D])[N])
+{
+	long budget = get_block_size();
+
+	if (budget <= 0)
+		return false;
+
+	unsigned int ND = *pND;
+	unsigned int inner = 0;
+	long bytes = 0;
+
+	for (unsigned int j = 0; j < D; j++) {
+
+		int f = -1;
+
+		for (unsigned int i = 0; i < ND; i++)
+			if ((0 != (*strs[j])[i]) && ((-1 == f) || (labs((*strs[j])[i]) < labs((*strs[j])[f]))))
+				f = i;
+
+		if (-1 == f)
+			continue;
+
+		bytes += labs((*strs[j])[f]);
+
+		// ignore dimensions which other arguments do not
+		// move along (e.g. reductions or broadcasting)
+
+		bool all = true;
+
+		for (unsigned int k = 0; k < D; k++)
+			all &= (0 != (*strs[k])[f]);
+
+		if (all)
+			inner = MD_SET(inner, f);
+	}
+
+	if ((bitcount(inner) < 2) || (md_calc_size(ND, dims) * bytes <= budget))
+		return false;
+
+	// tile sizes: distribute budget starting with the smallest dimension
+
+	unsigned int ord[N];
+	compute_permutation(ND, ord, dims);
+
+	long elems = MAX(1, budget / bytes);
+	unsigned int m = bitcount(inner);
+	unsigned int tiles = 0;
+
+	// new dimensions are appended, so only visit the original ones
+
+	unsigned int ND0 = ND;
+
+	for (unsigned int k = 0, l = 0; k < ND0; k++) {
+
+		unsigned int i = ord[k];
+
+		if (!MD_IS_SET(inner, i))
+			continue;
+
+		long b = largest_divisor(dims[i], (long)pow((double)elems, 1. / (m - l++)));
+
+		elems = MAX(1, elems / b);
+
+		if (1 == b)
+			continue;
+
+		tiles = MD_SET(tiles, i);
+
+		if ((b == dims[i]) || (ND == N))
+			continue;
+
+		dims[ND] = dims[i] / b;
+		dims[i] = b;
+
+		for (unsigned int j = 0; j < D; j++)
+			(*strs[j])[ND] = (*strs[j])[i] * b;
+
+		ND++;
+	}
+
+	// loop over tiles first, each group ordered by stride
+
+	long max_strides[ND];
+
+	for (unsigned int i = 0; i < ND; i++) {
+
+		max_strides[i] = 0;
+
+		for (unsigned int j = 0; j < D; j++)
+			max_strides[i] = MAX(max_strides[i], labs((*strs[j])[i]));
+	}
+
+	compute_permutation(ND, ord, max_strides);
+
+	unsigned int ord2[ND];
+	unsigned int o = 0;
+
+	for (unsigned int k = 0; k < ND; k++)
+		if (MD_IS_SET(tiles, ord[k]))
+			ord2[o++] = ord[k];
+
+	for (unsigned int k = 0; k < ND; k++)
+		if (!MD_IS_SET(tiles, ord[k]))
+			ord2[o++] = ord[k];
+
+	for (unsigned int j = 0; j < D; j++)
+		reorder_long(ND, ord2, *strs[j]);
+
+	reorder_long(ND, ord2, dims);
+
+	debug_printf(DP_DEBUG4, "Blocking: ");
+	debug_print_dims(DP_DEBUG4, ND, dims);
+
+	*pND = ND;
+
+	return true;
+}
+
+
+
 unsigned int optimize_dims(unsigned int D, unsigned int N, long dims[N], long (*strs[D])[N])
 {
 	merge_dims(D, N, dims, strs);
@@ -285,6 +653,9 @@ unsigned int optimize_dims(unsigned int D, unsigned int N, long dims[N], long (*
 
 	debug_print_dims(DP_DEBUG4, ND, dims);
 
+	if (cache_blocking(D, N, &ND, dims, strs))
+		return ND;
+
 	float blocking[N];
 #ifdef BERKELEY_SVN
 	// actually those are not the blocking factors
@@ -449,35 +820,73 @@ static unsigned int parallelizable(unsigned int D, unsigned int io, unsigned int
 #define CHUNK (32 * 1024)
 #define CORES (64)
 
+// default minimal amount of memory accessed by a parallel task
+#define TASK_KB 256
+
+
+static long task_size = 0;
+
+/**
+ * set minimal number of bytes accessed by each parallel task,
+ * 0 restores the default (BART_TASK_KB or 256 KB)
+ */
+void num_set_task_size(long bytes)
+{
+	#pragma omp atomic write
+	task_size = MAX(0, bytes);
+}
+
+static long get_task_size(void)
+{
+	long ret;
+
+	#pragma omp atomic read
+	ret = task_size;
+
+	if (0 == ret) {
+
+		const char* str = getenv("BART_TASK_KB");
+
+		ret = (((NULL != str) && (0 < atol(str))) ? atol(str) : TASK_KB) * 1024;
+
+		num_set_task_size(ret);
+	}
+
+	return ret;
+}
+
 
 /**
  * compute set of dimensions to parallelize
  *
+ * Starting with the outermost dimension, parallelizable dimensions
+ * are selected as long as each task, i.e. each position in the
+ * selected dimensions, still accesses at least the task size.
  */
 unsigned int dims_parallel(unsigned int D, unsigned int io, unsigned int N, const long dims[N], long (*strs[D])[N], size_t size[D])
 {
 	unsigned int flags = parallelizable(D, io, N, dims, strs, size);
 
-	unsigned int i = D;
-	unsigned int count = 1;
+	long bytes = 0;
+
+	for (unsigned int j = 0; j < D; j++)
+		bytes += size[j];
 
+	long tsize = get_task_size();
 	long reps = md_calc_size(N, dims);
 
 	unsigned int oflags = 0;
 
-	while ((count < CORES) && (i-- > 0)) {
-
-		if (MD_IS_SET(flags, i)) {
+	for (int i = N - 1; i >= 0; i--) {
 
-			reps /= dims[i];
+		if (!MD_IS_SET(flags, i))
+			continue;
 
-			if (reps < CHUNK)
-				break;
-
-			oflags = MD_SET(oflags, i);
+		if ((reps / dims[i]) * bytes < tsize)
+			break;
 
-			//break; // only 1
-		}
+		reps /= dims[i];
+		oflags = MD_SET(oflags, i);
 	}
 
 	return oflags;
@@ -485,5 +894,54 @@ unsigned int dims_parallel(unsigned int D, unsigned int io, unsigned int N, cons
 
 
 
+/**
+ * compute dimension along which a reduction is split into
+ * independent partial sums and the number of parts
+ *
+ * The output (with strides ostrs) has to be constant along the
+ * reduced dimension and must not overlap itself otherwise.
+ * The partition only depends on the dimensions, so that partial
+ * sums can be combined in a fixed order.
+ */
+int dims_reduction(unsigned int N, long* parts, const long dims[N], const long ostrs[N], size_t osize)
+{
+	int r = -1;
+
+	for (unsigned int i = 0; i < N; i++)
+		if ((0 == ostrs[i]) && (1 < dims[i]) && ((-1 == r) || (dims[i] > dims[r])))
+			r = i;
+
+	if (-1 == r)
+		return -1;
+
+	bool m[N][N];
+	compute_enclosures(N, m, dims, ostrs);
+
+	long osz = 1;
+
+	for (unsigned int i = 0; i < N; i++) {
+
+		if ((0 == ostrs[i]) || (1 == dims[i]))
+			continue;
+
+		if ((size_t)labs(ostrs[i]) < osize)
+			return -1;
+
+		for (unsigned int j = 0; j < N; j++)
+			if ((i != j) && (0 != ostrs[j]) && (1 < dims[j]) && !(m[i][j] || m[j][i]))
+				return -1;
+
+		osz *= dims[i];
+	}
+
+	long total = md_calc_size(N, dims);
+
+	*parts = MIN(dims[r], MIN(CORES, total / CHUNK));
 
+	// partial sums should be small compared to the input
 
+	if ((*parts < 2) || (osz * *parts > total))
+		return -1;
+
+	return r;
+}
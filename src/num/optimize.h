@@ -13,6 +13,9 @@ extern void merge_dims(unsigned int D, unsigned int N, long dims[N], long (*ostr
 extern unsigned int remove_empty_dims(unsigned int D, unsigned int N, long dims[N], long (*ostrs[D])[N]);
 extern unsigned int optimize_dims(unsigned int D, unsigned int N, long dims[N], long (*strs[D])[N]);
 extern unsigned int min_blockdim(unsigned int D, unsigned int N, const long dims[N], long (*strs[D])[N], size_t size[D]);
+extern void num_set_task_size(long bytes);
+extern void num_set_block_size(long bytes);
+extern long num_cache_size(unsigned int level);
+extern void num_tune_blocking(void);
 extern unsigned int dims_parallel(unsigned int D, unsigned int io, unsigned int N, const long dims[N], long (*strs[D])[N], size_t size[D]);
-
-
+extern int dims_reduction(unsigned int N, long* parts, const long dims[N], const long ostrs[N], size_t osize);
@@ -1,19 +1,34 @@
 /* Copyright 2013. The Regents of the University of California.
- * All rights reserved. Use of this source code is governed by 
+ * All rights reserved. Use of this source code is governed by
  * a BSD-style license which can be found in the LICENSE file.
  *
  * Authors:
  * 2013 Martin Uecker <uecker@eecs.berkeley.edu>
  * 2013 Dara Bahri <dbahri123@gmail.com>
+ *
+ *
+ * Random numbers are generated with the counter-based generator
+ * Philox4x32-10: each value is a function of the seed and its
+ * position in one global stream, so arrays can be filled in parallel
+ * and the result does not depend on the number of threads. Every
+ * call reserves a new part of the stream.
+ *
+ * Salmon JK, Moraes MA, Dror RO, Shaw DE. Parallel random numbers:
+ * as easy as 1, 2, 3. Proceedings of SC11; 2011.
  */
 
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdbool.h>
 #include <math.h>
 #include <complex.h>
 
 #include "num/multind.h"
 
+#include "misc/misc.h"
+
 #ifdef USE_CUDA
 #include "num/gpuops.h"
 #endif
@@ -22,24 +37,147 @@
 
 unsigned int num_rand_seed = 123;
 
+// position in the stream (in blocks of four 32-bit words)
+static uint64_t num_rand_ctr = 0;
+
+// block size (in floats) for parallel generation
+#define RAND_BLK 4096L
+
 
 void num_rand_init(unsigned int seed)
 {
-	num_rand_seed = seed;
+	#pragma omp critical
+	{
+		num_rand_seed = seed;
+		num_rand_ctr = 0;
+	}
 }
 
 
-double uniform_rand(void)
+static uint64_t rand_reserve(uint64_t blocks)
 {
-	double ret;
+	uint64_t ret;
 
-	#pragma omp critical
-	ret = rand_r(&num_rand_seed) / (double)RAND_MAX;
+	#pragma omp atomic capture
+	{ ret = num_rand_ctr; num_rand_ctr += blocks; }
 
 	return ret;
 }
 
 
+static inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t* hi)
+{
+	uint64_t p = (uint64_t)a * (uint64_t)b;
+
+	*hi = (uint32_t)(p >> 32);
+
+	return (uint32_t)p;
+}
+
+
+/*
+ * Philox4x32 with 10 rounds. The counter is the position in
+ * the stream, the key is the seed.
+ */
+static inline void philox4x32(uint32_t out[4], uint64_t ctr, uint32_t seed)
+{
+	uint32_t c0 = (uint32_t)ctr;
+	uint32_t c1 = (uint32_t)(ctr >> 32);
+	uint32_t c2 = 0;
+	uint32_t c3 = 0;
+
+	uint32_t k0 = seed;
+	uint32_t k1 = 0;
+
+	for (int r = 0; r < 10; r++) {
+
+		uint32_t hi0, hi1;
+		uint32_t lo0 = mulhilo(0xD2511F53, c0, &hi0);
+		uint32_t lo1 = mulhilo(0xCD9E8D57, c2, &hi1);
+
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+
+// uniform in (0, 1]
+static inline float u32_to_float(uint32_t x)
+{
+	return ((x >> 8) + 1) * (1.f / 16777216.f);
+}
+
+
+/*
+ * Fill N floats, starting at position ctr of the stream (in
+ * floats), with uniform or standard normal random numbers.
+ * Normal numbers are computed from pairs with Box-Muller.
+ */
+static void rand_block(long N, float* dst, uint64_t ctr, unsigned int seed, bool normal)
+{
+	assert(0 == ctr % 4);
+	assert(N <= RAND_BLK);
+
+	long N4 = 4 * ((N + 3) / 4);
+
+	uint32_t x[RAND_BLK];
+	float u[RAND_BLK];
+
+	for (long i = 0; i < N4; i += 4)
+		philox4x32(x + i, (ctr + i) / 4, seed);
+
+	#pragma omp simd
+	for (long i = 0; i < N4; i++)
+		u[i] = u32_to_float(x[i]);
+
+	if (normal) {
+
+		#pragma omp simd
+		for (long i = 0; i < N4; i += 2) {
+
+			float r = sqrtf(-2.f * logf(u[i + 0]));
+			float p = 2.f * (float)M_PI * u[i + 1];
+
+			u[i + 0] = r * cosf(p);
+			u[i + 1] = r * sinf(p);
+		}
+	}
+
+	for (long i = 0; i < N; i++)
+		dst[i] = u[i];
+}
+
+
+static void rand_fill(long N, float* dst, bool normal)
+{
+	uint64_t start = 4 * rand_reserve((N + 3) / 4);
+	unsigned int seed = num_rand_seed;
+
+	#pragma omp parallel for if (N > RAND_BLK)
+	for (long i = 0; i < N; i += RAND_BLK)
+		rand_block(MIN(RAND_BLK, N - i), dst + i, start + i, seed, normal);
+}
+
+
+double uniform_rand(void)
+{
+	uint32_t x[4];
+	philox4x32(x, rand_reserve(1), num_rand_seed);
+
+	return ((x[0] >> 5) * 67108864. + (x[1] >> 6)) / 9007199254740992.;
+}
+
+
 /**
  * Box-Muller
  */
@@ -48,12 +186,12 @@ complex double gaussian_rand(void)
 	double u1, u2, s;
 
  	do {
-	
+
 		u1 = 2. * uniform_rand() - 1.;
 		u2 = 2. * uniform_rand() - 1.;
    		s = u1 * u1 + u2 * u2;
 
-   	} while (s > 1.);
+   	} while ((s > 1.) || (0. == s));
 
 	double re = sqrt(-2. * log(s) / s) * u1;
 	double im = sqrt(-2. * log(s) / s) * u2;
@@ -61,20 +199,63 @@ complex double gaussian_rand(void)
 	return re + 1.i * im;
 }
 
-void md_gaussian_rand(unsigned int D, const long dims[D], complex float* dst)
+
+
+static void md_rand(unsigned int D, const long dims[D], complex float* dst, bool normal, bool real)
 {
 #ifdef  USE_CUDA
 	if (cuda_ondevice(dst)) {
-	
+
 		complex float* tmp = md_alloc(D, dims, sizeof(complex float));
-		md_gaussian_rand(D, dims, tmp);
+		md_rand(D, dims, tmp, normal, real);
 		md_copy(D, dims, dst, tmp, sizeof(complex float));
 		md_free(tmp);
 		return;
 	}
 #endif
-//#pragma omp parallel for
-	for (long i = 0; i < md_calc_size(D, dims); i++)
-		dst[i] = (float)gaussian_rand();
+	long N = md_calc_size(D, dims);
+
+	if (!real) {
+
+		rand_fill(2 * N, (float*)dst, normal);
+		return;
+	}
+
+	// real values: generate into the second half
+	// and spread them out (front to back)
+
+	float* tmp = (float*)dst + N;
+
+	rand_fill(N, tmp, normal);
+
+	for (long i = 0; i < N; i++)
+		dst[i] = tmp[i];
+}
+
+
+/**
+ * Real-valued standard normal random numbers.
+ */
+void md_gaussian_rand(unsigned int D, const long dims[D], complex float* dst)
+{
+	md_rand(D, dims, dst, true, true);
 }
 
+
+/**
+ * Complex random numbers, real and imaginary part
+ * are standard normal (as gaussian_rand).
+ */
+void md_zgaussian_rand(unsigned int D, const long dims[D], complex float* dst)
+{
+	md_rand(D, dims, dst, true, false);
+}
+
+
+/**
+ * Real-valued random numbers uniform in (0, 1].
+ */
+void md_uniform_rand(unsigned int D, const long dims[D], complex float* dst)
+{
+	md_rand(D, dims, dst, false, true);
+}
@@ -8,6 +8,8 @@
 extern double uniform_rand(void);
 extern _Complex double gaussian_rand(void);
 extern void md_gaussian_rand(unsigned int D, const long dims[__VLA(D)], _Complex float* dst);
+extern void md_zgaussian_rand(unsigned int D, const long dims[__VLA(D)], _Complex float* dst);
+extern void md_uniform_rand(unsigned int D, const long dims[__VLA(D)], _Complex float* dst);
 
 extern void num_rand_init(unsigned int seed);
 
@@ -45,7 +45,12 @@ void md_shuffle(unsigned int N, const long dims[N], const long factors[N],
 #endif
 
 
-static void decompose_dims(unsigned int N, long dims2[2 * N], long ostrs2[2 * N], long istrs2[2 * N],
+/**
+ * Dimensions and strides of md_decompose2 (and, with the arguments
+ * swapped, of md_recompose2) as a 2N-dimensional copy. Can be used
+ * to apply elementwise operations while (de)composing.
+ */
+void md_decompose_dims(unsigned int N, long dims2[2 * N], long ostrs2[2 * N], long istrs2[2 * N],
 		const long factors[N], const long odims[N + 1], const long ostrs[N + 1], const long idims[N], const long istrs[N])
 {
 	long prod = 1;
@@ -80,7 +85,7 @@ void md_decompose2(unsigned int N, const long factors[N],
 	long ostrs2[2 * N];
 	long istrs2[2 * N];
 
-	decompose_dims(N, dims2, ostrs2, istrs2, factors, odims, ostrs, idims, istrs);
+	md_decompose_dims(N, dims2, ostrs2, istrs2, factors, odims, ostrs, idims, istrs);
 
 	md_copy2(2 * N, dims2, ostrs2, out, istrs2, in, size);
 }
@@ -105,7 +110,7 @@ void md_recompose2(unsigned int N, const long factors[N],
 	long ostrs2[2 * N];
 	long istrs2[2 * N];
 
-	decompose_dims(N, dims2, istrs2, ostrs2, factors, idims, istrs, odims, ostrs);
+	md_decompose_dims(N, dims2, istrs2, ostrs2, factors, idims, istrs, odims, ostrs);
 
 	md_copy2(2 * N, dims2, ostrs2, out, istrs2, in, size);
 }
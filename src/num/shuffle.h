@@ -9,6 +9,10 @@ extern void md_shuffle2(unsigned int N, const long dims[__VLA(N)], const long fa
 extern void md_shuffle(unsigned int N, const long dims[__VLA(N)], const long factors[__VLA(N)],
 		void* out, const void* in, size_t size);
 
+extern void md_decompose_dims(unsigned int N, long dims2[__VLA(2 * N)], long ostrs2[__VLA(2 * N)], long istrs2[__VLA(2 * N)],
+		const long factors[__VLA(N)], const long odims[__VLA(N + 1)], const long ostrs[__VLA(N + 1)],
+		const long idims[__VLA(N)], const long istrs[__VLA(N)]);
+
 extern void md_decompose2(unsigned int N, const long factors[__VLA(N)],
 		const long odims[__VLA(N + 1)], const long ostrs[__VLA(N + 1)], void* out,
 		const long idims[__VLA(N)], const long istrs[__VLA(N)], const void* in, size_t size);
@@ -520,6 +520,11 @@ struct vec_iter_s {
 	void (*smul)(long N, float alpha, float* a, const float* x);
 	void (*xpay)(long N, float alpha, float* a, const float* x);
 	void (*axpy)(long N, float* a, float alpha, const float* x);
+
+	double (*axpy_dot)(long N, float* a, float alpha, const float* x);
+	double (*xpay_norm2)(long N, float beta, float* a, const float* x);
+	double (*cg_update)(long N, float alpha, float* x, const float* p, float* r, const float* Ap);
+	void (*momentum)(long N, float theta, float* x, float* o);
 };
 
 
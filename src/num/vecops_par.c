@@ -0,0 +1,434 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by
+ * a BSD-style license which can be found in the LICENSE file.
+ *
+ *
+ * Multi-threaded and vectorized implementation of the vector
+ * operations used by the iterative algorithms (iter/italgos.c).
+ *
+ * Elementwise operations are split into chunks which are processed
+ * in parallel. Reductions (dot, norm) sum fixed blocks of the vector
+ * with several independent accumulators and then add the partial sums
+ * in order, so the result does not depend on the number of threads.
+ * The fused operations combine the updates of one solver step with
+ * the following reduction, so that each vector is read only once.
+ *
+ * On x86-64 Linux, the kernels are compiled for AVX-512, AVX2 and the
+ * baseline instruction set and the best version is selected at load
+ * time (GCC function multi-versioning).
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "misc/misc.h"
+
+#include "vecops.h"
+
+
+// chunk size for elementwise operations (in floats)
+#define CHUNK 16384L
+
+// do not start threads for vectors smaller than this
+#define PAR_MIN 65536L
+
+// reductions: number of partial sums and minimal block size
+#define MAX_BLOCKS 1024L
+#define MIN_BLOCK 4096L
+
+// independent accumulators in the reduction kernels
+#define LANES 16
+
+
+
+VEC_CLONES
+static double dot_kernel(long N, const float* x, const float* y)
+{
+	double acc[LANES] = { 0. };
+
+	long i = 0;
+
+	for (; i + LANES <= N; i += LANES)
+		for (int l = 0; l < LANES; l++)
+			acc[l] += (double)x[i + l] * (double)y[i + l];
+
+	for (; i < N; i++)
+		acc[i % LANES] += (double)x[i] * (double)y[i];
+
+	double res = 0.;
+
+	for (int l = 0; l < LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+VEC_CLONES
+static void axpy_kernel(long N, float* dst, float alpha, const float* src)
+{
+	for (long i = 0; i < N; i++)
+		dst[i] += alpha * src[i];
+}
+
+VEC_CLONES
+static void xpay_kernel(long N, float beta, float* dst, const float* src)
+{
+	for (long i = 0; i < N; i++)
+		dst[i] = dst[i] * beta + src[i];
+}
+
+VEC_CLONES
+static void smul_kernel(long N, float alpha, float* dst, const float* src)
+{
+	for (long i = 0; i < N; i++)
+		dst[i] = alpha * src[i];
+}
+
+VEC_CLONES
+static void add_kernel(long N, float* dst, const float* src1, const float* src2)
+{
+	for (long i = 0; i < N; i++)
+		dst[i] = src1[i] + src2[i];
+}
+
+VEC_CLONES
+static void sub_kernel(long N, float* dst, const float* src1, const float* src2)
+{
+	for (long i = 0; i < N; i++)
+		dst[i] = src1[i] - src2[i];
+}
+
+VEC_CLONES
+static void swap_kernel(long N, float* a, float* b)
+{
+	for (long i = 0; i < N; i++) {
+
+		float tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+
+VEC_CLONES
+static double axpy_dot_kernel(long N, float* dst, float alpha, const float* src)
+{
+	double acc[LANES] = { 0. };
+
+	long i = 0;
+
+	for (; i + LANES <= N; i += LANES) {
+
+		for (int l = 0; l < LANES; l++) {
+
+			dst[i + l] += alpha * src[i + l];
+			acc[l] += (double)src[i + l] * (double)dst[i + l];
+		}
+	}
+
+	for (; i < N; i++) {
+
+		dst[i] += alpha * src[i];
+		acc[i % LANES] += (double)src[i] * (double)dst[i];
+	}
+
+	double res = 0.;
+
+	for (int l = 0; l < LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+VEC_CLONES
+static double xpay_norm2_kernel(long N, float beta, float* dst, const float* src)
+{
+	double acc[LANES] = { 0. };
+
+	long i = 0;
+
+	for (; i + LANES <= N; i += LANES) {
+
+		for (int l = 0; l < LANES; l++) {
+
+			dst[i + l] = dst[i + l] * beta + src[i + l];
+			acc[l] += (double)dst[i + l] * (double)dst[i + l];
+		}
+	}
+
+	for (; i < N; i++) {
+
+		dst[i] = dst[i] * beta + src[i];
+		acc[i % LANES] += (double)dst[i] * (double)dst[i];
+	}
+
+	double res = 0.;
+
+	for (int l = 0; l < LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+VEC_CLONES
+static double cg_update_kernel(long N, float alpha, float* x, const float* p, float* r, const float* Ap)
+{
+	double acc[LANES] = { 0. };
+
+	long i = 0;
+
+	for (; i + LANES <= N; i += LANES) {
+
+		for (int l = 0; l < LANES; l++) {
+
+			x[i + l] += alpha * p[i + l];
+			r[i + l] -= alpha * Ap[i + l];
+			acc[l] += (double)r[i + l] * (double)r[i + l];
+		}
+	}
+
+	for (; i < N; i++) {
+
+		x[i] += alpha * p[i];
+		r[i] -= alpha * Ap[i];
+		acc[i % LANES] += (double)r[i] * (double)r[i];
+	}
+
+	double res = 0.;
+
+	for (int l = 0; l < LANES; l++)
+		res += acc[l];
+
+	return res;
+}
+
+VEC_CLONES
+static void momentum_kernel(long N, float theta, float* x, float* o)
+{
+	for (long i = 0; i < N; i++) {
+
+		float tmp = x[i];
+		x[i] = tmp + theta * (tmp - o[i]);
+		o[i] = tmp;
+	}
+}
+
+
+
+static float* allocate(long N)
+{
+	assert(N >= 0);
+	return xmalloc((size_t)N * sizeof(float));
+}
+
+static void del(float* vec)
+{
+	free(vec);
+}
+
+static void clear(long N, float* vec)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		memset(vec + i, 0, MIN(CHUNK, N - i) * sizeof(float));
+}
+
+static void copy(long N, float* dst, const float* src)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		memcpy(dst + i, src + i, MIN(CHUNK, N - i) * sizeof(float));
+}
+
+static void swap(long N, float* a, float* b)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		swap_kernel(MIN(CHUNK, N - i), a + i, b + i);
+}
+
+
+/*
+ * The block size only depends on N, so that partial
+ * sums are the same for any number of threads.
+ */
+static long reduction_blocks(long N, long* B)
+{
+	*B = MAX(MIN_BLOCK, (N + MAX_BLOCKS - 1) / MAX_BLOCKS);
+
+	return (N + *B - 1) / *B;
+}
+
+static double sum_blocks(long nb, const double part[MAX_BLOCKS])
+{
+	double res = 0.;
+
+	for (long b = 0; b < nb; b++)
+		res += part[b];
+
+	return res;
+}
+
+static double dot(long N, const float* vec1, const float* vec2)
+{
+	long B;
+	long nb = reduction_blocks(N, &B);
+
+	double part[MAX_BLOCKS];
+
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long b = 0; b < nb; b++)
+		part[b] = dot_kernel(MIN(B, N - b * B), vec1 + b * B, vec2 + b * B);
+
+	return sum_blocks(nb, part);
+}
+
+static double norm(long N, const float* vec)
+{
+	return sqrt(dot(N, vec, vec));
+}
+
+static void axpy(long N, float* dst, float alpha, const float* src)
+{
+	if (0. == alpha)
+		return;
+
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		axpy_kernel(MIN(CHUNK, N - i), dst + i, alpha, src + i);
+}
+
+static void xpay(long N, float beta, float* dst, const float* src)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		xpay_kernel(MIN(CHUNK, N - i), beta, dst + i, src + i);
+}
+
+static void smul(long N, float alpha, float* dst, const float* src)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		smul_kernel(MIN(CHUNK, N - i), alpha, dst + i, src + i);
+}
+
+static void add(long N, float* dst, const float* src1, const float* src2)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		add_kernel(MIN(CHUNK, N - i), dst + i, src1 + i, src2 + i);
+}
+
+static void sub(long N, float* dst, const float* src1, const float* src2)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		sub_kernel(MIN(CHUNK, N - i), dst + i, src1 + i, src2 + i);
+}
+
+
+static double axpy_dot(long N, float* dst, float alpha, const float* src)
+{
+	long B;
+	long nb = reduction_blocks(N, &B);
+
+	double part[MAX_BLOCKS];
+
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long b = 0; b < nb; b++)
+		part[b] = axpy_dot_kernel(MIN(B, N - b * B), dst + b * B, alpha, src + b * B);
+
+	return sum_blocks(nb, part);
+}
+
+static double xpay_norm2(long N, float beta, float* dst, const float* src)
+{
+	long B;
+	long nb = reduction_blocks(N, &B);
+
+	double part[MAX_BLOCKS];
+
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long b = 0; b < nb; b++)
+		part[b] = xpay_norm2_kernel(MIN(B, N - b * B), beta, dst + b * B, src + b * B);
+
+	return sum_blocks(nb, part);
+}
+
+static double cg_update(long N, float alpha, float* x, const float* p, float* r, const float* Ap)
+{
+	long B;
+	long nb = reduction_blocks(N, &B);
+
+	double part[MAX_BLOCKS];
+
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long b = 0; b < nb; b++) {
+
+		long o = b * B;
+		part[b] = cg_update_kernel(MIN(B, N - o), alpha, x + o, p + o, r + o, Ap + o);
+	}
+
+	return sum_blocks(nb, part);
+}
+
+static void momentum(long N, float theta, float* x, float* o)
+{
+	#pragma omp parallel for if (N > PAR_MIN)
+	for (long i = 0; i < N; i += CHUNK)
+		momentum_kernel(MIN(CHUNK, N - i), theta, x + i, o + i);
+}
+
+
+
+// defined in iter/vec.h
+struct vec_iter_s {
+
+	float* (*allocate)(long N);
+	void (*del)(float* x);
+	void (*clear)(long N, float* x);
+	void (*copy)(long N, float* a, const float* x);
+	void (*swap)(long N, float* a, float* x);
+
+	double (*norm)(long N, const float* x);
+	double (*dot)(long N, const float* x, const float* y);
+
+	void (*sub)(long N, float* a, const float* x, const float* y);
+	void (*add)(long N, float* a, const float* x, const float* y);
+
+	void (*smul)(long N, float alpha, float* a, const float* x);
+	void (*xpay)(long N, float alpha, float* a, const float* x);
+	void (*axpy)(long N, float* a, float alpha, const float* x);
+
+	double (*axpy_dot)(long N, float* a, float alpha, const float* x);
+	double (*xpay_norm2)(long N, float beta, float* a, const float* x);
+	double (*cg_update)(long N, float alpha, float* x, const float* p, float* r, const float* Ap);
+	void (*momentum)(long N, float theta, float* x, float* o);
+};
+
+
+extern const struct vec_iter_s cpu_par_iter_ops;
+const struct vec_iter_s cpu_par_iter_ops = {
+
+	.allocate = allocate,
+	.del = del,
+	.clear = clear,
+	.copy = copy,
+	.dot = dot,
+	.norm = norm,
+	.axpy = axpy,
+	.xpay = xpay,
+	.smul = smul,
+	.add = add,
+	.sub = sub,
+	.swap = swap,
+
+	.axpy_dot = axpy_dot,
+	.xpay_norm2 = xpay_norm2,
+	.cg_update = cg_update,
+	.momentum = momentum,
+};
+
@@ -0,0 +1,197 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by 
+ * a BSD-style license which can be found in the LICENSE file.
+ *
+ *
+ * Scratch memory which is reused across operator applications.
+ *
+ * A workspace is a stack: memory is handed out from one buffer
+ * which is allocated once with the reserved size and released
+ * again in reverse order. Users reserve what they need at most
+ * when they are created. A workspace can be shared by several
+ * operators which are applied one after the other, but must not
+ * be used from different threads at the same time. If a request
+ * does not fit, it is served from the heap instead.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <assert.h>
+
+#include "num/multind.h"
+
+#include "misc/misc.h"
+#include "misc/debug.h"
+
+#include "workspace.h"
+
+
+#define WS_ALIGN	64
+#define WS_MAX_ALLOC	16
+
+
+struct workspace_s {
+
+	int refcount;
+
+	size_t size;	// reserved size
+	size_t used;
+	size_t peak;	// including heap fallbacks
+	long fallbacks;
+
+	char* buf;
+
+	int top;
+	struct ws_alloc_s {
+
+		void* ptr;
+		size_t size;
+		_Bool heap;
+
+	} stack[WS_MAX_ALLOC];
+};
+
+
+static size_t ws_round(size_t size)
+{
+	return (size + WS_ALIGN - 1) & ~(size_t)(WS_ALIGN - 1);
+}
+
+
+struct workspace_s* workspace_create(size_t size)
+{
+	PTR_ALLOC(struct workspace_s, ws);
+
+	ws->refcount = 1;
+	ws->size = ws_round(size);
+	ws->used = 0;
+	ws->peak = 0;
+	ws->fallbacks = 0;
+	ws->buf = NULL;
+	ws->top = 0;
+
+	return ws;
+}
+
+
+struct workspace_s* workspace_ref(struct workspace_s* ws)
+{
+	ws->refcount++;
+	return ws;
+}
+
+
+void workspace_free(struct workspace_s* ws)
+{
+	if (NULL == ws)
+		return;
+
+	if (0 < --ws->refcount)
+		return;
+
+	assert(0 == ws->top);
+
+	debug_printf(DP_DEBUG1, "Workspace: %.1f MB reserved, %.1f MB peak, %ld heap allocations.\n",
+			ws->size / 1048576., ws->peak / 1048576., ws->fallbacks);
+
+	free(ws->buf);
+	free(ws);
+}
+
+
+/**
+ * Make sure that at least size bytes are available.
+ *
+ * Reservations of different users are not added, because
+ * a shared workspace is only used by one of them at a time.
+ */
+void workspace_reserve(struct workspace_s* ws, size_t size)
+{
+	size = ws_round(size);
+
+	if (size <= ws->size)
+		return;
+
+	// the buffer can only grow while nothing is allocated from it
+	assert(0 == ws->top);
+
+	free(ws->buf);
+	ws->buf = NULL;
+	ws->size = size;
+}
+
+
+void* workspace_alloc(struct workspace_s* ws, size_t size)
+{
+	assert(ws->top < WS_MAX_ALLOC);
+
+	size = ws_round(size);
+
+	if ((NULL == ws->buf) && (0 < ws->size)) {
+
+		void* buf = NULL;
+
+		if (0 != posix_memalign(&buf, WS_ALIGN, ws->size))
+			error("workspace: could not allocate %zu bytes.\n", ws->size);
+
+		ws->buf = buf;
+	}
+
+	struct ws_alloc_s* a = &ws->stack[ws->top++];
+
+	a->size = size;
+	a->heap = (ws->used + size > ws->size);
+
+	if (a->heap) {
+
+		debug_printf(DP_DEBUG3, "Workspace exhausted, allocating %zu bytes on heap.\n", size);
+
+		a->ptr = xmalloc(size);
+		ws->fallbacks++;
+
+	} else {
+
+		a->ptr = ws->buf + ws->used;
+		ws->used += size;
+	}
+
+	size_t total = 0;
+
+	for (int i = 0; i < ws->top; i++)
+		total += ws->stack[i].size;
+
+	ws->peak = MAX(ws->peak, total);
+
+	return a->ptr;
+}
+
+
+void* md_workspace_alloc(struct workspace_s* ws, unsigned int D, const long dims[D], size_t size)
+{
+	return workspace_alloc(ws, md_calc_size(D, dims) * size);
+}
+
+
+void workspace_release(struct workspace_s* ws, void* ptr)
+{
+	if (NULL == ptr)
+		return;
+
+	assert(0 < ws->top);
+
+	struct ws_alloc_s* a = &ws->stack[--ws->top];
+
+	// must be released in reverse order of allocation
+	assert(a->ptr == ptr);
+
+	if (a->heap)
+		free(ptr);
+	else
+		ws->used -= a->size;
+}
+
+
+size_t workspace_peak(const struct workspace_s* ws)
+{
+	return ws->peak;
+}
@@ -0,0 +1,25 @@
+/* Copyright 2016. The Regents of the University of California.
+ * All rights reserved. Use of this source code is governed by 
+ * a BSD-style license which can be found in the LICENSE file.
+ */
+
+#include <stddef.h>
+
+#include "misc/cppwrap.h"
+
+struct workspace_s;
+
+extern struct workspace_s* workspace_create(size_t size);
+extern struct workspace_s* workspace_ref(struct workspace_s* ws);
+extern void workspace_free(struct workspace_s* ws);
+
+extern void workspace_reserve(struct workspace_s* ws, size_t size);
+
+extern void* workspace_alloc(struct workspace_s* ws, size_t size);
+extern void workspace_release(struct workspace_s* ws, void* ptr);
+
+extern size_t workspace_peak(const struct workspace_s* ws);
+
+extern void* md_workspace_alloc(struct workspace_s* ws, unsigned int D, const long dims[__VLA(D)], size_t size);
+
+#include "misc/cppwrap.h"
@@ -52,7 +52,7 @@ int main_resize(int argc, char* argv[])
 	long in_dims[N];
 	long out_dims[N];
 
-	void* in_data = load_cfl(argv[argc - 2], N, in_dims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[argc - 2], N, in_dims);
 	md_copy_dims(N, out_dims, in_dims);
 	
 	for (int i = 0; i < count; i += 2) {
@@ -66,12 +66,43 @@ int main_resize(int argc, char* argv[])
 		out_dims[dim] = size;
 	}
 
-	void* out_data = create_cfl(argv[argc - 1], N, out_dims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[argc - 1], N, out_dims);
 
-	(center ? md_resize_center : md_resize)(N, out_dims, out_data, in_dims, in_data, CFL_SIZE);
+	// loop over dimensions which are not resized
 
-	unmap_cfl(N, in_dims, in_data);
-	unmap_cfl(N, out_dims, out_data);
+	unsigned long resized = 0;
+
+	for (unsigned int i = 0; i < N; i++)
+		if (in_dims[i] != out_dims[i])
+			resized = MD_SET(resized, i);
+
+	unsigned long loop_flags = cfl_stream_flags(N, in_dims, resized);
+
+	long in_cdims[N];
+	long out_cdims[N];
+	md_select_dims(N, ~loop_flags, in_cdims, in_dims);
+	md_select_dims(N, ~loop_flags, out_cdims, out_dims);
+
+	complex float* in_data = md_alloc(N, in_cdims, CFL_SIZE);
+	complex float* out_data = md_alloc(N, out_cdims, CFL_SIZE);
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		cfl_stream_read(in, N, loop_flags, pos, in_data);
+
+		(center ? md_resize_center : md_resize)(N, out_cdims, out_data, in_cdims, in_data, CFL_SIZE);
+
+		cfl_stream_write(out, N, loop_flags, pos, out_data);
+
+	} while (md_next(N, in_dims, loop_flags, pos));
+
+	md_free(in_data);
+	md_free(out_data);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 
 	exit(0);
 }
@@ -34,7 +34,7 @@ int main_rss(int argc, char* argv[argc])
 	mini_cmdline(argc, argv, 3, usage_str, help_str);
 
 	long dims[DIMS];
-	complex float* data = load_cfl(argv[2], DIMS, dims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[2], DIMS, dims);
 
 	int flags = atoi(argv[1]);
 
@@ -43,12 +43,36 @@ int main_rss(int argc, char* argv[argc])
 	long odims[DIMS];
 	md_select_dims(DIMS, ~flags, odims, dims);
 
-	complex float* out = create_cfl(argv[3], DIMS, odims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[3], DIMS, odims);
 
-	md_zrss(DIMS, dims, flags, out, data);
+	// the loop dimensions are not reduced and are the same for the output
 
-	unmap_cfl(DIMS, dims, data);
-	unmap_cfl(DIMS, odims, out);
+	unsigned long loop_flags = cfl_stream_flags(DIMS, dims, flags);
+
+	long cdims[DIMS];
+	long codims[DIMS];
+	md_select_dims(DIMS, ~loop_flags, cdims, dims);
+	md_select_dims(DIMS, ~flags, codims, cdims);
+
+	complex float* data = md_alloc(DIMS, cdims, CFL_SIZE);
+	complex float* odata = md_alloc(DIMS, codims, CFL_SIZE);
+
+	long pos[DIMS] = { 0 };
+
+	do {
+		cfl_stream_read(in, DIMS, loop_flags, pos, data);
+
+		md_zrss(DIMS, cdims, flags, odata, data);
+
+		cfl_stream_write(out, DIMS, loop_flags, pos, odata);
+
+	} while (md_next(DIMS, dims, loop_flags, pos));
+
+	md_free(data);
+	md_free(odata);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 
 	exit(0);
 }
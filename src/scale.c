@@ -40,13 +40,32 @@ int main_scale(int argc, char* argv[])
 
 	const int N = DIMS;
 	long dims[N];
-	complex float* idata = load_cfl(argv[2], N, dims);
-	complex float* odata = create_cfl(argv[3], N, dims);
-		
-	md_zsmul(N, dims, odata, idata, scale);
+	struct cfl_stream_s* in = load_cfl_stream(argv[2], N, dims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[3], N, dims);
 
-	unmap_cfl(N, dims, idata);
-	unmap_cfl(N, dims, odata);
+	unsigned long loop_flags = cfl_stream_flags(N, dims, 0u);
+
+	long cdims[N];
+	md_select_dims(N, ~loop_flags, cdims, dims);
+
+	complex float* data = md_alloc(N, cdims, sizeof(complex float));
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		cfl_stream_read(in, N, loop_flags, pos, data);
+
+		md_zsmul(N, cdims, data, data, scale);
+
+		cfl_stream_write(out, N, loop_flags, pos, data);
+
+	} while (md_next(N, dims, loop_flags, pos));
+
+	md_free(data);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 	exit(0);
 }
 
@@ -33,6 +33,7 @@
 #include "num/flpmath.h"
 #include "num/fft.h"
 #include "num/ops.h"
+#include "num/expr.h"
 
 #include "linops/linop.h"
 #include "linops/someops.h"
@@ -81,8 +82,16 @@ static void maps_apply(const void* _data, complex float* dst, const complex floa
 {
 	const struct maps_data* data = _data;
 
-	md_clear(DIMS, data->ksp_dims, dst, CFL_SIZE);
-	md_zfmac2(DIMS, data->max_dims, data->strs_ksp, dst, data->strs_img, src, data->strs_mps, data->sens);
+	// dst = sum( sens .* src ) in one pass without clearing dst first
+
+	struct md_zexpr_s* expr = md_zexpr_create(DIMS, data->max_dims);
+
+	int img = md_zexpr_input(expr, data->strs_img, src);
+	int mps = md_zexpr_input(expr, data->strs_mps, data->sens);
+
+	md_zexpr_sum(expr, data->strs_ksp, dst, md_zexpr_zmul(expr, img, mps));
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
 }
 
 
@@ -91,8 +100,15 @@ static void maps_apply_adjoint(const void* _data, complex float* dst, const comp
  	const struct maps_data* data = _data;
 
 	// dst = sum( conj(sens) .* tmp )
-	md_clear(DIMS, data->img_dims, dst, CFL_SIZE);
-	md_zfmacc2(DIMS, data->max_dims, data->strs_img, dst, data->strs_ksp, src, data->strs_mps, data->sens);
+
+	struct md_zexpr_s* expr = md_zexpr_create(DIMS, data->max_dims);
+
+	int ksp = md_zexpr_input(expr, data->strs_ksp, src);
+	int mps = md_zexpr_input(expr, data->strs_mps, data->sens);
+
+	md_zexpr_sum(expr, data->strs_img, dst, md_zexpr_zmulc(expr, ksp, mps));
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
 }
 
 
@@ -253,3 +269,355 @@ struct linop_s* sense_init(const long max_dims[DIMS],
 
 
 
+
+
+
+/**
+ * data structure for the coil-batched sense operator
+ *
+ * @param maps sensitivities and dimensions
+ * @param coils number of coils
+ * @param block number of coils processed at once
+ * @param pat_strs strides of the weights
+ * @param weights k-space weights (or NULL)
+ * @param fft_ops FFT for a full and for the last (partial) block
+ * @param pe_ops phase-encode FFTs for the normal operator (or NULL)
+ * @param pe_scale scale factor for the normal operator with pe_ops
+ */
+struct sense_stream_s {
+
+	struct maps_data* maps;
+
+	long coils;
+	long block;
+
+	long pat_strs[DIMS];
+	const complex float* weights;
+
+	struct linop_s* fft_ops[2];
+	struct linop_s* pe_ops[2];
+	float pe_scale;
+};
+
+
+static void stream_block_dims(const struct sense_stream_s* data, long c, long max_dims[DIMS], long cim_dims[DIMS])
+{
+	md_copy_dims(DIMS, max_dims, data->maps->max_dims);
+	max_dims[COIL_DIM] = MIN(data->block, data->coils - c);
+
+	md_select_dims(DIMS, ~MAPS_FLAG, cim_dims, max_dims);
+}
+
+
+static const struct linop_s* stream_block_fft(const struct sense_stream_s* data, long c)
+{
+	return data->fft_ops[(data->block <= data->coils - c) ? 0 : 1];
+}
+
+
+static const struct linop_s* stream_block_pe_fft(const struct sense_stream_s* data, long c)
+{
+	return data->pe_ops[(data->block <= data->coils - c) ? 0 : 1];
+}
+
+
+/*
+ * buf = sum_maps sens .* src for the coils c, ..., c + block - 1
+ */
+static void stream_maps_forward(const struct sense_stream_s* data, long c, complex float* buf, const complex float* src)
+{
+	const struct maps_data* maps = data->maps;
+
+	long max_dims[DIMS];
+	long cim_dims[DIMS];
+	stream_block_dims(data, c, max_dims, cim_dims);
+
+	long cim_strs[DIMS];
+	md_calc_strides(DIMS, cim_strs, cim_dims, CFL_SIZE);
+
+	struct md_zexpr_s* expr = md_zexpr_create(DIMS, max_dims);
+
+	int img = md_zexpr_input(expr, maps->strs_img, src);
+	int mps = md_zexpr_input(expr, maps->strs_mps, (void*)maps->sens + c * maps->strs_mps[COIL_DIM]);
+
+	md_zexpr_sum(expr, cim_strs, buf, md_zexpr_zmul(expr, img, mps));
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
+}
+
+
+/*
+ * dst (+)= sum_coils conj(sens) .* buf for the coils c, ..., c + block - 1
+ */
+static void stream_maps_adjoint(const struct sense_stream_s* data, long c, complex float* dst, const complex float* buf)
+{
+	const struct maps_data* maps = data->maps;
+
+	long max_dims[DIMS];
+	long cim_dims[DIMS];
+	stream_block_dims(data, c, max_dims, cim_dims);
+
+	long cim_strs[DIMS];
+	md_calc_strides(DIMS, cim_strs, cim_dims, CFL_SIZE);
+
+	struct md_zexpr_s* expr = md_zexpr_create(DIMS, max_dims);
+
+	int cim = md_zexpr_input(expr, cim_strs, buf);
+	int mps = md_zexpr_input(expr, maps->strs_mps, (void*)maps->sens + c * maps->strs_mps[COIL_DIM]);
+	int val = md_zexpr_zmulc(expr, cim, mps);
+
+	// the first block initializes dst
+
+	if (0 == c)
+		md_zexpr_sum(expr, maps->strs_img, dst, val);
+	else
+		md_zexpr_acc(expr, maps->strs_img, dst, val);
+
+	md_zexpr_eval(expr);
+	md_zexpr_free(expr);
+}
+
+
+static void stream_weights(const struct sense_stream_s* data, long c, const long ostrs[DIMS], complex float* dst, const long istrs[DIMS], const complex float* src, bool adjoint)
+{
+	long max_dims[DIMS];
+	long cim_dims[DIMS];
+	stream_block_dims(data, c, max_dims, cim_dims);
+
+	if (NULL == data->weights) {
+
+		md_copy2(DIMS, cim_dims, ostrs, dst, istrs, src, CFL_SIZE);
+		return;
+	}
+
+	(adjoint ? md_zmulc2 : md_zmul2)(DIMS, cim_dims, ostrs, dst, istrs, src, data->pat_strs, data->weights);
+}
+
+
+static complex float* stream_alloc_block(const struct sense_stream_s* data, const complex float* ref)
+{
+	long max_dims[DIMS];
+	long cim_dims[DIMS];
+	stream_block_dims(data, 0, max_dims, cim_dims);
+
+	return md_alloc_sameplace(DIMS, cim_dims, CFL_SIZE, ref);
+}
+
+
+static void sense_stream_apply(const void* _data, complex float* dst, const complex float* src)
+{
+	const struct sense_stream_s* data = _data;
+	const struct maps_data* maps = data->maps;
+
+	complex float* buf = stream_alloc_block(data, src);
+
+	for (long c = 0; c < data->coils; c += data->block) {
+
+		long max_dims[DIMS];
+		long cim_dims[DIMS];
+		stream_block_dims(data, c, max_dims, cim_dims);
+
+		long cim_strs[DIMS];
+		md_calc_strides(DIMS, cim_strs, cim_dims, CFL_SIZE);
+
+		stream_maps_forward(data, c, buf, src);
+		linop_forward(stream_block_fft(data, c), DIMS, cim_dims, buf, DIMS, cim_dims, buf);
+		stream_weights(data, c, maps->strs_ksp, (void*)dst + c * maps->strs_ksp[COIL_DIM], cim_strs, buf, false);
+	}
+
+	md_free(buf);
+}
+
+
+static void sense_stream_apply_adjoint(const void* _data, complex float* dst, const complex float* src)
+{
+	const struct sense_stream_s* data = _data;
+	const struct maps_data* maps = data->maps;
+
+	complex float* buf = stream_alloc_block(data, src);
+
+	for (long c = 0; c < data->coils; c += data->block) {
+
+		long max_dims[DIMS];
+		long cim_dims[DIMS];
+		stream_block_dims(data, c, max_dims, cim_dims);
+
+		long cim_strs[DIMS];
+		md_calc_strides(DIMS, cim_strs, cim_dims, CFL_SIZE);
+
+		stream_weights(data, c, cim_strs, buf, maps->strs_ksp, (const void*)src + c * maps->strs_ksp[COIL_DIM], true);
+		linop_adjoint(stream_block_fft(data, c), DIMS, cim_dims, buf, DIMS, cim_dims, buf);
+		stream_maps_adjoint(data, c, dst, buf);
+	}
+
+	md_free(buf);
+}
+
+
+/*
+ * If the weights are constant along the readout, they commute with
+ * the readout FFT, which then cancels in F^H W^H W F. The normal
+ * operator only transforms along the phase-encode dimensions (in
+ * hybrid x-ky-kz space) and multiplies with the readout length to
+ * account for the scaling of the sensitivities.
+ */
+static void sense_stream_apply_normal(const void* _data, complex float* dst, const complex float* src)
+{
+	const struct sense_stream_s* data = _data;
+	const struct maps_data* maps = data->maps;
+
+	bool hybrid = (NULL != data->pe_ops[0]);
+
+	// dst is accumulated while src is still needed
+
+	complex float* out = (dst == src) ? md_alloc_sameplace(DIMS, maps->img_dims, CFL_SIZE, src) : dst;
+
+	complex float* buf = stream_alloc_block(data, src);
+
+	for (long c = 0; c < data->coils; c += data->block) {
+
+		long max_dims[DIMS];
+		long cim_dims[DIMS];
+		stream_block_dims(data, c, max_dims, cim_dims);
+
+		long cim_strs[DIMS];
+		md_calc_strides(DIMS, cim_strs, cim_dims, CFL_SIZE);
+
+		const struct linop_s* fft = hybrid ? stream_block_pe_fft(data, c) : stream_block_fft(data, c);
+
+		stream_maps_forward(data, c, buf, src);
+		linop_forward(fft, DIMS, cim_dims, buf, DIMS, cim_dims, buf);
+
+		if ((NULL != data->weights) || hybrid) {
+
+			struct md_zexpr_s* expr = md_zexpr_create(DIMS, cim_dims);
+
+			int val = md_zexpr_input(expr, cim_strs, buf);
+
+			if (NULL != data->weights) {
+
+				int wgh = md_zexpr_input(expr, data->pat_strs, data->weights);
+
+				val = md_zexpr_zmulc(expr, md_zexpr_zmul(expr, val, wgh), wgh);
+			}
+
+			if (hybrid)
+				val = md_zexpr_zsmul(expr, val, data->pe_scale);
+
+			md_zexpr_store(expr, cim_strs, buf, val);
+			md_zexpr_eval(expr);
+			md_zexpr_free(expr);
+		}
+
+		linop_adjoint(fft, DIMS, cim_dims, buf, DIMS, cim_dims, buf);
+		stream_maps_adjoint(data, c, out, buf);
+	}
+
+	md_free(buf);
+
+	if (out != dst) {
+
+		md_copy(DIMS, maps->img_dims, dst, out, CFL_SIZE);
+		md_free(out);
+	}
+}
+
+
+static void sense_stream_free(const void* _data)
+{
+	const struct sense_stream_s* data = _data;
+
+	maps_free_data(data->maps);
+
+	for (int i = 0; i < 2; i++) {
+
+		if (NULL != data->fft_ops[i])
+			linop_free(data->fft_ops[i]);
+
+		if (NULL != data->pe_ops[i])
+			linop_free(data->pe_ops[i]);
+	}
+
+	free((void*)data);
+}
+
+
+/**
+ * Create a coil-batched sense operator, y = W F S x
+ *
+ * The operator is applied to a block of coils at a time, so that only
+ * the coil images of one block are held in memory. The normal operator
+ * applies S^H F^H W^H W F S block by block and needs no k-space buffer.
+ * The weights are referenced (not copied) and may be changed between
+ * applications of the operator. If they are constant along the readout
+ * (pat_dims[READ_DIM] == 1), the normal operator only applies FFTs
+ * along the phase-encode dimensions.
+ *
+ * @param max_dims maximal dimensions across all data structures
+ * @param sens_flags active map dimensions
+ * @param sens sensitivities
+ * @param pat_dims dimensions of the weights
+ * @param weights k-space weights W (or NULL)
+ * @param mem memory for the coil images of one block in bytes (0 for all coils)
+ * @param gpu TRUE if using gpu
+ */
+struct linop_s* sense_stream_create(const long max_dims[DIMS], unsigned int sens_flags, const complex float* sens,
+			const long pat_dims[DIMS], const complex float* weights, long mem, bool gpu)
+{
+	PTR_ALLOC(struct sense_stream_s, data);
+
+	data->maps = maps_create_data(max_dims, sens_flags, sens, gpu);
+
+	// scale the sensitivity maps by the FFT scale factor
+	fftscale(DIMS, data->maps->mps_dims, FFT_FLAGS, data->maps->sens, data->maps->sens);
+
+	data->coils = max_dims[COIL_DIM];
+
+	long coil_size = md_calc_size(DIMS, data->maps->ksp_dims) / data->coils * CFL_SIZE;
+
+	data->block = (mem <= 0) ? data->coils : MAX(1, MIN(data->coils, mem / coil_size));
+
+	debug_printf(DP_DEBUG1, "SENSE: %ld coils in blocks of %ld.\n", data->coils, data->block);
+
+	data->weights = weights;
+
+	if (NULL != weights) {
+
+		assert(md_check_compat(DIMS, ~0u, data->maps->ksp_dims, pat_dims));
+		assert(1 == pat_dims[COIL_DIM]);
+		md_calc_strides(DIMS, data->pat_strs, pat_dims, CFL_SIZE);
+	}
+
+	// readout FFT can be skipped in the normal operator
+
+	bool hybrid = (1 < max_dims[READ_DIM]) && (1 < max_dims[PHS1_DIM] * max_dims[PHS2_DIM])
+			&& ((NULL == weights) || (1 == pat_dims[READ_DIM]));
+
+	data->pe_scale = max_dims[READ_DIM];
+
+	if (hybrid)
+		debug_printf(DP_DEBUG1, "SENSE: normal operator in hybrid space (phase-encode FFTs only).\n");
+
+	long rest = data->coils % data->block;
+
+	for (int i = 0; i < 2; i++) {
+
+		data->fft_ops[i] = NULL;
+		data->pe_ops[i] = NULL;
+
+		if ((1 == i) && (0 == rest))
+			continue;
+
+		long blk_dims[DIMS];
+		long cim_dims[DIMS];
+		stream_block_dims(data, (0 == i) ? 0 : (data->coils - rest), blk_dims, cim_dims);
+
+		data->fft_ops[i] = linop_fft_create(DIMS, cim_dims, FFT_FLAGS, gpu);
+
+		if (hybrid)
+			data->pe_ops[i] = linop_fft_create(DIMS, cim_dims, PHS1_FLAG|PHS2_FLAG, gpu);
+	}
+
+	return linop_create(DIMS, data->maps->ksp_dims, DIMS, data->maps->img_dims, data,
+			sense_stream_apply, sense_stream_apply_adjoint, sense_stream_apply_normal, NULL, sense_stream_free);
+}
@@ -36,17 +36,42 @@ int main_transpose(int argc, char* argv[])
 	assert((0 <= dim1) && (dim1 < N));
 	assert((0 <= dim2) && (dim2 < N));
 
-	complex float* idata = load_cfl(argv[3], N, idims);
+	struct cfl_stream_s* in = load_cfl_stream(argv[3], N, idims);
 
 	long odims[N];
 	md_transpose_dims(N, dim1, dim2, odims, idims);
 
-	complex float* odata = create_cfl(argv[4], N, odims);
+	struct cfl_stream_s* out = create_cfl_stream(argv[4], N, odims);
 
-	md_transpose(N, dim1, dim2, odims, odata, idims, idata, sizeof(complex float));
+	// loop over all other dimensions, which are at the same position in the output
 
-	unmap_cfl(N, idims, idata);
-	unmap_cfl(N, odims, odata);
+	unsigned long loop_flags = cfl_stream_flags(N, idims, MD_BIT(dim1) | MD_BIT(dim2));
+
+	long icdims[N];
+	long ocdims[N];
+	md_select_dims(N, ~loop_flags, icdims, idims);
+	md_transpose_dims(N, dim1, dim2, ocdims, icdims);
+
+	complex float* idata = md_alloc(N, icdims, sizeof(complex float));
+	complex float* odata = md_alloc(N, ocdims, sizeof(complex float));
+
+	long pos[N];
+	md_set_dims(N, pos, 0);
+
+	do {
+		cfl_stream_read(in, N, loop_flags, pos, idata);
+
+		md_transpose(N, dim1, dim2, ocdims, odata, icdims, idata, sizeof(complex float));
+
+		cfl_stream_write(out, N, loop_flags, pos, odata);
+
+	} while (md_next(N, idims, loop_flags, pos));
+
+	md_free(idata);
+	md_free(odata);
+
+	cfl_stream_close(in);
+	cfl_stream_close(out);
 	exit(0);
 }
 
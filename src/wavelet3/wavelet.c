@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "misc/misc.h"
 #include "misc/debug.h"
@@ -67,55 +68,326 @@ static int coord(int l, int x, int flen, int k)
 {
 	int n = 2 * l + 1 - (flen - 1) + k;
 
-	if (n < 0)
-		n = -n - 1;
+	// repeat the reflection for signals shorter than the filter
 
-	if (n >= x)
-		n = x - 1 - (n - x);
+	while ((n < 0) || (n >= x)) {
+
+		if (n < 0)
+			n = -n - 1;
+
+		if (n >= x)
+			n = x - 1 - (n - x);
+	}
 
 	return n;
 }
 
 
-static void wavelet_down3(const long dims[3], const long out_str[3], complex float* out, const long in_str[3], const complex float* in, unsigned int flen, const float filter[flen])
+// block size (in floats) along the contiguous dimension
+#define WBLK 256
+
+
+/*
+ * The analysis and synthesis steps compute (or combine) both bands
+ * in one pass. The taps for one output position (including the
+ * boundary reflection) are set up once, the innermost loop is over
+ * the contiguous dimension and has no branches. If this dimension
+ * is a singleton (transform along the contiguous dimension), the
+ * row kernels are used instead, which only need coord() at the two
+ * ends of a row.
+ */
+VEC_CLONES
+static void down_taps(long K, float* low, float* hgh, unsigned int flen, const float* src[flen], const float flo[flen], const float fhg[flen])
 {
-#pragma omp parallel for collapse(3)
-	for (unsigned int i = 0; i < dims[2]; i++)
-		for (unsigned int j = 0; j < bandsize(dims[1], flen); j++)
-			for (unsigned int k = 0; k < dims[0]; k++) {
+	for (long k0 = 0; k0 < K; k0 += WBLK) {
 
-				*access(out_str, out, i, j, k) = 0.;
+		long n = MIN(WBLK, K - k0);
 
-				for (unsigned int l = 0; l < flen; l++) {
+		float a[WBLK] = { 0. };
+		float b[WBLK] = { 0. };
 
-						int n = coord(j, dims[1], flen, l);
-	
-						*access(out_str, out, i, j, k) += 
-							*(caccess(in_str, in, i, n, k)) * filter[flen - l - 1];
-				}
+		for (unsigned int l = 0; l < flen; l++) {
+
+			const float* x = src[l] + k0;
+			float cl = flo[flen - l - 1];
+			float ch = fhg[flen - l - 1];
+
+			for (long k = 0; k < n; k++) {
+
+				a[k] += x[k] * cl;
+				b[k] += x[k] * ch;
 			}
+		}
+
+		for (long k = 0; k < n; k++) {
+
+			low[k0 + k] = a[k];
+			hgh[k0 + k] = b[k];
+		}
+	}
+}
+
+VEC_CLONES
+static void up_taps(long K, float* out, unsigned int m, const float* src[2 * m], const float coef[2 * m])
+{
+	for (long k0 = 0; k0 < K; k0 += WBLK) {
+
+		long n = MIN(WBLK, K - k0);
+
+		float a[WBLK] = { 0. };
+
+		for (unsigned int l = 0; l < 2 * m; l++) {
+
+			const float* x = src[l] + k0;
+			float c = coef[l];
+
+			for (long k = 0; k < n; k++)
+				a[k] += x[k] * c;
+		}
+
+		for (long k = 0; k < n; k++)
+			out[k0 + k] = a[k];
+	}
+}
+
+
+/*
+ * Taps of the synthesis filters for output position j: the
+ * band positions n[] and the filter coefficients c[].
+ */
+static unsigned int up_coords(long j, long B, unsigned int flen, long n[flen], unsigned int c[flen])
+{
+	long t = j + flen / 2 - (flen - 1);
+	unsigned int m = 0;
+
+	for (unsigned int l = labs(t) % 2; l < flen; l += 2) {
+
+		long x = (t + l) / 2;
+
+		if ((0 <= x) && (x < B)) {
+
+			n[m] = x;
+			c[m] = flen - l - 1;
+			m++;
+		}
+	}
+
+	return m;
 }
 
-static void wavelet_up3(const long dims[3], const long out_str[3], complex float* out, const long in_str[3],  const complex float* in, unsigned int flen, const float filter[flen])
+
+static inline void down_row(long N, long B, long os, complex float* low, complex float* hgh, long is, const complex float* in, unsigned int flen, const float flo[flen], const float fhg[flen])
 {
-//	md_clear2(3, dims, out_str, out, CFL_SIZE);
+	// positions which do not need the boundary reflection
+
+	long j0 = MIN(B, (long)(flen - 1) / 2);
+	long j1 = MAX(j0, MIN(B, N / 2));
 
-#pragma omp parallel for collapse(3)
-	for (unsigned int i = 0; i < dims[2]; i++)
-		for (unsigned int j = 0; j < dims[1]; j++)
-			for (unsigned int k = 0; k < dims[0]; k++) {
+	for (long j = 0; j < B; j++) {
 
-		//		*access(out_str, out, i, j, k) = 0.;
+		if (j == j0)
+			j = j1;
+
+		if (j >= B)
+			break;
+
+		complex float a = 0.;
+		complex float b = 0.;
+
+		for (unsigned int l = 0; l < flen; l++) {
+
+			complex float x = in[coord(j, N, flen, l) * is];
+
+			a += x * flo[flen - l - 1];
+			b += x * fhg[flen - l - 1];
+		}
+
+		low[j * os] = a;
+		hgh[j * os] = b;
+	}
+
+	for (long j = j0; j < j1; j++) {
+
+		const complex float* x = in + (2 * j + 2 - (long)flen) * is;
+
+		complex float a = 0.;
+		complex float b = 0.;
+
+		for (unsigned int l = 0; l < flen; l++) {
+
+			a += x[l * is] * flo[flen - l - 1];
+			b += x[l * is] * fhg[flen - l - 1];
+		}
+
+		low[j * os] = a;
+		hgh[j * os] = b;
+	}
+}
+
+
+static inline void up_row(long N, long B, long os, complex float* out, long is, const complex float* low, const complex float* hgh, unsigned int flen, const float flo[flen], const float fhg[flen])
+{
+	// positions which use all taps (for even filter lengths)
+
+	long j0 = 0;
+	long j1 = 0;
+
+	if (0 == flen % 2) {
+
+		j0 = MIN(N, MAX(0, (long)flen / 2 - 2));
+		j1 = MAX(j0, MIN(N, 2 * B - (long)flen / 2));
+	}
 
-				for (unsigned int l = ((j + flen / 2 - 0) - (flen - 1)) % 2; l < flen; l += 2) {
+	for (long j = 0; j < N; j++) {
 
-					int n = ((j + flen / 2 - 0) - (flen - 1) + l) / 2;
+		if (j == j0)
+			j = j1;
 
-					if ((0 <= n) && ((unsigned int)n < bandsize(dims[1], flen)))
-						*access(out_str, out, i, j, k) += 
-							*caccess(in_str, in, i, n, k) * filter[flen - l - 1];
-				}
+		if (j >= N)
+			break;
+
+		long n[flen];
+		unsigned int c[flen];
+		unsigned int m = up_coords(j, B, flen, n, c);
+
+		complex float a = 0.;
+
+		for (unsigned int l = 0; l < m; l++)
+			a += low[n[l] * is] * flo[c[l]] + hgh[n[l] * is] * fhg[c[l]];
+
+		out[j * os] = a;
+	}
+
+	for (long j = j0; j < j1; j++) {
+
+		long t = j + flen / 2 - (flen - 1);
+		long p = t & 1;
+		long n = (t + p) / 2;
+
+		complex float a = 0.;
+
+		for (unsigned int l = 0; l < flen / 2; l++) {
+
+			unsigned int c = flen - 1 - (p + 2 * l);
+
+			a += low[(n + l) * is] * flo[c] + hgh[(n + l) * is] * fhg[c];
+		}
+
+		out[j * os] = a;
+	}
+}
+
+
+static inline void down_rows(const long dims[3], const long out_str[3], complex float* low, complex float* hgh, const long in_str[3], const complex float* in, unsigned int flen, const float filter[2][flen])
+{
+	assert(0 == out_str[1] % CFL_SIZE);
+	assert(0 == in_str[1] % CFL_SIZE);
+
+	long B = bandsize(dims[1], flen);
+	long os = out_str[1] / CFL_SIZE;
+	long is = in_str[1] / CFL_SIZE;
+
+#pragma omp parallel for
+	for (long i = 0; i < dims[2]; i++)
+		down_row(dims[1], B, os, access(out_str, low, i, 0, 0), access(out_str, hgh, i, 0, 0),
+			is, caccess(in_str, in, i, 0, 0), flen, filter[0], filter[1]);
+}
+
+
+static inline void up_rows(const long dims[3], const long out_str[3], complex float* out, const long in_str[3], const complex float* low, const complex float* hgh, unsigned int flen, const float filter[2][flen])
+{
+	assert(0 == out_str[1] % CFL_SIZE);
+	assert(0 == in_str[1] % CFL_SIZE);
+
+	long B = bandsize(dims[1], flen);
+	long os = out_str[1] / CFL_SIZE;
+	long is = in_str[1] / CFL_SIZE;
+
+#pragma omp parallel for
+	for (long i = 0; i < dims[2]; i++)
+		up_row(dims[1], B, os, access(out_str, out, i, 0, 0),
+			is, caccess(in_str, low, i, 0, 0), caccess(in_str, hgh, i, 0, 0), flen, filter[0], filter[1]);
+}
+
+
+static void wavelet_down3(const long dims[3], const long out_str[3], complex float* low, complex float* hgh, const long in_str[3], const complex float* in, unsigned int flen, const float filter[2][flen])
+{
+	if (1 == dims[0]) {
+
+		// constant filter lengths, so that the taps are unrolled
+
+		switch (flen) {
+		case 2:  down_rows(dims, out_str, low, hgh, in_str, in, 2, filter); break;
+		case 4:  down_rows(dims, out_str, low, hgh, in_str, in, 4, filter); break;
+		case 10: down_rows(dims, out_str, low, hgh, in_str, in, 10, filter); break;
+		default: down_rows(dims, out_str, low, hgh, in_str, in, flen, filter);
+		}
+
+		return;
+	}
+
+	long B = bandsize(dims[1], flen);
+
+	assert(CFL_SIZE == in_str[0]);
+	assert(CFL_SIZE == out_str[0]);
+
+#pragma omp parallel for collapse(2)
+	for (long i = 0; i < dims[2]; i++) {
+		for (long j = 0; j < B; j++) {
+
+			const float* src[flen];
+
+			for (unsigned int l = 0; l < flen; l++)
+				src[l] = (const float*)caccess(in_str, in, i, coord(j, dims[1], flen, l), 0);
+
+			down_taps(2 * dims[0], (float*)access(out_str, low, i, j, 0), (float*)access(out_str, hgh, i, j, 0),
+				flen, src, filter[0], filter[1]);
+		}
+	}
+}
+
+
+static void wavelet_up3(const long dims[3], const long out_str[3], complex float* out, const long in_str[3], const complex float* low, const complex float* hgh, unsigned int flen, const float filter[2][flen])
+{
+	if (1 == dims[0]) {
+
+		switch (flen) {
+		case 2:  up_rows(dims, out_str, out, in_str, low, hgh, 2, filter); break;
+		case 4:  up_rows(dims, out_str, out, in_str, low, hgh, 4, filter); break;
+		case 10: up_rows(dims, out_str, out, in_str, low, hgh, 10, filter); break;
+		default: up_rows(dims, out_str, out, in_str, low, hgh, flen, filter);
+		}
+
+		return;
+	}
+
+	long B = bandsize(dims[1], flen);
+
+	assert(CFL_SIZE == in_str[0]);
+	assert(CFL_SIZE == out_str[0]);
+
+#pragma omp parallel for collapse(2)
+	for (long i = 0; i < dims[2]; i++) {
+		for (long j = 0; j < dims[1]; j++) {
+
+			long n[flen];
+			unsigned int c[flen];
+			unsigned int m = up_coords(j, B, flen, n, c);
+
+			const float* src[2 * flen];
+			float coef[2 * flen];
+
+			for (unsigned int l = 0; l < m; l++) {
+
+				src[2 * l + 0] = (const float*)caccess(in_str, low, i, n[l], 0);
+				src[2 * l + 1] = (const float*)caccess(in_str, hgh, i, n[l], 0);
+				coef[2 * l + 0] = filter[0][c[l]];
+				coef[2 * l + 1] = filter[1][c[l]];
 			}
+
+			up_taps(2 * dims[0], (float*)access(out_str, out, i, j, 0), m, src, coef);
+		}
+	}
 }
 
 
@@ -168,8 +440,7 @@ void fwt1(unsigned int N, unsigned int d, const long dims[N], const long ostr[N]
 #endif
 
 	// no clear needed
-	wavelet_down3(wdims, wostr, low, wistr, in, flen, filter[0][0]);
-	wavelet_down3(wdims, wostr, hgh, wistr, in, flen, filter[0][1]);
+	wavelet_down3(wdims, wostr, low, hgh, wistr, in, flen, filter[0]);
 }
 
 
@@ -200,11 +471,11 @@ void iwt1(unsigned int N, unsigned int d, const long dims[N], const long ostr[N]
 	long wistr[3] = { CFL_SIZE, istr[d], CFL_SIZE * md_calc_size(o, idims) };
 	long wostr[3] = { CFL_SIZE, ostr[d], CFL_SIZE * md_calc_size(o, dims) };
 
-	md_clear(3, wdims, out, CFL_SIZE);	// we cannot clear because we merge outputs
-
 #ifdef  USE_CUDA
 	if (cuda_ondevice(out)) {
 
+		md_clear(3, wdims, out, CFL_SIZE);	// we cannot clear because we merge outputs
+
 		assert(cuda_ondevice(low));
 		assert(cuda_ondevice(hgh));
 
@@ -220,8 +491,8 @@ void iwt1(unsigned int N, unsigned int d, const long dims[N], const long ostr[N]
 	}
 #endif
 
-	wavelet_up3(wdims, wostr, out, wistr, low, flen, filter[1][0]);
-	wavelet_up3(wdims, wostr, out, wistr, hgh, flen, filter[1][1]);
+	// no clear needed, both bands are combined in one pass
+	wavelet_up3(wdims, wostr, out, wistr, low, hgh, flen, filter[1]);
 }
 
 
@@ -48,11 +48,16 @@ __host__ __device__ int coord(int l, int x, int flen, int k)
 {
 	int n = 2 * l + 1 - (flen - 1) + k;
 
-	if (n < 0)
-		n = -n - 1;
+	// repeat the reflection for signals shorter than the filter
 
-	if (n >= x)
-		n = x - 1 - (n - x);
+	while ((n < 0) || (n >= x)) {
+
+		if (n < 0)
+			n = -n - 1;
+
+		if (n >= x)
+			n = x - 1 - (n - x);
+	}
 
 	return n;
 }